@@ -1,10 +1,13 @@
 #pragma once
 
 #include "logging.h"
+#include <cstddef>
+#include <cstdint>
 #include <shared_mutex>
 #include <string>
 
 // forward declarations
+class DirFdCache;
 struct MountState;
 class VirtualFileTreeItem;
 class QProcess;
@@ -37,6 +40,47 @@ static constexpr unsigned int RECURSIVE =
     0x00000008;  // if set, directories are linked recursively
 }  // namespace linkFlag
 
+/**
+ * Caching options applied to each mount. The defaults of the kernel caching options
+ * match the libfuse defaults
+ */
+struct FuseCacheOptions
+{
+  double entryTimeout    = 1.0;  // seconds to cache name lookups
+  double attrTimeout     = 1.0;  // seconds to cache file attributes
+  // seconds to cache failed lookups, 0 disables it. Ignored by high level mounts that
+  // watch their sources, see setWatchSources
+  double negativeTimeout = 0.0;
+  bool kernelCache       = false;  // keep the page cache of files between opens
+  // like kernelCache, but invalidate on mtime or size changes. High level API only
+  bool autoCache                   = false;
+  unsigned int maxReadahead        = 0;  // in bytes, 0 uses the kernel default
+  unsigned int maxBackground       = 0;  // 0 uses the libfuse default
+  unsigned int congestionThreshold = 0;  // 0 uses the libfuse default
+  // number of missing paths remembered by usvfs to answer repeated lookups without
+  // searching the file tree, 0 disables it. High level API only
+  unsigned int negativeLookupCacheSize = 4096;
+  // index the full virtual paths of the file tree, so a lookup takes a single hash
+  // table probe instead of walking the tree. High level API only
+  bool pathIndex = true;
+  // seconds usvfs keeps the attributes of the real files to answer getattr without a
+  // system call, 0 disables it. Changes made through the mount drop them, changes made
+  // outside of it are only seen once they expire or through setWatchSources
+  double attributeCacheTimeout = 0.0;
+};
+
+/**
+ * Counters of the file descriptors of real directories kept open by all mounts
+ */
+struct DirectoryFdStats
+{
+  uint64_t hits      = 0;  // uses of a directory whose file descriptor was open
+  uint64_t misses    = 0;  // uses that opened the directory again
+  uint64_t evictions = 0;  // file descriptors closed to stay within the budget
+  size_t open        = 0;  // open file descriptors counting towards the budget
+  size_t pinned      = 0;  // open file descriptors of directories that are mounted over
+};
+
 class __attribute__((visibility("default"))) UsvfsManager
 {
 public:
@@ -66,7 +110,8 @@ public:
 
   /**
    * link a directory virtually. This static variant recursively links all files
-   * individually, change notifications are used to update the information.
+   * individually, change notifications are used to update the information if enabled
+   * with setWatchSources.
    * (virtually or physically)
    */
   bool usvfsVirtualLinkDirectoryStatic(const std::string& source,
@@ -185,6 +230,70 @@ public:
   // set whether to create mounts in a new user mount namespace
   void setUseMountNamespace(bool value) noexcept;
 
+  /**
+   * @brief Set the number of worker threads used to process FUSE requests of each
+   * mount. Applies to mounts created after calling this function
+   * @param maxThreads Maximum number of worker threads, 0 uses the single-threaded
+   * loop
+   * @param maxIdleThreads Maximum number of idle worker threads to keep around
+   * @note Mounts in a mount namespace always use the single-threaded loop
+   */
+  void setFuseThreads(unsigned int maxThreads, unsigned int maxIdleThreads) noexcept;
+
+  /**
+   * @brief Set whether to use the inode based low level FUSE API instead of the path
+   * based high level API. Applies to mounts created after calling this function
+   */
+  void setUseLowLevelApi(bool value) noexcept;
+
+  /**
+   * @brief Set the kernel caching options. Applies to mounts created after calling this
+   * function
+   * @note Virtual file trees rarely change after mounting, so long timeouts avoid most
+   * getattr and lookup requests
+   */
+  void setCacheOptions(const FuseCacheOptions& options) noexcept;
+
+  /**
+   * @brief Set whether to register opened files with the kernel so reads and writes
+   * bypass the daemon. Applies to mounts created after calling this function
+   * @note Requires kernel 6.9 or later, libfuse 3.16 or later and CAP_SYS_ADMIN. Files
+   * are served by the daemon if passthrough is not available
+   */
+  void setPassthrough(bool value) noexcept;
+
+  /**
+   * @brief Set the directory to store a cache of the directory listings each mount is
+   * built from. Linking directories that did not change since the last mount does not
+   * read them again. Applies to directories linked after calling this function
+   * @param directory The cache directory, empty disables the cache
+   */
+  void setTreeCacheDir(std::string directory) noexcept;
+
+  /**
+   * @brief Set whether to watch the linked directories with inotify while mounted, so
+   * files added to or removed from them outside the mount show up in the mount without
+   * mounting it again. Applies to mounts created after calling this function
+   * @note Adding the watches reads the linked directories again when mounting. Each
+   * watched directory counts towards fs.inotify.max_user_watches
+   * @note Mounts using the high level API do not cache failed lookups in the kernel
+   * while watching, because it cannot drop them for the added files. The negative
+   * timeout of the cache options is ignored for them
+   */
+  void setWatchSources(bool value) noexcept;
+
+  /**
+   * @brief Set the maximum number of file descriptors of linked directories kept open
+   * by all mounts. Directories are opened on first use and the least recently used ones
+   * are closed once the budget is exceeded. The directories that are mounted over are
+   * always kept open and do not count towards the budget
+   * @param budget Maximum number of open file descriptors, 0 uses half of the
+   * RLIMIT_NOFILE soft limit, which is raised towards the hard limit on startup
+   */
+  void setDirectoryFdBudget(size_t budget) noexcept;
+
+  [[nodiscard]] DirectoryFdStats directoryFdStats() const noexcept;
+
   static bool
   fileNameInSkipSuffixes(const std::string& fileName,
                          const std::set<std::string>& skipSuffixes) noexcept;
@@ -214,9 +323,16 @@ private:
   // mount function without locking for internal use
   bool mountInternal() noexcept;
 
-  bool m_debugMode         = false;
-  bool m_useMountNamespace = false;
+  bool m_debugMode                  = false;
+  bool m_useMountNamespace          = false;
+  bool m_useLowLevelApi             = false;
+  bool m_passthrough                = false;
+  bool m_watchSources               = false;
+  unsigned int m_fuseMaxThreads     = 0;
+  unsigned int m_fuseMaxIdleThreads = 0;
+  FuseCacheOptions m_cacheOptions;
   std::string m_upperDir;
+  std::string m_treeCacheDir;
   std::chrono::milliseconds m_processDelay = std::chrono::milliseconds::zero();
   std::set<std::string> m_skipFileSuffixes;
   std::set<std::string> m_skipDirectories;
@@ -227,6 +343,8 @@ private:
   pid_t m_nsPidFd = -1;  // file descriptor to access the mount namespace
   std::vector<std::unique_ptr<MountState>> m_mounts;
   std::vector<std::unique_ptr<MountState>> m_pendingMounts;
+  // file descriptors of the real directories of all mounts
+  std::shared_ptr<DirFdCache> m_dirFds;
   std::vector<pid_t> m_spawnedProcesses;
   std::shared_ptr<spdlog::sinks::rotating_file_sink<std::mutex>> m_fileSink;
 };
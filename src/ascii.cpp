@@ -0,0 +1,266 @@
+#include "ascii.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define USVFS_X86
+#endif
+
+using namespace std;
+
+namespace
+{
+constexpr char lowerAscii(char c) noexcept
+{
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+constexpr char upperAscii(char c) noexcept
+{
+  return c >= 'a' && c <= 'z' ? static_cast<char>(c - ('a' - 'A')) : c;
+}
+
+// scalar implementations, used for the bytes that do not fill a vector
+bool isAsciiScalar(const char* data, size_t length) noexcept
+{
+  unsigned char bits = 0;
+  for (size_t i = 0; i < length; ++i) {
+    bits |= static_cast<unsigned char>(data[i]);
+  }
+  return bits < 0x80;
+}
+
+void toLowerScalar(const char* src, char* dst, size_t length) noexcept
+{
+  for (size_t i = 0; i < length; ++i) {
+    dst[i] = lowerAscii(src[i]);
+  }
+}
+
+void toUpperScalar(const char* src, char* dst, size_t length) noexcept
+{
+  for (size_t i = 0; i < length; ++i) {
+    dst[i] = upperAscii(src[i]);
+  }
+}
+
+optional<bool> iequalsScalar(const char* lhs, const char* rhs, size_t length) noexcept
+{
+  for (size_t i = 0; i < length; ++i) {
+    if ((lhs[i] | rhs[i]) & 0x80) {
+      return nullopt;
+    }
+    if (lowerAscii(lhs[i]) != lowerAscii(rhs[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef USVFS_X86
+// bytes are compared as signed values, so non ASCII bytes are never in a letter range
+// and are left unchanged by the case conversions
+
+// false until initialized, so calls during static initialization use SSE2
+const bool hasAvx2 = [] {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}();
+
+__m128i lowerSse2(__m128i v) noexcept
+{
+  const __m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                        _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+  return _mm_or_si128(v, _mm_and_si128(isUpper, _mm_set1_epi8(0x20)));
+}
+
+__m128i upperSse2(__m128i v) noexcept
+{
+  const __m128i isLower = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)),
+                                        _mm_cmplt_epi8(v, _mm_set1_epi8('z' + 1)));
+  return _mm_andnot_si128(_mm_and_si128(isLower, _mm_set1_epi8(0x20)), v);
+}
+
+__m128i load(const char* p) noexcept
+{
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+void store(char* p, __m128i v) noexcept
+{
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+__attribute__((target("avx2"))) __m256i lowerAvx2(__m256i v) noexcept
+{
+  const __m256i isUpper =
+      _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+  return _mm256_or_si256(v, _mm256_and_si256(isUpper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2"))) __m256i upperAvx2(__m256i v) noexcept
+{
+  const __m256i isLower =
+      _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), v));
+  return _mm256_andnot_si256(_mm256_and_si256(isLower, _mm256_set1_epi8(0x20)), v);
+}
+
+__attribute__((target("avx2"))) __m256i load256(const char* p) noexcept
+{
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+__attribute__((target("avx2"))) void store256(char* p, __m256i v) noexcept
+{
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+// the AVX2 functions return the number of bytes processed, the rest is handled by the
+// SSE2 and scalar code
+
+__attribute__((target("avx2"))) size_t isAsciiAvx2(const char* data, size_t length,
+                                                   bool& ascii) noexcept
+{
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    if (_mm256_movemask_epi8(load256(data + i)) != 0) {
+      ascii = false;
+      return i;
+    }
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t toLowerAvx2(const char* src, char* dst,
+                                                   size_t length) noexcept
+{
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    store256(dst + i, lowerAvx2(load256(src + i)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t toUpperAvx2(const char* src, char* dst,
+                                                   size_t length) noexcept
+{
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    store256(dst + i, upperAvx2(load256(src + i)));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) size_t
+iequalsAvx2(const char* lhs, const char* rhs, size_t length,
+            optional<bool>& result) noexcept
+{
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    const __m256i a = load256(lhs + i);
+    const __m256i b = load256(rhs + i);
+    if (_mm256_movemask_epi8(_mm256_or_si256(a, b)) != 0) {
+      result = nullopt;
+      return i;
+    }
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(lowerAvx2(a), lowerAvx2(b))) != -1) {
+      result = false;
+      return i;
+    }
+  }
+  return i;
+}
+#endif
+}  // namespace
+
+bool isAscii(string_view str) noexcept
+{
+  const char* data = str.data();
+  size_t length    = str.length();
+
+#ifdef USVFS_X86
+  if (hasAvx2) {
+    bool ascii           = true;
+    const size_t checked = isAsciiAvx2(data, length, ascii);
+    if (!ascii) {
+      return false;
+    }
+    data += checked;
+    length -= checked;
+  }
+
+  for (; length >= 16; data += 16, length -= 16) {
+    if (_mm_movemask_epi8(load(data)) != 0) {
+      return false;
+    }
+  }
+#endif
+
+  return isAsciiScalar(data, length);
+}
+
+void asciiToLower(const char* src, char* dst, size_t length) noexcept
+{
+#ifdef USVFS_X86
+  if (hasAvx2) {
+    const size_t converted = toLowerAvx2(src, dst, length);
+    src += converted;
+    dst += converted;
+    length -= converted;
+  }
+
+  for (; length >= 16; src += 16, dst += 16, length -= 16) {
+    store(dst, lowerSse2(load(src)));
+  }
+#endif
+
+  toLowerScalar(src, dst, length);
+}
+
+void asciiToUpper(const char* src, char* dst, size_t length) noexcept
+{
+#ifdef USVFS_X86
+  if (hasAvx2) {
+    const size_t converted = toUpperAvx2(src, dst, length);
+    src += converted;
+    dst += converted;
+    length -= converted;
+  }
+
+  for (; length >= 16; src += 16, dst += 16, length -= 16) {
+    store(dst, upperSse2(load(src)));
+  }
+#endif
+
+  toUpperScalar(src, dst, length);
+}
+
+optional<bool> asciiIEquals(const char* lhs, const char* rhs, size_t length) noexcept
+{
+#ifdef USVFS_X86
+  if (hasAvx2) {
+    optional<bool> result = true;
+    const size_t compared = iequalsAvx2(lhs, rhs, length, result);
+    if (result != true) {
+      return result;
+    }
+    lhs += compared;
+    rhs += compared;
+    length -= compared;
+  }
+
+  for (; length >= 16; lhs += 16, rhs += 16, length -= 16) {
+    const __m128i a = load(lhs);
+    const __m128i b = load(rhs);
+    if (_mm_movemask_epi8(_mm_or_si128(a, b)) != 0) {
+      return nullopt;
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(lowerSse2(a), lowerSse2(b))) != 0xffff) {
+      return false;
+    }
+  }
+#endif
+
+  return iequalsScalar(lhs, rhs, length);
+}
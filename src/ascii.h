@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+// kernels for the ASCII fast paths of the string utilities. They process 32 bytes at a
+// time with AVX2 or 16 bytes with SSE2 depending on the CPU, other architectures use a
+// scalar implementation. Only the ASCII letters are case converted, the result does not
+// depend on the locale
+
+// check whether a string only consists of ASCII characters
+bool isAscii(std::string_view str) noexcept;
+
+// convert the upper case ASCII letters of src to lower case and write the result to
+// dst, which may be equal to src. Other bytes are copied unchanged
+void asciiToLower(const char* src, char* dst, std::size_t length) noexcept;
+
+// convert the lower case ASCII letters of src to upper case and write the result to
+// dst, which may be equal to src. Other bytes are copied unchanged
+void asciiToUpper(const char* src, char* dst, std::size_t length) noexcept;
+
+/**
+ * @brief Compare two strings of the same length ignoring the case of ASCII letters
+ * @return Whether the strings are equal, std::nullopt if non ASCII characters were
+ * found before a difference. Such strings have to be compared by other means
+ */
+std::optional<bool> asciiIEquals(const char* lhs, const char* rhs,
+                                 std::size_t length) noexcept;
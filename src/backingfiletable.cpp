@@ -0,0 +1,72 @@
+#include "backingfiletable.h"
+
+#include "logger.h"
+
+#include <linux/fuse.h>
+#include <sys/ioctl.h>
+
+using namespace std;
+
+int BackingFileTable::open(const int fuseFd, const int fd) noexcept
+{
+#ifdef FUSE_DEV_IOC_BACKING_OPEN
+  struct stat st{};
+  if (fstat(fd, &st) == -1) {
+    logger::error("fstat failed on fd {}: {}", fd, strerror(errno));
+    return 0;
+  }
+  const Key key{st.st_dev, st.st_ino};
+
+  scoped_lock lock(mtx);
+  auto& entry = backingFiles[key];
+  if (entry.backingId == 0) {
+    fuse_backing_map map{};
+    map.fd = fd;
+
+    const int backingId = ioctl(fuseFd, FUSE_DEV_IOC_BACKING_OPEN, &map);
+    if (backingId <= 0) {
+      // this requires CAP_SYS_ADMIN, the caller falls back to regular reads and writes
+      logger::debug("FUSE_DEV_IOC_BACKING_OPEN failed on fd {}: {}", fd,
+                    strerror(errno));
+      backingFiles.erase(key);
+      return 0;
+    }
+    entry.backingId = backingId;
+  }
+
+  ++entry.refCount;
+  openFiles[fd] = key;
+  return entry.backingId;
+#else
+  (void)fuseFd;
+  (void)fd;
+  return 0;
+#endif
+}
+
+void BackingFileTable::close(const int fuseFd, const int fd) noexcept
+{
+#ifdef FUSE_DEV_IOC_BACKING_CLOSE
+  scoped_lock lock(mtx);
+  const auto fileIt = openFiles.find(fd);
+  if (fileIt == openFiles.end()) {
+    return;
+  }
+
+  const auto it = backingFiles.find(fileIt->second);
+  openFiles.erase(fileIt);
+  if (it == backingFiles.end() || --it->second.refCount > 0) {
+    return;
+  }
+
+  int32_t backingId = it->second.backingId;
+  if (ioctl(fuseFd, FUSE_DEV_IOC_BACKING_CLOSE, &backingId) == -1) {
+    logger::error("FUSE_DEV_IOC_BACKING_CLOSE failed for backing id {}: {}", backingId,
+                  strerror(errno));
+  }
+  backingFiles.erase(it);
+#else
+  (void)fuseFd;
+  (void)fd;
+#endif
+}
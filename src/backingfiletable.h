@@ -0,0 +1,35 @@
+#pragma once
+
+// keeps track of the backing files registered with the kernel for FUSE passthrough.
+// The kernel only accepts a single backing file per inode, so all opened files that
+// refer to the same backing inode share one backing id
+class BackingFileTable
+{
+public:
+  /**
+   * @brief Register the file referred to by fd as a backing file
+   * @param fuseFd File descriptor of the FUSE device
+   * @param fd File descriptor of the opened backing file
+   * @return The backing id, or 0 if the file could not be registered
+   */
+  int open(int fuseFd, int fd) noexcept;
+
+  /**
+   * @brief Release the reference of an opened file, the backing file is unregistered
+   * when no opened file refers to it anymore
+   */
+  void close(int fuseFd, int fd) noexcept;
+
+private:
+  using Key = std::pair<dev_t, ino_t>;
+
+  struct Entry
+  {
+    int backingId   = 0;
+    size_t refCount = 0;
+  };
+
+  std::map<Key, Entry> backingFiles;
+  std::unordered_map<int, Key> openFiles;  // opened file descriptor to backing inode
+  std::mutex mtx;
+};
@@ -0,0 +1,542 @@
+#include "casefolding.h"
+
+#include <array>
+#include <cstdint>
+
+using namespace std;
+
+namespace
+{
+// the lower case mapping differs from the simple case folding or depends on the context
+constexpr uint8_t lowerSpecial = 1;
+// the full case folding differs from the simple case folding
+constexpr uint8_t foldSpecial = 2;
+
+// code points first, first + stride, ..., last are folded by adding delta
+struct FoldRange
+{
+  char32_t first;
+  char32_t last;
+  int32_t delta;
+  uint8_t stride;
+};
+
+struct SpecialRange
+{
+  char32_t first;
+  char32_t last;
+  uint8_t flags;
+};
+
+// simple case foldings (status C and S of CaseFolding.txt) of Unicode 15.0, matching
+// ICU 72
+constexpr FoldRange foldRanges[] = {
+    {0x0041, 0x005A, 32, 1},
+    {0x00B5, 0x00B5, 775, 1},
+    {0x00C0, 0x00D6, 32, 1},
+    {0x00D8, 0x00DE, 32, 1},
+    {0x0100, 0x012E, 1, 2},
+    {0x0132, 0x0136, 1, 2},
+    {0x0139, 0x0147, 1, 2},
+    {0x014A, 0x0176, 1, 2},
+    {0x0178, 0x0178, -121, 1},
+    {0x0179, 0x017D, 1, 2},
+    {0x017F, 0x017F, -268, 1},
+    {0x0181, 0x0181, 210, 1},
+    {0x0182, 0x0184, 1, 2},
+    {0x0186, 0x0186, 206, 1},
+    {0x0187, 0x0187, 1, 1},
+    {0x0189, 0x018A, 205, 1},
+    {0x018B, 0x018B, 1, 1},
+    {0x018E, 0x018E, 79, 1},
+    {0x018F, 0x018F, 202, 1},
+    {0x0190, 0x0190, 203, 1},
+    {0x0191, 0x0191, 1, 1},
+    {0x0193, 0x0193, 205, 1},
+    {0x0194, 0x0194, 207, 1},
+    {0x0196, 0x0196, 211, 1},
+    {0x0197, 0x0197, 209, 1},
+    {0x0198, 0x0198, 1, 1},
+    {0x019C, 0x019C, 211, 1},
+    {0x019D, 0x019D, 213, 1},
+    {0x019F, 0x019F, 214, 1},
+    {0x01A0, 0x01A4, 1, 2},
+    {0x01A6, 0x01A6, 218, 1},
+    {0x01A7, 0x01A7, 1, 1},
+    {0x01A9, 0x01A9, 218, 1},
+    {0x01AC, 0x01AC, 1, 1},
+    {0x01AE, 0x01AE, 218, 1},
+    {0x01AF, 0x01AF, 1, 1},
+    {0x01B1, 0x01B2, 217, 1},
+    {0x01B3, 0x01B5, 1, 2},
+    {0x01B7, 0x01B7, 219, 1},
+    {0x01B8, 0x01B8, 1, 1},
+    {0x01BC, 0x01BC, 1, 1},
+    {0x01C4, 0x01C4, 2, 1},
+    {0x01C5, 0x01C5, 1, 1},
+    {0x01C7, 0x01C7, 2, 1},
+    {0x01C8, 0x01C8, 1, 1},
+    {0x01CA, 0x01CA, 2, 1},
+    {0x01CB, 0x01DB, 1, 2},
+    {0x01DE, 0x01EE, 1, 2},
+    {0x01F1, 0x01F1, 2, 1},
+    {0x01F2, 0x01F4, 1, 2},
+    {0x01F6, 0x01F6, -97, 1},
+    {0x01F7, 0x01F7, -56, 1},
+    {0x01F8, 0x021E, 1, 2},
+    {0x0220, 0x0220, -130, 1},
+    {0x0222, 0x0232, 1, 2},
+    {0x023A, 0x023A, 10795, 1},
+    {0x023B, 0x023B, 1, 1},
+    {0x023D, 0x023D, -163, 1},
+    {0x023E, 0x023E, 10792, 1},
+    {0x0241, 0x0241, 1, 1},
+    {0x0243, 0x0243, -195, 1},
+    {0x0244, 0x0244, 69, 1},
+    {0x0245, 0x0245, 71, 1},
+    {0x0246, 0x024E, 1, 2},
+    {0x0345, 0x0345, 116, 1},
+    {0x0370, 0x0372, 1, 2},
+    {0x0376, 0x0376, 1, 1},
+    {0x037F, 0x037F, 116, 1},
+    {0x0386, 0x0386, 38, 1},
+    {0x0388, 0x038A, 37, 1},
+    {0x038C, 0x038C, 64, 1},
+    {0x038E, 0x038F, 63, 1},
+    {0x0391, 0x03A1, 32, 1},
+    {0x03A3, 0x03AB, 32, 1},
+    {0x03C2, 0x03C2, 1, 1},
+    {0x03CF, 0x03CF, 8, 1},
+    {0x03D0, 0x03D0, -30, 1},
+    {0x03D1, 0x03D1, -25, 1},
+    {0x03D5, 0x03D5, -15, 1},
+    {0x03D6, 0x03D6, -22, 1},
+    {0x03D8, 0x03EE, 1, 2},
+    {0x03F0, 0x03F0, -54, 1},
+    {0x03F1, 0x03F1, -48, 1},
+    {0x03F4, 0x03F4, -60, 1},
+    {0x03F5, 0x03F5, -64, 1},
+    {0x03F7, 0x03F7, 1, 1},
+    {0x03F9, 0x03F9, -7, 1},
+    {0x03FA, 0x03FA, 1, 1},
+    {0x03FD, 0x03FF, -130, 1},
+    {0x0400, 0x040F, 80, 1},
+    {0x0410, 0x042F, 32, 1},
+    {0x0460, 0x0480, 1, 2},
+    {0x048A, 0x04BE, 1, 2},
+    {0x04C0, 0x04C0, 15, 1},
+    {0x04C1, 0x04CD, 1, 2},
+    {0x04D0, 0x052E, 1, 2},
+    {0x0531, 0x0556, 48, 1},
+    {0x10A0, 0x10C5, 7264, 1},
+    {0x10C7, 0x10C7, 7264, 1},
+    {0x10CD, 0x10CD, 7264, 1},
+    {0x13F8, 0x13FD, -8, 1},
+    {0x1C80, 0x1C80, -6222, 1},
+    {0x1C81, 0x1C81, -6221, 1},
+    {0x1C82, 0x1C82, -6212, 1},
+    {0x1C83, 0x1C84, -6210, 1},
+    {0x1C85, 0x1C85, -6211, 1},
+    {0x1C86, 0x1C86, -6204, 1},
+    {0x1C87, 0x1C87, -6180, 1},
+    {0x1C88, 0x1C88, 35267, 1},
+    {0x1C90, 0x1CBA, -3008, 1},
+    {0x1CBD, 0x1CBF, -3008, 1},
+    {0x1E00, 0x1E94, 1, 2},
+    {0x1E9B, 0x1E9B, -58, 1},
+    {0x1E9E, 0x1E9E, -7615, 1},
+    {0x1EA0, 0x1EFE, 1, 2},
+    {0x1F08, 0x1F0F, -8, 1},
+    {0x1F18, 0x1F1D, -8, 1},
+    {0x1F28, 0x1F2F, -8, 1},
+    {0x1F38, 0x1F3F, -8, 1},
+    {0x1F48, 0x1F4D, -8, 1},
+    {0x1F59, 0x1F5F, -8, 2},
+    {0x1F68, 0x1F6F, -8, 1},
+    {0x1F88, 0x1F8F, -8, 1},
+    {0x1F98, 0x1F9F, -8, 1},
+    {0x1FA8, 0x1FAF, -8, 1},
+    {0x1FB8, 0x1FB9, -8, 1},
+    {0x1FBA, 0x1FBB, -74, 1},
+    {0x1FBC, 0x1FBC, -9, 1},
+    {0x1FBE, 0x1FBE, -7173, 1},
+    {0x1FC8, 0x1FCB, -86, 1},
+    {0x1FCC, 0x1FCC, -9, 1},
+    {0x1FD8, 0x1FD9, -8, 1},
+    {0x1FDA, 0x1FDB, -100, 1},
+    {0x1FE8, 0x1FE9, -8, 1},
+    {0x1FEA, 0x1FEB, -112, 1},
+    {0x1FEC, 0x1FEC, -7, 1},
+    {0x1FF8, 0x1FF9, -128, 1},
+    {0x1FFA, 0x1FFB, -126, 1},
+    {0x1FFC, 0x1FFC, -9, 1},
+    {0x2126, 0x2126, -7517, 1},
+    {0x212A, 0x212A, -8383, 1},
+    {0x212B, 0x212B, -8262, 1},
+    {0x2132, 0x2132, 28, 1},
+    {0x2160, 0x216F, 16, 1},
+    {0x2183, 0x2183, 1, 1},
+    {0x24B6, 0x24CF, 26, 1},
+    {0x2C00, 0x2C2F, 48, 1},
+    {0x2C60, 0x2C60, 1, 1},
+    {0x2C62, 0x2C62, -10743, 1},
+    {0x2C63, 0x2C63, -3814, 1},
+    {0x2C64, 0x2C64, -10727, 1},
+    {0x2C67, 0x2C6B, 1, 2},
+    {0x2C6D, 0x2C6D, -10780, 1},
+    {0x2C6E, 0x2C6E, -10749, 1},
+    {0x2C6F, 0x2C6F, -10783, 1},
+    {0x2C70, 0x2C70, -10782, 1},
+    {0x2C72, 0x2C72, 1, 1},
+    {0x2C75, 0x2C75, 1, 1},
+    {0x2C7E, 0x2C7F, -10815, 1},
+    {0x2C80, 0x2CE2, 1, 2},
+    {0x2CEB, 0x2CED, 1, 2},
+    {0x2CF2, 0x2CF2, 1, 1},
+    {0xA640, 0xA66C, 1, 2},
+    {0xA680, 0xA69A, 1, 2},
+    {0xA722, 0xA72E, 1, 2},
+    {0xA732, 0xA76E, 1, 2},
+    {0xA779, 0xA77B, 1, 2},
+    {0xA77D, 0xA77D, -35332, 1},
+    {0xA77E, 0xA786, 1, 2},
+    {0xA78B, 0xA78B, 1, 1},
+    {0xA78D, 0xA78D, -42280, 1},
+    {0xA790, 0xA792, 1, 2},
+    {0xA796, 0xA7A8, 1, 2},
+    {0xA7AA, 0xA7AA, -42308, 1},
+    {0xA7AB, 0xA7AB, -42319, 1},
+    {0xA7AC, 0xA7AC, -42315, 1},
+    {0xA7AD, 0xA7AD, -42305, 1},
+    {0xA7AE, 0xA7AE, -42308, 1},
+    {0xA7B0, 0xA7B0, -42258, 1},
+    {0xA7B1, 0xA7B1, -42282, 1},
+    {0xA7B2, 0xA7B2, -42261, 1},
+    {0xA7B3, 0xA7B3, 928, 1},
+    {0xA7B4, 0xA7C2, 1, 2},
+    {0xA7C4, 0xA7C4, -48, 1},
+    {0xA7C5, 0xA7C5, -42307, 1},
+    {0xA7C6, 0xA7C6, -35384, 1},
+    {0xA7C7, 0xA7C9, 1, 2},
+    {0xA7D0, 0xA7D0, 1, 1},
+    {0xA7D6, 0xA7D8, 1, 2},
+    {0xA7F5, 0xA7F5, 1, 1},
+    {0xAB70, 0xABBF, -38864, 1},
+    {0xFF21, 0xFF3A, 32, 1},
+    {0x10400, 0x10427, 40, 1},
+    {0x104B0, 0x104D3, 40, 1},
+    {0x10570, 0x1057A, 39, 1},
+    {0x1057C, 0x1058A, 39, 1},
+    {0x1058C, 0x10592, 39, 1},
+    {0x10594, 0x10595, 39, 1},
+    {0x10C80, 0x10CB2, 64, 1},
+    {0x118A0, 0x118BF, 32, 1},
+    {0x16E40, 0x16E5F, 32, 1},
+    {0x1E900, 0x1E921, 34, 1},
+};
+
+// characters whose mappings ICU has to be used for
+constexpr SpecialRange specialRanges[] = {
+    {0x00B5, 0x00B5, lowerSpecial},
+    {0x00DF, 0x00DF, foldSpecial},
+    {0x0130, 0x0130, lowerSpecial | foldSpecial},
+    {0x0149, 0x0149, foldSpecial},
+    {0x017F, 0x017F, lowerSpecial},
+    {0x01F0, 0x01F0, foldSpecial},
+    {0x0345, 0x0345, lowerSpecial},
+    {0x0390, 0x0390, foldSpecial},
+    {0x03A3, 0x03A3, lowerSpecial},
+    {0x03B0, 0x03B0, foldSpecial},
+    {0x03C2, 0x03C2, lowerSpecial},
+    {0x03D0, 0x03D1, lowerSpecial},
+    {0x03D5, 0x03D6, lowerSpecial},
+    {0x03F0, 0x03F1, lowerSpecial},
+    {0x03F5, 0x03F5, lowerSpecial},
+    {0x0587, 0x0587, foldSpecial},
+    {0x13A0, 0x13F5, lowerSpecial},
+    {0x13F8, 0x13FD, lowerSpecial},
+    {0x1C80, 0x1C88, lowerSpecial},
+    {0x1E96, 0x1E9A, foldSpecial},
+    {0x1E9B, 0x1E9B, lowerSpecial},
+    {0x1E9E, 0x1E9E, foldSpecial},
+    {0x1F50, 0x1F50, foldSpecial},
+    {0x1F52, 0x1F52, foldSpecial},
+    {0x1F54, 0x1F54, foldSpecial},
+    {0x1F56, 0x1F56, foldSpecial},
+    {0x1F80, 0x1FAF, foldSpecial},
+    {0x1FB2, 0x1FB4, foldSpecial},
+    {0x1FB6, 0x1FB7, foldSpecial},
+    {0x1FBC, 0x1FBC, foldSpecial},
+    {0x1FBE, 0x1FBE, lowerSpecial},
+    {0x1FC2, 0x1FC4, foldSpecial},
+    {0x1FC6, 0x1FC7, foldSpecial},
+    {0x1FCC, 0x1FCC, foldSpecial},
+    {0x1FD2, 0x1FD3, foldSpecial},
+    {0x1FD6, 0x1FD7, foldSpecial},
+    {0x1FE2, 0x1FE4, foldSpecial},
+    {0x1FE6, 0x1FE7, foldSpecial},
+    {0x1FF2, 0x1FF4, foldSpecial},
+    {0x1FF6, 0x1FF7, foldSpecial},
+    {0x1FFC, 0x1FFC, foldSpecial},
+    {0xAB70, 0xABBF, lowerSpecial},
+    {0xFB00, 0xFB06, foldSpecial},
+    {0xFB13, 0xFB17, foldSpecial},
+};
+
+struct Mapping
+{
+  int32_t delta = 0;
+  uint8_t flags = 0;
+
+  constexpr bool operator==(const Mapping&) const = default;
+};
+
+// the code points are split into blocks, identical blocks are only stored once. Each
+// block contains an index into the mappings for each of its code points
+constexpr size_t blockBits = 7;
+constexpr size_t blockSize = size_t{1} << blockBits;
+constexpr size_t tableEnd =
+    (max(end(foldRanges)[-1].last, end(specialRanges)[-1].last) / blockSize + 1) *
+    blockSize;
+constexpr size_t blockCount = tableEnd / blockSize;
+
+using Block = array<uint8_t, blockSize>;
+
+template <size_t MappingCount, size_t UniqueBlockCount>
+struct FoldTable
+{
+  array<Mapping, MappingCount> mappings{};
+  array<uint8_t, blockCount> blockIndices{};
+  array<Block, UniqueBlockCount> blocks{};
+  size_t mappingCount = 1;
+  size_t uniqueBlockCount = 1;
+};
+
+// builds a table with room for the largest possible number of mappings and blocks
+consteval auto buildTable()
+{
+  FoldTable<256, 256> table;
+  size_t foldIndex    = 0;
+  size_t specialIndex = 0;
+
+  for (size_t b = 0; b < blockCount; ++b) {
+    // blocks without any mappings use the first block, which only has the empty mapping
+    const auto blockEnd = static_cast<char32_t>((b + 1) * blockSize);
+    const bool hasFolds =
+        foldIndex < size(foldRanges) && foldRanges[foldIndex].first < blockEnd;
+    const bool hasSpecials = specialIndex < size(specialRanges) &&
+                             specialRanges[specialIndex].first < blockEnd;
+    if (!hasFolds && !hasSpecials) {
+      continue;
+    }
+
+    Block block{};
+    for (size_t i = 0; i < blockSize; ++i) {
+      const auto c = static_cast<char32_t>(b * blockSize + i);
+      Mapping mapping;
+
+      while (foldIndex < size(foldRanges) && foldRanges[foldIndex].last < c) {
+        ++foldIndex;
+      }
+      if (foldIndex < size(foldRanges)) {
+        const FoldRange& range = foldRanges[foldIndex];
+        if (range.first <= c && (c - range.first) % range.stride == 0) {
+          mapping.delta = range.delta;
+        }
+      }
+
+      while (specialIndex < size(specialRanges) &&
+             specialRanges[specialIndex].last < c) {
+        ++specialIndex;
+      }
+      if (specialIndex < size(specialRanges) &&
+          specialRanges[specialIndex].first <= c) {
+        mapping.flags = specialRanges[specialIndex].flags;
+      }
+
+      // most code points have no mapping, which is always the first one
+      size_t m = 0;
+      while (mapping != Mapping{} && m < table.mappingCount &&
+             table.mappings[m] != mapping) {
+        ++m;
+      }
+      if (m == table.mappingCount) {
+        if (m == table.mappings.size()) {
+          throw "too many distinct mappings";
+        }
+        table.mappings[table.mappingCount++] = mapping;
+      }
+      block[i] = static_cast<uint8_t>(m);
+    }
+
+    size_t u = 0;
+    while (u < table.uniqueBlockCount && table.blocks[u] != block) {
+      ++u;
+    }
+    if (u == table.uniqueBlockCount) {
+      if (u == table.blocks.size()) {
+        throw "too many distinct blocks";
+      }
+      table.blocks[table.uniqueBlockCount++] = block;
+    }
+    table.blockIndices[b] = static_cast<uint8_t>(u);
+  }
+
+  return table;
+}
+
+constexpr auto fullTable = buildTable();
+
+// the table shrunk to the number of mappings and blocks actually used
+constexpr auto table = [] {
+  FoldTable<fullTable.mappingCount, fullTable.uniqueBlockCount> result;
+  for (size_t i = 0; i < fullTable.mappingCount; ++i) {
+    result.mappings[i] = fullTable.mappings[i];
+  }
+  for (size_t i = 0; i < fullTable.uniqueBlockCount; ++i) {
+    result.blocks[i] = fullTable.blocks[i];
+  }
+  result.blockIndices     = fullTable.blockIndices;
+  result.mappingCount     = fullTable.mappingCount;
+  result.uniqueBlockCount = fullTable.uniqueBlockCount;
+  return result;
+}();
+
+constexpr Mapping lookup(char32_t c) noexcept
+{
+  if (c >= tableEnd) {
+    return {};
+  }
+  return table.mappings[table.blocks[table.blockIndices[c >> blockBits]]
+                                    [c & (blockSize - 1)]];
+}
+
+static_assert(lookup(U'A').delta == 'a' - 'A');
+static_assert(lookup(U'a').delta == 0);
+static_assert(lookup(U'Ä') == Mapping{U'ä' - U'Ä', 0});
+static_assert(lookup(U'Ж').delta == U'ж' - U'Ж');
+static_assert(lookup(U'ß').flags == foldSpecial);
+static_assert(lookup(U'Σ').flags == lowerSpecial);
+static_assert(lookup(U'テ') == Mapping{});
+
+/**
+ * @brief Decode the UTF-8 sequence at the start of str
+ * @return Length of the sequence, 0 if it is invalid
+ */
+size_t decode(string_view str, char32_t& c) noexcept
+{
+  const auto byte = [&](size_t i) {
+    return static_cast<unsigned char>(str[i]);
+  };
+  const auto isContinuation = [&](size_t i) {
+    return i < str.length() && (byte(i) & 0xC0) == 0x80;
+  };
+
+  const unsigned char lead = byte(0);
+  if (lead < 0x80) {
+    c = lead;
+    return 1;
+  }
+
+  size_t length;
+  char32_t min;
+  if ((lead & 0xE0) == 0xC0) {
+    length = 2;
+    min    = 0x80;
+    c      = lead & 0x1F;
+  } else if ((lead & 0xF0) == 0xE0) {
+    length = 3;
+    min    = 0x800;
+    c      = lead & 0x0F;
+  } else if ((lead & 0xF8) == 0xF0) {
+    length = 4;
+    min    = 0x10000;
+    c      = lead & 0x07;
+  } else {
+    return 0;
+  }
+
+  for (size_t i = 1; i < length; ++i) {
+    if (!isContinuation(i)) {
+      return 0;
+    }
+    c = (c << 6) | (byte(i) & 0x3F);
+  }
+
+  // reject overlong encodings, surrogates and code points outside of Unicode
+  if (c < min || (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+    return 0;
+  }
+  return length;
+}
+
+void encode(char32_t c, string& str) noexcept
+{
+  if (c < 0x80) {
+    str.push_back(static_cast<char>(c));
+  } else if (c < 0x800) {
+    str.push_back(static_cast<char>(0xC0 | (c >> 6)));
+    str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+  } else if (c < 0x10000) {
+    str.push_back(static_cast<char>(0xE0 | (c >> 12)));
+    str.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+    str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+  } else {
+    str.push_back(static_cast<char>(0xF0 | (c >> 18)));
+    str.push_back(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+    str.push_back(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+    str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+  }
+}
+}  // namespace
+
+bool unicodeToLower(string_view str, string& result) noexcept
+{
+  result.clear();
+  result.reserve(str.length());
+
+  while (!str.empty()) {
+    char32_t c;
+    const size_t length = decode(str, c);
+    if (length == 0) {
+      return false;
+    }
+
+    const Mapping mapping = lookup(c);
+    if (mapping.flags & lowerSpecial) {
+      return false;
+    }
+    if (mapping.delta == 0) {
+      result.append(str.substr(0, length));
+    } else {
+      encode(static_cast<char32_t>(c + mapping.delta), result);
+    }
+    str.remove_prefix(length);
+  }
+  return true;
+}
+
+optional<bool> unicodeIEquals(string_view lhs, string_view rhs) noexcept
+{
+  while (!lhs.empty() && !rhs.empty()) {
+    char32_t a;
+    char32_t b;
+    const size_t lengthA = decode(lhs, a);
+    const size_t lengthB = decode(rhs, b);
+    if (lengthA == 0 || lengthB == 0) {
+      return nullopt;
+    }
+
+    const Mapping mappingA = lookup(a);
+    const Mapping mappingB = lookup(b);
+    if ((mappingA.flags | mappingB.flags) & foldSpecial) {
+      return nullopt;
+    }
+    if (a + mappingA.delta != b + mappingB.delta) {
+      return false;
+    }
+    lhs.remove_prefix(lengthA);
+    rhs.remove_prefix(lengthB);
+  }
+  return lhs.empty() && rhs.empty();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+// case mapping of UTF-8 strings using a built in table of the Unicode simple case
+// foldings, without converting them to UTF-16. Characters the table cannot handle on
+// their own, like those with full case foldings or context dependent lower case
+// mappings, are reported to the caller, who has to fall back to ICU. So are invalid
+// UTF-8 sequences
+
+/**
+ * @brief Convert a UTF-8 string to lower case, reusing the memory of result
+ * @return Whether the string could be converted. If not, the content of result is
+ * unspecified
+ */
+bool unicodeToLower(std::string_view str, std::string& result) noexcept;
+
+/**
+ * @brief Compare two UTF-8 strings ignoring case
+ * @return Whether the strings are equal, std::nullopt if characters the table cannot
+ * fold were found before a difference
+ */
+std::optional<bool> unicodeIEquals(std::string_view lhs, std::string_view rhs) noexcept;
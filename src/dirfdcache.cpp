@@ -0,0 +1,423 @@
+#include "dirfdcache.h"
+
+#include "epoch.h"
+#include "logger.h"
+#include "usvfs.h"
+
+using namespace std;
+
+namespace
+{
+// retired file descriptors are stored in the pointer itself, so closing them later
+// does not allocate
+void* fdToPointer(int fd) noexcept
+{
+  return reinterpret_cast<void*>(static_cast<uintptr_t>(fd) + 1);
+}
+
+void closeRetired(void* p) noexcept
+{
+  close(static_cast<int>(reinterpret_cast<uintptr_t>(p) - 1));
+}
+
+int openDirectory(const string& path) noexcept
+{
+  const int fd = open(path.c_str(), OPEN_FLAGS | O_CLOEXEC);
+  if (fd == -1) {
+    const int error = errno;
+    logger::warn("error opening directory {}: {}", path, strerror(error));
+    errno = error;
+    return -1;
+  }
+  logger::trace("opened fd {} for {}", fd, path);
+  return fd;
+}
+}  // namespace
+
+DirFdCache::DirFdCache(size_t budget) noexcept
+    : m_budget(max<size_t>(budget, 1))
+{}
+
+DirFdCache::~DirFdCache()
+{
+  for (auto& chunk : m_chunks) {
+    Entry* entries = chunk.load(memory_order_relaxed);
+    if (entries == nullptr) {
+      break;
+    }
+    for (size_t i = 0; i < chunkSize; ++i) {
+      if (const int fd = entries[i].fd.load(memory_order_relaxed); fd != -1) {
+        close(fd);
+      }
+    }
+    delete[] entries;
+  }
+}
+
+DirId DirFdCache::acquire(string path, int fd, bool pinned,
+                          const struct stat* st) noexcept
+{
+  struct stat fdStat;
+  if (st == nullptr && fd != -1 && fstat(fd, &fdStat) == 0) {
+    st = &fdStat;
+  }
+
+  scoped_lock lock(m_mtx);
+
+  const DirId id = find(path, st);
+  Entry* e       = id != invalidDir ? entry(id) : nullptr;
+  if (e != nullptr && st != nullptr && e->hasInode &&
+      e->inode != Inode{st->st_dev, st->st_ino}) {
+    // the directory at the path was replaced
+    releaseFd(*e);
+  }
+  if (fd == -1 && pinned && (e == nullptr || e->fd.load(memory_order_relaxed) == -1)) {
+    // pinned directories may not be reachable by path later
+    fd = openDirectory(path);
+    if (fd == -1) {
+      return invalidDir;
+    }
+  }
+
+  try {
+    if (e != nullptr) {
+      addRef(id, *e, fd, pinned, st);
+      return id;
+    }
+    if (const DirId added = addEntry(path, fd, pinned, st); added != invalidDir) {
+      return added;
+    }
+  } catch (const bad_alloc&) {
+    logger::error("error adding directory {}: {}", path, strerror(ENOMEM));
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  return invalidDir;
+}
+
+void DirFdCache::release(DirId id) noexcept
+{
+  scoped_lock lock(m_mtx);
+
+  Entry* e = entry(id);
+  if (e == nullptr || e->refs == 0) {
+    return;
+  }
+  if (--e->refs == 0) {
+    removeEntry(id, *e);
+  }
+}
+
+void DirFdCache::replace(DirId id, int fd) noexcept
+{
+  struct stat st;
+  const bool hasStat = fd != -1 && fstat(fd, &st) == 0;
+
+  scoped_lock lock(m_mtx);
+
+  Entry* e = entry(id);
+  if (e == nullptr || e->refs == 0) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return;
+  }
+  if (fd == -1 && e->pinned) {
+    return;
+  }
+  releaseFd(*e);
+
+  if (fd != -1) {
+    try {
+      if (hasStat) {
+        setInode(id, *e, st);
+      }
+      storeFd(id, *e, fd);
+    } catch (const bad_alloc&) {
+      // opened again on next use
+      close(fd);
+    }
+  }
+}
+
+bool DirFdCache::isPinned(DirId id) const noexcept
+{
+  scoped_lock lock(m_mtx);
+  const Entry* e = entry(id);
+  return e != nullptr && e->pinned;
+}
+
+int DirFdCache::get(DirId id) noexcept
+{
+  Entry* e = entry(id);
+  if (e == nullptr) {
+    errno = EBADF;
+    return -1;
+  }
+
+  if (const int fd = e->fd.load(memory_order_acquire); fd != -1) {
+    // only written if not set yet, to not invalidate the cache line on every use
+    if (!e->recent.load(memory_order_relaxed)) {
+      e->recent.store(true, memory_order_relaxed);
+    }
+    m_hits.fetch_add(1, memory_order_relaxed);
+    return fd;
+  }
+
+  // opening under the lock keeps concurrent misses of the same directory from opening
+  // it twice
+  scoped_lock lock(m_mtx);
+  if (const int fd = e->fd.load(memory_order_relaxed); fd != -1) {
+    m_hits.fetch_add(1, memory_order_relaxed);
+    return fd;
+  }
+  if (e->refs == 0) {
+    errno = EBADF;
+    return -1;
+  }
+  if (e->pinned) {
+    logger::warn("not opening directory {} again, it may be below a mount point",
+                 e->path);
+    errno = EBADF;
+    return -1;
+  }
+
+  try {
+    reserveSlot();
+  } catch (const bad_alloc&) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  const int fd = openDirectory(e->path);
+  if (fd == -1) {
+    return -1;
+  }
+  if (struct stat st; !e->hasInode && fstat(fd, &st) == 0) {
+    // directories registered by path are found by their inode from now on
+    try {
+      setInode(id, *e, st);
+    } catch (const bad_alloc&) {
+      // only found by path
+    }
+  }
+  adoptFd(id, *e, fd);
+  m_misses.fetch_add(1, memory_order_relaxed);
+  return fd;
+}
+
+void DirFdCache::setBudget(size_t budget) noexcept
+{
+  scoped_lock lock(m_mtx);
+  m_budget = max<size_t>(budget, 1);
+}
+
+DirFdCache::Stats DirFdCache::stats() const noexcept
+{
+  return {m_hits.load(memory_order_relaxed), m_misses.load(memory_order_relaxed),
+          m_evictions.load(memory_order_relaxed), m_open.load(memory_order_relaxed),
+          m_pinned.load(memory_order_relaxed)};
+}
+
+DirFdCache::Entry* DirFdCache::entry(DirId id) const noexcept
+{
+  if (id >= maxChunks * chunkSize) {
+    return nullptr;
+  }
+  Entry* entries = m_chunks[id >> chunkBits].load(memory_order_acquire);
+  return entries != nullptr ? &entries[id & (chunkSize - 1)] : nullptr;
+}
+
+DirId DirFdCache::find(const string& path, const struct stat* st) const noexcept
+{
+  if (const auto it = m_paths.find(path); it != m_paths.end()) {
+    return it->second;
+  }
+  if (st != nullptr) {
+    // the inode cannot be reused by another directory while a file descriptor is open
+    const auto it = m_inodes.find({st->st_dev, st->st_ino});
+    if (it != m_inodes.end() &&
+        entry(it->second)->fd.load(memory_order_relaxed) != -1) {
+      return it->second;
+    }
+  }
+  return invalidDir;
+}
+
+void DirFdCache::addRef(DirId id, Entry& e, int fd, bool pinned,
+                        const struct stat* st) noexcept(false)
+{
+  if (st != nullptr) {
+    setInode(id, e, *st);
+  }
+  if (fd != -1 && !pinned && !e.pinned) {
+    reserveSlot();
+  }
+
+  if (pinned && !e.pinned) {
+    if (e.fd.load(memory_order_relaxed) != -1) {
+      // the file descriptor no longer counts towards the budget
+      m_clock[e.slot] = invalidDir;
+      m_freeSlots.push_back(e.slot);
+      m_open.fetch_sub(1, memory_order_relaxed);
+      m_pinned.fetch_add(1, memory_order_relaxed);
+    }
+    e.pinned = true;
+  }
+  if (fd != -1) {
+    if (e.fd.load(memory_order_relaxed) == -1) {
+      storeFd(id, e, fd);
+    } else {
+      close(fd);
+    }
+  }
+  ++e.refs;
+}
+
+DirId DirFdCache::addEntry(const string& path, int fd, bool pinned,
+                           const struct stat* st) noexcept(false)
+{
+  if (m_freeIds.empty() && m_nextId == maxChunks * chunkSize) {
+    logger::error("error adding directory {}: too many directories", path);
+    return invalidDir;
+  }
+  if (fd != -1 && !pinned) {
+    reserveSlot();
+  }
+
+  const DirId id = m_freeIds.empty() ? m_nextId : m_freeIds.back();
+  auto& chunk    = m_chunks[id >> chunkBits];
+  if (chunk.load(memory_order_relaxed) == nullptr) {
+    chunk.store(new Entry[chunkSize], memory_order_release);
+  }
+
+  Entry& e = *entry(id);
+  e.path   = path;
+  m_paths.emplace(path, id);
+  if (st != nullptr) {
+    try {
+      setInode(id, e, *st);
+    } catch (const bad_alloc&) {
+      m_paths.erase(path);
+      throw;
+    }
+  }
+
+  if (m_freeIds.empty()) {
+    ++m_nextId;
+  } else {
+    m_freeIds.pop_back();
+  }
+  e.pinned = pinned;
+  e.refs   = 1;
+  if (fd != -1) {
+    storeFd(id, e, fd);
+  }
+  return id;
+}
+
+void DirFdCache::removeEntry(DirId id, Entry& e) noexcept
+{
+  releaseFd(e);
+  if (const auto it = m_paths.find(e.path); it != m_paths.end() && it->second == id) {
+    m_paths.erase(it);
+  }
+  if (const auto it = m_inodes.find(e.inode);
+      e.hasInode && it != m_inodes.end() && it->second == id) {
+    m_inodes.erase(it);
+  }
+  e.pinned   = false;
+  e.hasInode = false;
+  string().swap(e.path);
+
+  try {
+    m_freeIds.push_back(id);
+  } catch (const bad_alloc&) {
+    // the id is not reused
+  }
+}
+
+void DirFdCache::setInode(DirId id, Entry& e, const struct stat& st) noexcept(false)
+{
+  const Inode inode = {st.st_dev, st.st_ino};
+  if (e.hasInode && e.inode == inode) {
+    return;
+  }
+  m_inodes.insert_or_assign(inode, id);
+  if (const auto it = m_inodes.find(e.inode);
+      e.hasInode && it != m_inodes.end() && it->second == id) {
+    m_inodes.erase(it);
+  }
+  e.inode    = inode;
+  e.hasInode = true;
+}
+
+void DirFdCache::reserveSlot() noexcept(false)
+{
+  if (m_clock.size() == m_clock.capacity()) {
+    m_clock.reserve(max<size_t>(64, m_clock.capacity() * 2));
+  }
+  // every slot can be free at the same time
+  m_freeSlots.reserve(m_clock.capacity());
+}
+
+void DirFdCache::storeFd(DirId id, Entry& e, int fd) noexcept(false)
+{
+  if (e.pinned) {
+    e.fd.store(fd, memory_order_release);
+    m_pinned.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+  reserveSlot();
+  adoptFd(id, e, fd);
+}
+
+void DirFdCache::adoptFd(DirId id, Entry& e, int fd) noexcept
+{
+  while (m_open.load(memory_order_relaxed) >= m_budget) {
+    if (m_hand >= m_clock.size()) {
+      m_hand = 0;
+    }
+    const DirId victimId = m_clock[m_hand++];
+    if (victimId == invalidDir) {
+      continue;
+    }
+    Entry& victim = *entry(victimId);
+    // file descriptors used since the hand last passed them get a second chance
+    if (victim.recent.exchange(false, memory_order_relaxed)) {
+      continue;
+    }
+    releaseFd(victim);
+    m_evictions.fetch_add(1, memory_order_relaxed);
+  }
+
+  if (!m_freeSlots.empty()) {
+    e.slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+  } else {
+    e.slot = static_cast<uint32_t>(m_clock.size());
+    m_clock.push_back(invalidDir);
+  }
+  m_clock[e.slot] = id;
+  e.recent.store(true, memory_order_relaxed);
+  e.fd.store(fd, memory_order_release);
+  m_open.fetch_add(1, memory_order_relaxed);
+}
+
+void DirFdCache::releaseFd(Entry& e) noexcept
+{
+  const int fd = e.fd.exchange(-1, memory_order_acq_rel);
+  if (fd == -1) {
+    return;
+  }
+  logger::trace("closing fd {} for {}", fd, e.path);
+  epoch::retire(fdToPointer(fd), closeRetired);
+  if (e.pinned) {
+    m_pinned.fetch_sub(1, memory_order_relaxed);
+    return;
+  }
+  m_clock[e.slot] = invalidDir;
+  m_freeSlots.push_back(e.slot);
+  m_open.fetch_sub(1, memory_order_relaxed);
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+// identifies a directory registered in a DirFdCache
+using DirId                = uint32_t;
+constexpr DirId invalidDir = std::numeric_limits<DirId>::max();
+
+// O_PATH file descriptors of real directories, shared by all mounts. Every registered
+// directory gets a stable id, its file descriptor is opened on first use and kept open
+// until more directories than the budget are open. The descriptors to close are chosen
+// with the CLOCK algorithm, which approximates closing the least recently used ones
+// without locking on every use
+//
+// Directories are reference counted. Registering a directory again by its path or by
+// a path with the same device and inode returns the existing id, so a directory linked
+// into several mounts is only opened once
+//
+// Directories below a mount point cannot be opened again by path once it is mounted,
+// the path would be resolved through the mount. Those are added pinned, pinned file
+// descriptors are opened when they are registered, are never closed to stay within the
+// budget and do not count towards it. A directory stays pinned until all its
+// references are released
+//
+// Closed descriptors are retired to the epoch based reclamation, so a descriptor
+// returned by get stays valid as long as the caller remains inside an EpochGuard
+class DirFdCache
+{
+public:
+  struct Stats
+  {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t open;    // open file descriptors that count towards the budget
+    size_t pinned;  // open pinned file descriptors
+  };
+
+  explicit DirFdCache(size_t budget) noexcept;
+  ~DirFdCache();
+
+  DirFdCache(const DirFdCache&)            = delete;
+  DirFdCache& operator=(const DirFdCache&) = delete;
+
+  /**
+   * @brief Register a directory or take another reference to it if it is registered
+   * already
+   * @param path Real path of the directory, used to open it again once it was closed
+   * @param fd An open file descriptor of the directory that is taken over, -1 opens it
+   * on first use
+   * @param pinned Whether to keep the file descriptor open until the directory is
+   * released
+   * @param st Attributes of the directory if they are known, otherwise they are read
+   * from fd if it is set
+   * @return The id of the directory, invalidDir on error
+   */
+  DirId acquire(std::string path, int fd = -1, bool pinned = false,
+                const struct stat* st = nullptr) noexcept;
+
+  /**
+   * @brief Release a reference to a directory. The last one unregisters the directory
+   * and closes its file descriptor, the id may then be reused
+   */
+  void release(DirId id) noexcept;
+
+  /**
+   * @brief Replace the file descriptor of a directory, used when the directory at its
+   * path was replaced. The id stays valid
+   * @param fd An open file descriptor of the directory that is taken over, -1 opens it
+   * on next use. Ignored for pinned directories, which cannot be opened again
+   */
+  void replace(DirId id, int fd) noexcept;
+
+  [[nodiscard]] bool isPinned(DirId id) const noexcept;
+
+  /**
+   * @brief Get the file descriptor of a directory, opening it if necessary. The caller
+   * has to be inside an EpochGuard until it stops using the file descriptor
+   * @return The file descriptor, -1 with errno set on error
+   */
+  [[nodiscard]] int get(DirId id) noexcept;
+
+  /**
+   * @brief Set the maximum number of open file descriptors. Lowering the budget closes
+   * file descriptors as new ones are opened
+   */
+  void setBudget(size_t budget) noexcept;
+
+  [[nodiscard]] Stats stats() const noexcept;
+
+private:
+  struct Inode
+  {
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const Inode&) const noexcept = default;
+  };
+
+  struct InodeHash
+  {
+    size_t operator()(const Inode& inode) const noexcept
+    {
+      return std::hash<uint64_t>{}(inode.ino ^
+                                   (static_cast<uint64_t>(inode.dev) << 32));
+    }
+  };
+
+  struct Entry
+  {
+    std::atomic<int> fd      = -1;
+    std::atomic<bool> recent = false;  // used since the clock hand last passed it
+    // the remaining members are protected by m_mtx
+    std::string path;
+    Inode inode   = {};
+    bool hasInode = false;
+    bool pinned   = false;
+    uint32_t slot = 0;  // position in m_clock while open
+    uint32_t refs = 0;
+  };
+
+  static constexpr size_t chunkBits = 12;
+  static constexpr size_t chunkSize = size_t{1} << chunkBits;
+  static constexpr size_t maxChunks = 4096;
+
+  [[nodiscard]] Entry* entry(DirId id) const noexcept;
+
+  // id of a registered directory, invalidDir if it is unknown. The caller holds m_mtx
+  [[nodiscard]] DirId find(const std::string& path,
+                           const struct stat* st) const noexcept;
+
+  // take another reference to a registered directory. The caller holds m_mtx
+  void addRef(DirId id, Entry& e, int fd, bool pinned,
+              const struct stat* st) noexcept(false);
+
+  // register a new directory. The caller holds m_mtx
+  DirId addEntry(const std::string& path, int fd, bool pinned,
+                 const struct stat* st) noexcept(false);
+
+  // unregister a directory and free its id. The caller holds m_mtx
+  void removeEntry(DirId id, Entry& e) noexcept;
+
+  // remember the device and inode of a directory. The caller holds m_mtx
+  void setInode(DirId id, Entry& e, const struct stat& st) noexcept(false);
+
+  // make sure adoptFd and releaseFd do not need to allocate. The caller holds m_mtx
+  void reserveSlot() noexcept(false);
+
+  // store the file descriptor of an entry. The caller holds m_mtx
+  void storeFd(DirId id, Entry& e, int fd) noexcept(false);
+
+  // close file descriptors until another one fits into the budget and store fd in a
+  // free slot of m_clock. The caller holds m_mtx and reserved a slot
+  void adoptFd(DirId id, Entry& e, int fd) noexcept;
+
+  // close the file descriptor of an entry once no reader can use it anymore and free
+  // its slot. The caller holds m_mtx
+  void releaseFd(Entry& e) noexcept;
+
+  // entries are allocated in chunks that are never moved, so get does not lock
+  std::array<std::atomic<Entry*>, maxChunks> m_chunks = {};
+  DirId m_nextId = 0;
+  std::vector<DirId> m_freeIds;
+
+  // registered directories by the path they were registered with and by device and
+  // inode
+  std::unordered_map<std::string, DirId> m_paths;
+  std::unordered_map<Inode, DirId, InodeHash> m_inodes;
+
+  // ids of the open entries, invalidDir for free slots
+  std::vector<DirId> m_clock;
+  std::vector<uint32_t> m_freeSlots;
+  size_t m_hand   = 0;
+  size_t m_budget = 0;
+
+  std::atomic<uint64_t> m_hits      = 0;
+  std::atomic<uint64_t> m_misses    = 0;
+  std::atomic<uint64_t> m_evictions = 0;
+  std::atomic<size_t> m_open        = 0;
+  std::atomic<size_t> m_pinned      = 0;
+
+  mutable std::mutex m_mtx;
+};
@@ -0,0 +1,168 @@
+#include "epoch.h"
+
+using namespace std;
+
+// per thread state, records are never freed and are reused by new threads once their
+// thread has exited
+struct EpochThreadRecord
+{
+  // epoch in which the thread entered its outermost guard, 0 if it is not inside one
+  atomic<uint64_t> epoch = 0;
+  atomic<bool> inUse     = true;
+  EpochThreadRecord* next = nullptr;
+  unsigned nesting        = 0;  // only accessed by the owning thread
+};
+
+namespace
+{
+struct Retired
+{
+  void* p;
+  void (*deleter)(void*);
+  uint64_t epoch;
+};
+
+// retired objects are only collected once there are this many, so the epoch does not
+// have to be advanced by every writer
+constexpr size_t collectThreshold = 64;
+
+// records allocated with the state, threads still get a record when memory is exhausted
+// as long as not more of them are alive at once
+constexpr size_t reservedRecords = 16;
+
+struct EpochState
+{
+  EpochState() noexcept
+  {
+    for (size_t i = 0; i < reservedRecords; ++i) {
+      reserved[i].inUse.store(false, memory_order_relaxed);
+      reserved[i].next = i + 1 < reservedRecords ? &reserved[i + 1] : nullptr;
+    }
+    records.store(&reserved[0], memory_order_release);
+  }
+
+  atomic<uint64_t> epoch = 1;
+  atomic<EpochThreadRecord*> records = nullptr;
+  EpochThreadRecord reserved[reservedRecords];
+
+  mutex retiredMtx;
+  vector<Retired> retired;
+};
+
+// never destroyed, so objects can still be retired during static destruction
+EpochState& state() noexcept
+{
+  static auto* s = new EpochState;
+  return *s;
+}
+
+EpochThreadRecord* acquireRecord() noexcept
+{
+  EpochState& s = state();
+  for (;;) {
+    for (auto* record = s.records.load(memory_order_acquire); record != nullptr;
+         record       = record->next) {
+      bool inUse = false;
+      if (record->inUse.compare_exchange_strong(inUse, true, memory_order_acquire)) {
+        return record;
+      }
+    }
+
+    auto* record = new (nothrow) EpochThreadRecord;
+    if (record != nullptr) {
+      record->next = s.records.load(memory_order_relaxed);
+      while (!s.records.compare_exchange_weak(record->next, record,
+                                              memory_order_release,
+                                              memory_order_relaxed)) {
+      }
+      return record;
+    }
+
+    // every record is used and none can be allocated, wait for a thread to exit
+    this_thread::yield();
+  }
+}
+
+EpochThreadRecord& threadRecord() noexcept
+{
+  struct Owner
+  {
+    EpochThreadRecord* record = acquireRecord();
+    ~Owner() { record->inUse.store(false, memory_order_release); }
+  };
+  thread_local Owner owner;
+  return *owner.record;
+}
+
+// advance the global epoch if every thread inside a guard has observed the current one
+// and return the epoch. The caller holds the lock of the retired objects
+uint64_t tryAdvance(EpochState& s) noexcept
+{
+  atomic_thread_fence(memory_order_seq_cst);
+  const uint64_t current = s.epoch.load(memory_order_relaxed);
+  for (auto* record = s.records.load(memory_order_acquire); record != nullptr;
+       record       = record->next) {
+    const uint64_t epoch = record->epoch.load(memory_order_relaxed);
+    if (epoch != 0 && epoch != current) {
+      return current;
+    }
+  }
+  s.epoch.store(current + 1, memory_order_release);
+  return current + 1;
+}
+}  // namespace
+
+EpochGuard::EpochGuard() noexcept : m_record(threadRecord())
+{
+  if (m_record.nesting++ == 0) {
+    m_record.epoch.store(state().epoch.load(memory_order_relaxed),
+                         memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+  }
+}
+
+EpochGuard::~EpochGuard()
+{
+  if (--m_record.nesting == 0) {
+    m_record.epoch.store(0, memory_order_release);
+  }
+}
+
+void epoch::retire(void* p, void (*deleter)(void*)) noexcept
+{
+  EpochState& s = state();
+  atomic_thread_fence(memory_order_seq_cst);
+
+  vector<Retired> expired;
+  {
+    scoped_lock lock(s.retiredMtx);
+    try {
+      s.retired.push_back({p, deleter, s.epoch.load(memory_order_relaxed)});
+    } catch (const bad_alloc&) {
+      // the object stays allocated, which is safer than deleting it while it may
+      // still be read
+      return;
+    }
+    if (s.retired.size() < collectThreshold) {
+      return;
+    }
+
+    // objects retired two epochs ago cannot be accessed anymore, readers that entered
+    // their guard before they were retired have left it
+    const uint64_t current = tryAdvance(s);
+    const auto it          = ranges::partition(s.retired, [&](const Retired& r) {
+                      return r.epoch + 2 > current;
+                    }).begin();
+    try {
+      expired.assign(it, s.retired.end());
+    } catch (const bad_alloc&) {
+      return;
+    }
+    s.retired.erase(it, s.retired.end());
+  }
+
+  // deleting may retire further objects
+  for (const Retired& r : expired) {
+    r.deleter(r.p);
+  }
+}
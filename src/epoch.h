@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+
+// epoch based memory reclamation for data that is read without locks. Readers access
+// shared objects inside an EpochGuard. Writers unlink objects, so new readers cannot
+// reach them anymore, and retire them. Retired objects are deleted once every thread
+// that was inside a guard when they were retired has left it
+
+struct EpochThreadRecord;
+
+// marks the calling thread as reading shared objects, guards can be nested
+class EpochGuard
+{
+public:
+  EpochGuard() noexcept;
+  ~EpochGuard();
+
+  EpochGuard(const EpochGuard&)            = delete;
+  EpochGuard& operator=(const EpochGuard&) = delete;
+
+private:
+  EpochThreadRecord& m_record;
+};
+
+namespace epoch
+{
+// delete p by calling deleter once no reader can access it anymore
+void retire(void* p, void (*deleter)(void*)) noexcept;
+
+template <typename T>
+void retire(T* p) noexcept
+{
+  if (p != nullptr) {
+    retire(const_cast<void*>(static_cast<const void*>(p)), [](void* q) {
+      delete static_cast<T*>(q);
+    });
+  }
+}
+}  // namespace epoch
+
+// owning pointer to an object that is replaced atomically, the replaced objects are
+// retired. Readers have to load the pointer inside an EpochGuard, replacing it has to
+// be serialized by the owner
+template <typename T>
+class EpochPtr
+{
+public:
+  explicit EpochPtr(T* p = nullptr) noexcept : m_ptr(p) {}
+
+  // no reader can access the object anymore once its owner is destroyed
+  ~EpochPtr() { delete m_ptr.load(std::memory_order_relaxed); }
+
+  EpochPtr(const EpochPtr&)            = delete;
+  EpochPtr& operator=(const EpochPtr&) = delete;
+
+  [[nodiscard]] T* load() const noexcept
+  {
+    return m_ptr.load(std::memory_order_acquire);
+  }
+
+  void store(T* p) noexcept
+  {
+    epoch::retire(m_ptr.exchange(p, std::memory_order_acq_rel));
+  }
+
+private:
+  std::atomic<T*> m_ptr;
+};
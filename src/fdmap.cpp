@@ -1,29 +1,168 @@
 #include "fdmap.h"
 
+#include "epoch.h"
 #include "logger.h"
 #include "utils.h"
 
+namespace
+{
+// reference to a directory released once the items referring to it are reclaimed
+struct RetiredDir
+{
+  std::shared_ptr<DirFdCache> cache;
+  DirId dir;
+};
+
+void releaseRetired(void* p)
+{
+  const auto* retired = static_cast<RetiredDir*>(p);
+  retired->cache->release(retired->dir);
+  delete retired;
+}
+}  // namespace
+
+FdMap::FdMap(std::shared_ptr<DirFdCache> cache) noexcept
+    : dirFds(std::move(cache))
+{}
+
+FdMap::~FdMap()
+{
+  releaseAll();
+}
+
+FdMap::FdMap(FdMap&& other) noexcept
+{
+  std::scoped_lock lock(other.mtx);
+  dirFds   = std::move(other.dirFds);
+  map      = std::move(other.map);
+  shadowed = std::move(other.shadowed);
+  other.map.clear();
+  other.shadowed.clear();
+}
+
+FdMap& FdMap::operator=(FdMap&& other) noexcept
+{
+  if (this != &other) {
+    std::scoped_lock lock(mtx, other.mtx);
+    releaseAll();
+    dirFds   = std::move(other.dirFds);
+    map      = std::move(other.map);
+    shadowed = std::move(other.shadowed);
+    other.map.clear();
+    other.shadowed.clear();
+  }
+  return *this;
+}
+
+DirId FdMap::id(const std::string_view path) const noexcept
+{
+  thread_local std::string pathLc;
+  toLower(path, pathLc);
+
+  std::shared_lock lock(mtx);
+  const auto it = map.find(pathLc);
+  return it != map.end() ? it->second : invalidDir;
+}
+
 int FdMap::at(const std::string_view path) const noexcept
 {
-  try {
-    return map.at(toLower(path));
-  } catch (const std::out_of_range&) {
+  const DirId dir = id(path);
+  if (dir == invalidDir || dirFds == nullptr) {
     logger::error("error geting dirFd for '{}'", path);
+    errno = ENOENT;
     return -1;
   }
+  return dirFds->get(dir);
+}
+
+DirId FdMap::insert(const std::string_view path, const int fd, const bool pinned,
+                    const struct stat* st) noexcept
+{
+  if (dirFds == nullptr) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return invalidDir;
+  }
+
+  std::string pathLc = toLower(path);
+
+  std::scoped_lock lock(mtx);
+  if (const auto it = map.find(pathLc); it != map.end()) {
+    // items may refer to the id, so it is kept for the new directory
+    if (fd != -1) {
+      dirFds->replace(it->second, fd);
+    }
+    return it->second;
+  }
+
+  const DirId dir = dirFds->acquire(std::string(path), fd, pinned, st);
+  if (dir != invalidDir) {
+    map.emplace(std::move(pathLc), dir);
+  }
+  return dir;
 }
 
-int& FdMap::operator[](const std::string_view path) noexcept
+void FdMap::erase(const std::string_view path) noexcept
 {
-  return map[toLower(path)];
+  thread_local std::string pathLc;
+  toLower(path, pathLc);
+
+  RetiredDir* retired;
+  {
+    std::scoped_lock lock(mtx);
+    const auto it = map.find(pathLc);
+    if (it == map.end() || dirFds == nullptr) {
+      return;
+    }
+    try {
+      retired = new RetiredDir{dirFds, it->second};
+    } catch (const std::bad_alloc&) {
+      // keep the reference, it is released with the map
+      logger::error("error removing directory {}: {}", path, strerror(ENOMEM));
+      return;
+    }
+    map.erase(it);
+  }
+  epoch::retire(retired, releaseRetired);
+}
+
+void FdMap::merge(FdMap&& other) noexcept
+{
+  if (this == &other) {
+    return;
+  }
+
+  std::scoped_lock lock(mtx, other.mtx);
+  if (dirFds == nullptr) {
+    dirFds = other.dirFds;
+  }
+  for (auto& [path, dir] : other.map) {
+    if (!map.try_emplace(path, dir).second) {
+      // the items of the other map still refer to its directory
+      shadowed.push_back(dir);
+    }
+  }
+  shadowed.insert(shadowed.end(), other.shadowed.begin(), other.shadowed.end());
+  other.map.clear();
+  other.shadowed.clear();
 }
 
-std::unordered_map<std::string, int>::iterator FdMap::begin() noexcept
+DirFdCache* FdMap::cache() const noexcept
 {
-  return map.begin();
+  return dirFds.get();
 }
 
-std::unordered_map<std::string, int>::iterator FdMap::end() noexcept
+void FdMap::releaseAll() noexcept
 {
-  return map.end();
+  if (dirFds != nullptr) {
+    for (const DirId dir : map | std::views::values) {
+      dirFds->release(dir);
+    }
+    for (const DirId dir : shadowed) {
+      dirFds->release(dir);
+    }
+  }
+  map.clear();
+  shadowed.clear();
 }
@@ -1,16 +1,89 @@
 #pragma once
 
-// wrapper class for std::unordered_map that returns an invalid file descriptor instead
-// of throwing std::out_of_range and converts keys to lower case
+#include "dirfdcache.h"
+
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+// maps the real paths of directories to their entries in a DirFdCache and converts keys
+// to lower case. Lookups do not allocate memory once the lower case buffer of the
+// calling thread is large enough. The map holds a reference to each of its directories,
+// which are released when it is destroyed, so the file tree items referring to them
+// must not be used anymore at that point
+// id(), at(), insert() and erase() are synchronized and may be called from multiple
+// FUSE worker threads
 class FdMap
 {
+  struct Hash
+  {
+    using is_transparent = void;
+    size_t operator()(std::string_view path) const noexcept
+    {
+      return std::hash<std::string_view>{}(path);
+    }
+  };
+
+  using Map = std::unordered_map<std::string, DirId, Hash, std::equal_to<>>;
+
 public:
-  int at(std::string_view path) const noexcept;
-  int& operator[](std::string_view path) noexcept;
+  explicit FdMap(std::shared_ptr<DirFdCache> cache = nullptr) noexcept;
+  ~FdMap();
+
+  FdMap(const FdMap&)            = delete;
+  FdMap& operator=(const FdMap&) = delete;
+  FdMap(FdMap&& other) noexcept;
+  FdMap& operator=(FdMap&& other) noexcept;
+
+  /**
+   * @brief Get the id of a directory in the cache
+   * @return The id, invalidDir if the path is not in the map
+   */
+  [[nodiscard]] DirId id(std::string_view path) const noexcept;
 
-  std::unordered_map<std::string, int>::iterator begin() noexcept;
-  std::unordered_map<std::string, int>::iterator end() noexcept;
+  /**
+   * @brief Get the file descriptor of a directory, opening it if necessary. The caller
+   * has to be inside an EpochGuard while using it
+   * @return The file descriptor, -1 on error
+   */
+  [[nodiscard]] int at(std::string_view path) const noexcept;
+
+  /**
+   * @brief Insert a directory. A path that is already in the map keeps its id and only
+   * gets the new file descriptor if one is passed
+   * @param path Real path of the directory
+   * @param fd An open file descriptor of the directory that is taken over, -1 opens it
+   * on first use
+   * @param pinned Whether the file descriptor is kept open, see DirFdCache
+   * @param st Attributes of the directory if known, see DirFdCache::acquire
+   * @return The id of the directory, invalidDir on error
+   */
+  DirId insert(std::string_view path, int fd = -1, bool pinned = false,
+               const struct stat* st = nullptr) noexcept;
+
+  /**
+   * @brief Remove a directory that was removed from the file tree and release its
+   * reference. The reference is released once no reader can use the removed items
+   * anymore, so their id is not reused while they are read
+   * @param path Real path of the directory
+   */
+  void erase(std::string_view path) noexcept;
+
+  /**
+   * @brief Move the directories of another map using the same cache into this one
+   */
+  void merge(FdMap&& other) noexcept;
+
+  [[nodiscard]] DirFdCache* cache() const noexcept;
 
 private:
-  std::unordered_map<std::string, int> map;
+  // release all directories in the cache, the caller holds mtx
+  void releaseAll() noexcept;
+
+  std::shared_ptr<DirFdCache> dirFds;
+  Map map;
+  // directories of merged maps whose paths were already in this one
+  std::vector<DirId> shadowed;
+  mutable std::shared_mutex mtx;
 };
@@ -0,0 +1,311 @@
+#include "filemap.h"
+
+#include "epoch.h"
+
+using namespace std;
+
+namespace
+{
+constexpr size_t minCapacity = 4;
+
+// slots contain the hash of the key in the upper and the index of the entry + 1 in the
+// lower 32 bits, 0 marks an empty slot
+constexpr uint64_t slotOf(size_t index, uint32_t hash) noexcept
+{
+  return (static_cast<uint64_t>(hash) << 32) | static_cast<uint32_t>(index + 1);
+}
+}  // namespace
+
+// the entries and slots of a table never move, a table is replaced by a new one when it
+// is full or half of its entries are erased. Entries are only appended, an entry is
+// stored before its slot and the new size is published last. Erased entries are set to
+// nullptr, their slots are kept so probing continues past them
+struct FileMap::Table
+{
+  size_t capacity;
+  atomic<size_t> size   = 0;
+  atomic<size_t> erased = 0;
+  size_t slotMask       = 0;  // number of slots - 1, only used if there are slots
+  unique_ptr<atomic<const value_type*>[]> entries;
+  unique_ptr<atomic<uint64_t>[]> slots;  // nullptr for small tables
+
+  explicit Table(size_t capacity) noexcept(false)
+      : capacity(capacity), entries(make_unique<atomic<const value_type*>[]>(capacity))
+  {
+    // keep the load factor of the index at 1/2 at most
+    if (capacity > linearLimit) {
+      slotMask = capacity * 2 - 1;
+      slots    = make_unique<atomic<uint64_t>[]>(capacity * 2);
+    }
+  }
+
+  [[nodiscard]] const value_type* entry(size_t index) const noexcept
+  {
+    return entries[index].load(memory_order_acquire);
+  }
+
+  // append an entry, the caller makes sure there is room for it
+  void append(const value_type* entry, uint32_t hash) noexcept
+  {
+    const size_t index = size.load(memory_order_relaxed);
+    entries[index].store(entry, memory_order_release);
+    if (slots != nullptr) {
+      size_t pos = hash & slotMask;
+      while (slots[pos].load(memory_order_relaxed) != 0) {
+        pos = (pos + 1) & slotMask;
+      }
+      slots[pos].store(slotOf(index, hash), memory_order_release);
+    }
+    size.store(index + 1, memory_order_release);
+  }
+};
+
+void FileMap::const_iterator::skipErased() noexcept
+{
+  for (; m_index < m_size; ++m_index) {
+    m_entry = m_table->entry(m_index);
+    if (m_entry != nullptr) {
+      return;
+    }
+  }
+}
+
+FileMap::~FileMap()
+{
+  deleteTable(m_table.load(memory_order_relaxed), true);
+}
+
+FileMap::FileMap(const FileMap& other) noexcept(false)
+{
+  const Table* table = other.m_table.load(memory_order_acquire);
+  if (table == nullptr) {
+    return;
+  }
+
+  const size_t count = table->size.load(memory_order_acquire);
+  auto* copy         = new Table(max(minCapacity, bit_ceil(count)));
+  try {
+    for (size_t i = 0; i < count; ++i) {
+      if (const value_type* source = table->entry(i); source != nullptr) {
+        auto entry = make_unique<value_type>(*source);
+        copy->append(entry.get(), hashOf(entry->first));
+        entry.release();
+      }
+    }
+  } catch (...) {
+    deleteTable(copy, true);
+    throw;
+  }
+  m_table.store(copy, memory_order_release);
+}
+
+FileMap::FileMap(FileMap&& other) noexcept
+    : m_table(other.m_table.exchange(nullptr, memory_order_acq_rel))
+{}
+
+FileMap& FileMap::operator=(FileMap&& other) noexcept
+{
+  if (this != &other) {
+    deleteTable(m_table.exchange(other.m_table.exchange(nullptr, memory_order_acq_rel),
+                                 memory_order_acq_rel),
+                true);
+  }
+  return *this;
+}
+
+FileMap::const_iterator FileMap::begin() const noexcept
+{
+  const Table* table = m_table.load(memory_order_acquire);
+  if (table == nullptr) {
+    return {};
+  }
+  return {table, table->size.load(memory_order_acquire)};
+}
+
+size_t FileMap::size() const noexcept
+{
+  const Table* table = m_table.load(memory_order_acquire);
+  if (table == nullptr) {
+    return 0;
+  }
+  // entries are erased after they were appended, so reading the erased count first
+  // never yields more erased than appended entries
+  const size_t erased = table->erased.load(memory_order_acquire);
+  return table->size.load(memory_order_acquire) - erased;
+}
+
+const FileMap::value_type* FileMap::find(string_view key) const noexcept
+{
+  const Table* table = m_table.load(memory_order_acquire);
+  if (table == nullptr) {
+    return nullptr;
+  }
+  const size_t index = indexOf(*table, key);
+  return index != SIZE_MAX ? table->entry(index) : nullptr;
+}
+
+pair<const FileMap::value_type*, bool>
+FileMap::try_emplace(string key, mapped_type item) noexcept(false)
+{
+  if (const value_type* existing = find(key)) {
+    return {existing, false};
+  }
+
+  const uint32_t hash = hashOf(key);
+  auto entry          = make_unique<value_type>(std::move(key), std::move(item));
+
+  Table* table = m_table.load(memory_order_relaxed);
+  if (table == nullptr) {
+    table = createTable(minCapacity, nullptr);
+    replaceTable(table);
+  } else if (const size_t count = table->size.load(memory_order_relaxed);
+             count == table->capacity) {
+    // drop the tombstones, the table only grows if most of its entries are still used
+    const size_t used = count - table->erased.load(memory_order_relaxed);
+    table = createTable(used * 2 > count ? count * 2 : table->capacity, table);
+    replaceTable(table);
+  }
+
+  table->append(entry.get(), hash);
+  return {entry.release(), true};
+}
+
+bool FileMap::erase(string_view key) noexcept(false)
+{
+  Table* table = m_table.load(memory_order_relaxed);
+  if (table == nullptr) {
+    return false;
+  }
+
+  const size_t index = indexOf(*table, key);
+  if (index == SIZE_MAX) {
+    return false;
+  }
+
+  // the entry may still be read by concurrent lookups and iterators
+  const value_type* entry = table->entry(index);
+  table->entries[index].store(nullptr, memory_order_release);
+  const size_t erased = table->erased.load(memory_order_relaxed) + 1;
+  table->erased.store(erased, memory_order_release);
+  epoch::retire(const_cast<value_type*>(entry));
+
+  // compacting once half of the entries are erased keeps lookups and iteration fast,
+  // the copy is paid for by the erased entries
+  const size_t count = table->size.load(memory_order_relaxed);
+  if (erased == count) {
+    replaceTable(nullptr);
+  } else if (erased * 2 >= count) {
+    replaceTable(createTable(max(minCapacity, bit_ceil(count - erased)), table));
+  }
+  return true;
+}
+
+bool FileMap::replace(string_view key, mapped_type item) noexcept(false)
+{
+  Table* table = m_table.load(memory_order_relaxed);
+  if (table == nullptr) {
+    return false;
+  }
+
+  const size_t index = indexOf(*table, key);
+  if (index == SIZE_MAX) {
+    return false;
+  }
+
+  // the slot keeps pointing to the index, only the entry is swapped
+  const value_type* old = table->entry(index);
+  auto* entry           = new value_type(old->first, std::move(item));
+  table->entries[index].store(entry, memory_order_release);
+  epoch::retire(const_cast<value_type*>(old));
+  return true;
+}
+
+void FileMap::reserve(size_t count) noexcept(false)
+{
+  const Table* table = m_table.load(memory_order_relaxed);
+  if (count > (table == nullptr ? 0 : table->capacity)) {
+    replaceTable(createTable(max(minCapacity, bit_ceil(count)), table));
+  }
+}
+
+void FileMap::clear() noexcept
+{
+  if (Table* table = m_table.exchange(nullptr, memory_order_acq_rel)) {
+    epoch::retire(table, [](void* p) {
+      deleteTable(static_cast<Table*>(p), true);
+    });
+  }
+}
+
+uint32_t FileMap::hashOf(string_view key) noexcept
+{
+  const size_t hash = std::hash<string_view>{}(key);
+  return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+size_t FileMap::indexOf(const Table& table, string_view key) noexcept
+{
+  if (table.slots == nullptr) {
+    const size_t count = table.size.load(memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+      const value_type* entry = table.entry(i);
+      if (entry != nullptr && entry->first == key) {
+        return i;
+      }
+    }
+    return SIZE_MAX;
+  }
+
+  const uint32_t hash = hashOf(key);
+  for (size_t pos = hash & table.slotMask;; pos = (pos + 1) & table.slotMask) {
+    const uint64_t slot = table.slots[pos].load(memory_order_acquire);
+    if (slot == 0) {
+      return SIZE_MAX;
+    }
+    if (static_cast<uint32_t>(slot >> 32) == hash) {
+      const size_t index      = static_cast<uint32_t>(slot) - 1;
+      const value_type* entry = table.entry(index);
+      if (entry != nullptr && entry->first == key) {
+        return index;
+      }
+    }
+  }
+}
+
+FileMap::Table* FileMap::createTable(size_t capacity, const Table* from) noexcept(false)
+{
+  auto* table = new Table(capacity);
+  if (from != nullptr) {
+    const size_t count = from->size.load(memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+      if (const value_type* entry = from->entry(i); entry != nullptr) {
+        table->append(entry, hashOf(entry->first));
+      }
+    }
+  }
+  return table;
+}
+
+void FileMap::deleteTable(Table* table, bool deleteEntries) noexcept
+{
+  if (table == nullptr) {
+    return;
+  }
+  if (deleteEntries) {
+    const size_t count = table->size.load(memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+      delete table->entry(i);
+    }
+  }
+  delete table;
+}
+
+void FileMap::replaceTable(Table* table) noexcept
+{
+  if (Table* old = m_table.exchange(table, memory_order_acq_rel)) {
+    // the entries are still referenced by the new table
+    epoch::retire(old, [](void* p) {
+      deleteTable(static_cast<Table*>(p), false);
+    });
+  }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+class VirtualFileTreeItem;
+
+// map of the children of a directory keyed by the lower case file name. The entries
+// are kept in insertion order in a table of entry pointers. Small directories are
+// searched linearly, larger ones get an open addressing hash index into the table, so
+// lookups in directories with many thousands of entries stay O(1).
+// Modifications have to be serialized by the owner. Lookups and iteration may run
+// concurrently with them from threads inside an EpochGuard: entries never change once
+// inserted, new entries and tables are published atomically and replaced ones are
+// retired. Erasing leaves a tombstone in the table, which is compacted once half of it
+// are tombstones, so erasing and replacing an item are amortized O(1)
+class FileMap
+{
+  struct Table;
+
+public:
+  using key_type    = std::string;
+  using mapped_type = std::shared_ptr<VirtualFileTreeItem>;
+  using value_type  = std::pair<const std::string, mapped_type>;
+
+  // iterates over the entries that existed when begin() was called
+  class const_iterator
+  {
+  public:
+    using iterator_concept  = std::forward_iterator_tag;
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = FileMap::value_type;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = const value_type*;
+    using reference         = const value_type&;
+
+    const_iterator() noexcept = default;
+
+    [[nodiscard]] reference operator*() const noexcept { return *m_entry; }
+    [[nodiscard]] pointer operator->() const noexcept { return m_entry; }
+
+    const_iterator& operator++() noexcept
+    {
+      ++m_index;
+      skipErased();
+      return *this;
+    }
+
+    const_iterator operator++(int) noexcept
+    {
+      auto copy = *this;
+      ++*this;
+      return copy;
+    }
+
+    [[nodiscard]] bool operator==(const const_iterator& other) const noexcept
+    {
+      return m_table == other.m_table && m_index == other.m_index;
+    }
+
+    [[nodiscard]] bool operator==(std::default_sentinel_t) const noexcept
+    {
+      return m_index == m_size;
+    }
+
+  private:
+    friend class FileMap;
+
+    const_iterator(const Table* table, size_t size) noexcept
+        : m_table(table), m_size(size)
+    {
+      skipErased();
+    }
+
+    // move to the first entry at or after m_index that has not been erased. The entry
+    // is kept, so it stays valid if it is erased while the iterator points to it
+    void skipErased() noexcept;
+
+    const Table* m_table      = nullptr;
+    const value_type* m_entry = nullptr;
+    size_t m_index            = 0;
+    size_t m_size             = 0;
+  };
+
+  FileMap() noexcept = default;
+  ~FileMap();
+
+  // copies the current entries, may be called concurrently with modifications
+  FileMap(const FileMap& other) noexcept(false);
+  FileMap(FileMap&& other) noexcept;
+  FileMap& operator=(const FileMap& other) = delete;
+  FileMap& operator=(FileMap&& other) noexcept;
+
+  [[nodiscard]] const_iterator begin() const noexcept;
+  [[nodiscard]] std::default_sentinel_t end() const noexcept { return {}; }
+
+  [[nodiscard]] size_t size() const noexcept;
+  [[nodiscard]] bool empty() const noexcept { return size() == 0; }
+
+  // look up an entry, returns nullptr if the key does not exist
+  [[nodiscard]] const value_type* find(std::string_view key) const noexcept;
+
+  /**
+   * @brief Insert an entry if the key does not exist yet
+   * @return The new or existing entry and whether the entry was inserted
+   */
+  std::pair<const value_type*, bool> try_emplace(std::string key,
+                                                 mapped_type item) noexcept(false);
+
+  // erase an entry, returns whether it existed
+  bool erase(std::string_view key) noexcept(false);
+
+  // replace the item of an existing entry without changing the order of the entries or
+  // invalidating iterators, returns whether the entry existed
+  bool replace(std::string_view key, mapped_type item) noexcept(false);
+
+  void reserve(size_t count) noexcept(false);
+  void clear() noexcept;
+
+private:
+  // directories up to this size are searched linearly without an index
+  static constexpr size_t linearLimit = 8;
+
+  [[nodiscard]] static uint32_t hashOf(std::string_view key) noexcept;
+
+  // returns SIZE_MAX if the key does not exist
+  [[nodiscard]] static size_t indexOf(const Table& table,
+                                      std::string_view key) noexcept;
+
+  // allocate a table with room for capacity entries, containing the entries of from
+  // that have not been erased
+  [[nodiscard]] static Table* createTable(size_t capacity,
+                                          const Table* from) noexcept(false);
+  static void deleteTable(Table* table, bool deleteEntries) noexcept;
+
+  // publish a new table and retire the current one
+  void replaceTable(Table* table) noexcept;
+
+  std::atomic<Table*> m_table = nullptr;
+};
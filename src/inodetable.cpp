@@ -0,0 +1,47 @@
+#include "inodetable.h"
+
+#include "logger.h"
+
+fuse_ino_t InodeTable::ref(const std::shared_ptr<VirtualFileTreeItem>& item) noexcept
+{
+  const fuse_ino_t ino = toIno(item.get());
+
+  std::scoped_lock lock(mtx);
+  auto& entry = map[ino];
+  if (entry.item == nullptr) {
+    entry.item = item;
+  }
+  ++entry.lookupCount;
+  return ino;
+}
+
+void InodeTable::unref(const fuse_ino_t ino, const uint64_t count) noexcept
+{
+  // the root item is owned by the mount state
+  if (ino == FUSE_ROOT_ID) {
+    return;
+  }
+
+  std::scoped_lock lock(mtx);
+  const auto it = map.find(ino);
+  if (it == map.end()) {
+    logger::warn("attempted to forget unknown inode {}", ino);
+    return;
+  }
+
+  if (it->second.lookupCount <= count) {
+    map.erase(it);
+  } else {
+    it->second.lookupCount -= count;
+  }
+}
+
+fuse_ino_t InodeTable::toIno(const VirtualFileTreeItem* item) noexcept
+{
+  return reinterpret_cast<fuse_ino_t>(item);
+}
+
+VirtualFileTreeItem* InodeTable::fromIno(const fuse_ino_t ino) noexcept
+{
+  return reinterpret_cast<VirtualFileTreeItem*>(ino);
+}
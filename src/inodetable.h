@@ -0,0 +1,35 @@
+#pragma once
+
+class VirtualFileTreeItem;
+
+// keeps file tree items alive while the kernel holds a reference to them when using the
+// low level API. The address of an item is used as its node id, so resolving a node id
+// does not require a table lookup
+class InodeTable
+{
+public:
+  /**
+   * @brief Get the node id of an item and increase its lookup count
+   * @return The node id of the item
+   */
+  fuse_ino_t ref(const std::shared_ptr<VirtualFileTreeItem>& item) noexcept;
+
+  /**
+   * @brief Decrease the lookup count of a node id, the item is released when the count
+   * reaches zero
+   */
+  void unref(fuse_ino_t ino, uint64_t count) noexcept;
+
+  static fuse_ino_t toIno(const VirtualFileTreeItem* item) noexcept;
+  static VirtualFileTreeItem* fromIno(fuse_ino_t ino) noexcept;
+
+private:
+  struct Entry
+  {
+    std::shared_ptr<VirtualFileTreeItem> item;
+    uint64_t lookupCount = 0;
+  };
+
+  std::unordered_map<fuse_ino_t, Entry> map;
+  std::mutex mtx;
+};
@@ -0,0 +1,125 @@
+#include "invalidator.h"
+
+#include "inodetable.h"
+#include "logger.h"
+#include "utils.h"
+#include "virtualfiletreeitem.h"
+
+using namespace std;
+
+Invalidator::~Invalidator()
+{
+  stop();
+}
+
+void Invalidator::start(fuse* fusePtr) noexcept
+{
+  stop();
+  m_fuse    = fusePtr;
+  m_session = nullptr;
+  m_root    = nullptr;
+  startThread();
+}
+
+void Invalidator::start(fuse_session* session,
+                        shared_ptr<VirtualFileTreeItem> root) noexcept
+{
+  stop();
+  m_fuse    = nullptr;
+  m_session = session;
+  m_root    = std::move(root);
+  startThread();
+}
+
+void Invalidator::startThread() noexcept
+{
+  try {
+    m_thread = jthread([this](const stop_token& stopToken) {
+      run(stopToken);
+    });
+  } catch (const system_error& e) {
+    logger::error("error starting invalidation thread: {}", e.what());
+  }
+}
+
+void Invalidator::stop() noexcept
+{
+  if (m_thread.joinable()) {
+    m_thread.request_stop();
+    m_thread.join();
+  }
+  scoped_lock lock(m_mtx);
+  m_paths.clear();
+}
+
+void Invalidator::invalidate(string path) noexcept
+{
+  if (!m_thread.joinable()) {
+    return;
+  }
+
+  {
+    scoped_lock lock(m_mtx);
+    m_paths.insert(std::move(path));
+  }
+  m_cv.notify_one();
+}
+
+void Invalidator::run(const stop_token& stopToken) noexcept
+{
+  while (true) {
+    set<string> paths;
+    {
+      unique_lock lock(m_mtx);
+      if (!m_cv.wait(lock, stopToken, [this] {
+            return !m_paths.empty();
+          })) {
+        return;
+      }
+      paths.swap(m_paths);
+    }
+
+    for (const auto& path : paths) {
+      if (m_session != nullptr) {
+        invalidateNode(path);
+        continue;
+      }
+      // ENOENT means the kernel does not know the path, so there is nothing to drop
+      const int res = fuse_invalidate_path(m_fuse, path.c_str());
+      if (res != 0 && res != -ENOENT) {
+        logger::warn("fuse_invalidate_path('{}') failed: {}", path, strerror(-res));
+      }
+    }
+  }
+}
+
+void Invalidator::invalidateNode(const string& path) noexcept
+{
+  // node ids are the addresses of the items, except for the root
+  const auto toIno = [this](const VirtualFileTreeItem* item) {
+    return item == m_root.get() ? FUSE_ROOT_ID : InodeTable::toIno(item);
+  };
+
+  // ENOENT means the kernel does not know the node, so there is nothing to drop. The
+  // entry is dropped even if the item is gone, so the kernel looks it up again
+  if (path != "/") {
+    if (const auto parent = m_root->find(getParentPath(path)); parent != nullptr) {
+      const string name = getFileNameFromPath(path);
+      const int res     = fuse_lowlevel_notify_inval_entry(
+          m_session, toIno(parent.get()), name.c_str(), name.size());
+      if (res != 0 && res != -ENOENT) {
+        logger::warn("fuse_lowlevel_notify_inval_entry('{}') failed: {}", path,
+                     strerror(-res));
+      }
+    }
+  }
+
+  if (const auto item = m_root->find(path, true); item != nullptr) {
+    const int res =
+        fuse_lowlevel_notify_inval_inode(m_session, toIno(item.get()), 0, 0);
+    if (res != 0 && res != -ENOENT) {
+      logger::warn("fuse_lowlevel_notify_inval_inode('{}') failed: {}", path,
+                   strerror(-res));
+    }
+  }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+struct fuse;
+struct fuse_session;
+class VirtualFileTreeItem;
+
+// invalidates kernel cache entries asynchronously. Notifications must not be sent from
+// the execution path of a related operation because the kernel may hold locks the
+// notification needs, so they are sent from a separate thread
+class Invalidator
+{
+public:
+  ~Invalidator();
+
+  // start sending the invalidations of a mount using the high level API
+  void start(fuse* fusePtr) noexcept;
+
+  // start sending the invalidations of a mount using the low level API. The paths are
+  // resolved to the node ids of the items in the file tree when they are sent
+  void start(fuse_session* session, std::shared_ptr<VirtualFileTreeItem> root) noexcept;
+
+  // stop the thread, pending invalidations are discarded
+  void stop() noexcept;
+
+  /**
+   * @brief Queue the invalidation of the cached entry and attributes of a path. For
+   * directories this includes the cached directory listing
+   * @param path Virtual path of the item
+   */
+  void invalidate(std::string path) noexcept;
+
+private:
+  void startThread() noexcept;
+  void run(const std::stop_token& stopToken) noexcept;
+
+  // invalidate the entry of a path in its parent directory and the inode of the item
+  // using the low level API
+  void invalidateNode(const std::string& path) noexcept;
+
+  fuse* m_fuse            = nullptr;
+  fuse_session* m_session = nullptr;
+  std::shared_ptr<VirtualFileTreeItem> m_root;
+  std::set<std::string> m_paths;
+  std::mutex m_mtx;
+  std::condition_variable_any m_cv;
+  std::jthread m_thread;
+};
@@ -1,11 +1,198 @@
 #include "mountstate.h"
 
 #include "logger.h"
+#include "treecache.h"
+#include "usvfs.h"
+#include "utils.h"
+#include "virtualfiletreeitem.h"
+
+void MountState::applyConnectionOptions(fuse_conn_info* conn) noexcept
+{
+  // splice data between the backing files and /dev/fuse instead of copying it
+  conn->want |= conn->capable &
+                (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+
+#ifdef FUSE_CAP_PASSTHROUGH
+  if (passthrough && (conn->capable & FUSE_CAP_PASSTHROUGH) != 0) {
+    conn->want |= FUSE_CAP_PASSTHROUGH;
+  } else if (passthrough) {
+    logger::warn("passthrough is not supported by the kernel, disabling it");
+    passthrough = false;
+  }
+#else
+  if (passthrough) {
+    logger::warn("passthrough is not supported by libfuse, disabling it");
+    passthrough = false;
+  }
+#endif
+
+  if (cacheOptions.maxReadahead != 0) {
+    conn->max_readahead = cacheOptions.maxReadahead;
+  }
+  if (cacheOptions.maxBackground != 0) {
+    conn->max_background = cacheOptions.maxBackground;
+  }
+  if (cacheOptions.congestionThreshold != 0) {
+    conn->congestion_threshold = cacheOptions.congestionThreshold;
+  }
+}
+
+void MountState::openPassthrough(fuse_file_info* fi) noexcept
+{
+#ifdef FUSE_CAP_PASSTHROUGH
+  if (passthrough) {
+    fi->backing_id =
+        backingFiles.open(fuse_session_fd(session), static_cast<int>(fi->fh));
+  }
+#else
+  (void)fi;
+#endif
+}
+
+void MountState::releasePassthrough(const fuse_file_info* fi) noexcept
+{
+  if (passthrough) {
+    backingFiles.close(fuse_session_fd(session), static_cast<int>(fi->fh));
+  }
+}
+
+int MountState::parentFd(const VirtualFileTreeItem& item,
+                         std::string_view realPath) const noexcept
+{
+  const DirId dir = item.realParentDir();
+  return dir != invalidDir ? fdMap.cache()->get(dir)
+                           : fdMap.at(getParentPath(realPath));
+}
+
+int MountState::dirFd(const VirtualFileTreeItem& item,
+                      std::string_view realPath) const noexcept
+{
+  const DirId dir = item.realDir();
+  return dir != invalidDir ? fdMap.cache()->get(dir) : fdMap.at(realPath);
+}
+
+void MountState::cacheAttributes(const VirtualFileTreeItem& item,
+                                 const struct stat& st, uint64_t version) const noexcept
+{
+  if (cacheOptions.attributeCacheTimeout <= 0) {
+    return;
+  }
+  using namespace std::chrono;
+  const duration<double> timeout(cacheOptions.attributeCacheTimeout);
+  item.cacheAttributes(st, version, duration_cast<steady_clock::duration>(timeout));
+}
+
+int MountState::createParentDir(const std::string& realParentPath, mode_t mode) noexcept
+{
+  const std::string parentName = getFileNameFromPath(realParentPath);
+  const int grandParentFd      = fdMap.at(getParentPath(realParentPath));
+  logger::trace("creating parent directory {}", realParentPath);
+  if (mkdirat(grandParentFd, parentName.c_str(), mode) == -1) {
+    const int e = errno;
+    logger::error("error creating parent directory '{}', mkdirat failed: {}",
+                  realParentPath, strerror(e));
+    return -e;
+  }
+
+  const int parentFd = openat(grandParentFd, parentName.c_str(), OPEN_FLAGS);
+  if (parentFd == -1) {
+    const int e = errno;
+    logger::error("error opening parent directory '{}': {}", realParentPath,
+                  strerror(e));
+    return -e;
+  }
+
+  // the FdMap takes over the file descriptor
+  logger::trace("adding fd {} for '{}'", parentFd, realParentPath);
+  if (fdMap.insert(realParentPath, parentFd) == invalidDir) {
+    return -ENOMEM;
+  }
+  return parentFd;
+}
+
+DirId MountState::addDirectory(const std::string& realPath) noexcept
+{
+  const DirId parentDir = fdMap.id(getParentPath(realPath));
+  if (parentDir == invalidDir || !fdMap.cache()->isPinned(parentDir)) {
+    const DirId dir = fdMap.insert(realPath);
+    if (dir != invalidDir) {
+      // a directory that was removed and created again is opened again on next use
+      fdMap.cache()->replace(dir, -1);
+    }
+    return dir;
+  }
+
+  EpochGuard guard;
+  const int parentFd = fdMap.cache()->get(parentDir);
+  const int fd       = parentFd == -1 ? -1
+                                      : openat(parentFd, getFileNamePtr(realPath),
+                                               OPEN_FLAGS | O_CLOEXEC);
+  if (fd == -1) {
+    logger::error("error opening directory {}: {}", realPath, strerror(errno));
+    return invalidDir;
+  }
+  return fdMap.insert(realPath, fd, true);
+}
+
+void MountState::collectRelocations(const std::string& path,
+                                    const std::shared_ptr<VirtualFileTreeItem>& item,
+                                    const std::string& oldRoot,
+                                    const std::string& newRoot,
+                                    std::vector<Relocation>& relocations,
+                                    bool& copied) noexcept(false)
+{
+  std::string realPath = item->realPath();
+  if (realPath != oldRoot && (!realPath.starts_with(oldRoot) ||
+                              realPath[oldRoot.size()] != '/')) {
+    // items of other linked directories stay where they are
+    return;
+  }
+  std::string newRealPath = newRoot + realPath.substr(oldRoot.size());
+  relocations.emplace_back(item, std::move(realPath), std::move(newRealPath));
+  if (!item->isDir()) {
+    return;
+  }
+
+  for (const auto& child : item->getChildren() | std::views::values) {
+    // the setters modify the item in every tree sharing it
+    const std::string childPath = path + "/" + child->fileName();
+    const auto unshared         = fileTree->unshare(childPath);
+    if (unshared == nullptr) {
+      continue;
+    }
+    copied |= unshared != child;
+    collectRelocations(childPath, unshared, oldRoot, newRoot, relocations, copied);
+  }
+}
+
+void MountState::applyRelocations(const std::vector<Relocation>& relocations) noexcept
+{
+  for (const auto& relocation : relocations) {
+    if (relocation.item->isDir()) {
+      fdMap.erase(relocation.oldRealPath);
+    }
+  }
+  for (const auto& [item, oldRealPath, newRealPath] : relocations) {
+    DirId dirId = invalidDir;
+    if (item->isDir()) {
+      dirId = addDirectory(newRealPath);
+    }
+    item->setRealPath(newRealPath);
+    item->setRealDirs(fdMap.id(getParentPath(newRealPath)), dirId);
+  }
+}
 
 MountState::~MountState()
 {
-  for (const auto& fd : fdMap | std::views::values) {
-    logger::trace("closing fd {}", fd);
-    close(fd);
+  // the watcher uses the file tree and adds directories to the FdMap
+  watcher.stop();
+
+  // the namespace child has exited, so its thread local storage can be released
+  if (tlsThread.joinable()) {
+    eventfd_write(tlsReleaseFd, 1);
+    tlsThread.join();
+  }
+  if (tlsReleaseFd != -1) {
+    close(tlsReleaseFd);
   }
 }
@@ -1,8 +1,16 @@
 #pragma once
 
+#include "backingfiletable.h"
 #include "fdmap.h"
+#include "inodetable.h"
+#include "invalidator.h"
+#include "negativecache.h"
+#include "watcher.h"
+#include "usvfs-fuse/usvfsmanager.h"
 
 struct fuse;
+struct fuse_session;
+class TreeCache;
 class VirtualFileTreeItem;
 
 struct MountState
@@ -13,11 +21,33 @@ struct MountState
     success,
     failure
   };
+
+  // an item of a renamed directory whose real path changes
+  struct Relocation
+  {
+    std::shared_ptr<VirtualFileTreeItem> item;
+    std::string oldRealPath;
+    std::string newRealPath;
+  };
+
   std::string upperDir;
   std::string mountpoint;
   std::shared_ptr<VirtualFileTreeItem> fileTree;
+  // owns the real directories in the DirFdCache shared by all mounts. The items of the
+  // file tree carry the ids of their directories, so lookups are only needed for items
+  // that do not, like the ones in the upper directory
   FdMap fdMap;
-  fuse* fusePtr = nullptr;
+  // directory listings the file tree was built from, only set until the mount is
+  // created
+  std::unique_ptr<TreeCache> treeCache;
+  InodeTable inodes;  // only used by the low level API
+  Invalidator invalidator;
+  NegativeCache negativeCache;  // only used by the high level API
+  // follows changes of the linked directories, only started if enabled
+  Watcher watcher;
+  fuse* fusePtr         = nullptr;
+  fuse_session* session = nullptr;
+  bool lowLevel         = false;  // whether to use the inode based low level API
   Status status = unknown;
   std::condition_variable cv;
   std::mutex mtx;
@@ -26,8 +56,75 @@ struct MountState
   char* stackTop = nullptr;  // End of stack buffer
   int pidFd      = -1;
   int nsFd       = -1;
+  int readyFd    = -1;  // signaled by the namespace child once it is mounted
+  // idle thread whose thread local storage the namespace child uses instead of the one
+  // of the thread cloning it. It exits once it is signaled by the destructor
+  std::thread tlsThread;
+  void* childTls   = nullptr;
+  int tlsReleaseFd = -1;
   uid_t uid;
   uid_t gid;
 
+  FuseCacheOptions cacheOptions;
+
+  // register opened files with the kernel so reads and writes bypass the daemon, this
+  // is reset by the init operation if the kernel does not support it
+  bool passthrough = false;
+  BackingFileTable backingFiles;
+
+  // number of FUSE worker threads, 0 uses the single-threaded loop
+  unsigned int maxThreads     = 0;
+  unsigned int maxIdleThreads = 0;
+
   ~MountState();
+
+  // apply the connection related options, called from the init operation
+  void applyConnectionOptions(fuse_conn_info* conn) noexcept;
+
+  // set up passthrough for an opened file if enabled. Reads and writes of the file are
+  // served by the daemon if this fails
+  void openPassthrough(fuse_file_info* fi) noexcept;
+
+  // release the passthrough backing file of an opened file, if any
+  void releasePassthrough(const fuse_file_info* fi) noexcept;
+
+  // file descriptor of the real directory containing an item with the given real path.
+  // Items that do not know their directory, like the ones created in the upper
+  // directory, are looked up in the FdMap. The file descriptor may be closed once the
+  // calling thread leaves its EpochGuard
+  [[nodiscard]] int parentFd(const VirtualFileTreeItem& item,
+                             std::string_view realPath) const noexcept;
+
+  // file descriptor of the real directory of a directory item, with the same fallback
+  [[nodiscard]] int dirFd(const VirtualFileTreeItem& item,
+                          std::string_view realPath) const noexcept;
+
+  // cache the attributes of the real file of an item if the attribute cache is enabled.
+  // version is the attributes version of the item from before they were read
+  void cacheAttributes(const VirtualFileTreeItem& item, const struct stat& st,
+                       uint64_t version) const noexcept;
+
+  // create a missing directory in the upper directory to create new items in, its
+  // parent has to exist. Returns the file descriptor of the directory, which stays open
+  // until the calling thread leaves its EpochGuard, or -errno on error
+  int createParentDir(const std::string& realParentPath, mode_t mode) noexcept;
+
+  // register a real directory that was created after the file tree was built. Below
+  // pinned directories, which are mounted over, it is opened relative to its parent and
+  // pinned as well, otherwise it is opened on first use
+  DirId addDirectory(const std::string& realPath) noexcept;
+
+  // collect the items of a subtree moved to path in the file tree that are stored below
+  // the real path oldRoot renamed to newRoot, parents before their children. Shared
+  // descendants are copied first, copied is set if one of them got a new identity
+  void collectRelocations(const std::string& path,
+                          const std::shared_ptr<VirtualFileTreeItem>& item,
+                          const std::string& oldRoot, const std::string& newRoot,
+                          std::vector<Relocation>& relocations,
+                          bool& copied) noexcept(false);
+
+  // point relocated items to their new real paths. The old directories are released
+  // before the new ones are added, so directories swapped by an exchange do not keep
+  // the file descriptors of their old paths
+  void applyRelocations(const std::vector<Relocation>& relocations) noexcept;
 };
@@ -0,0 +1,97 @@
+#include "negativecache.h"
+
+using namespace std;
+
+namespace
+{
+constexpr char foldAscii(char c) noexcept
+{
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+}  // namespace
+
+size_t NegativeCache::Hash::operator()(string_view path) const noexcept
+{
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : path) {
+    hash ^= static_cast<unsigned char>(foldAscii(c));
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool NegativeCache::Equal::operator()(string_view lhs, string_view rhs) const noexcept
+{
+  return ranges::equal(lhs, rhs, [](char a, char b) {
+    return foldAscii(a) == foldAscii(b);
+  });
+}
+
+void NegativeCache::setCapacity(size_t capacity) noexcept
+{
+  unique_lock lock(m_mtx);
+  m_capacity = capacity;
+  m_paths.clear();
+  m_bloom.reset();
+}
+
+bool NegativeCache::contains(string_view path) const noexcept
+{
+  if (m_capacity == 0) {
+    return false;
+  }
+
+  const size_t hash = Hash{}(path);
+  shared_lock lock(m_mtx);
+  return mayContain(hash) && m_paths.contains(path);
+}
+
+uint64_t NegativeCache::generation() const noexcept
+{
+  return m_generation.load(memory_order_acquire);
+}
+
+void NegativeCache::insert(string_view path, uint64_t generation) noexcept
+{
+  if (m_capacity == 0) {
+    return;
+  }
+
+  const size_t hash = Hash{}(path);
+  unique_lock lock(m_mtx);
+  // clear increments the generation while holding the lock, so a path that was
+  // created after the lookup started cannot be inserted afterwards
+  if (m_generation.load(memory_order_relaxed) != generation) {
+    return;
+  }
+  // the bloom filter cannot forget single paths, start over once the cache is full to
+  // keep its false positive rate low
+  if (m_paths.size() >= m_capacity) {
+    m_paths.clear();
+    m_bloom.reset();
+  }
+
+  try {
+    m_paths.emplace(path);
+  } catch (const bad_alloc&) {
+    return;
+  }
+  m_bloom.set(hash % bloomBits);
+  m_bloom.set((hash >> 32) % bloomBits);
+}
+
+void NegativeCache::clear() noexcept
+{
+  unique_lock lock(m_mtx);
+  m_generation.fetch_add(1, memory_order_release);
+  if (!m_paths.empty()) {
+    m_paths.clear();
+    m_bloom.reset();
+  }
+}
+
+bool NegativeCache::mayContain(size_t hash) const noexcept
+{
+  return m_bloom.test(hash % bloomBits) && m_bloom.test((hash >> 32) % bloomBits);
+}
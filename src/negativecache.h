@@ -0,0 +1,58 @@
+#pragma once
+
+// remembers virtual paths that do not exist, so repeated lookups of missing paths can
+// be answered without walking the file tree. Paths are compared ignoring the case of
+// ASCII characters. Lookups of paths that are not in the cache are usually rejected by
+// a bloom filter before the exact set is searched
+class NegativeCache
+{
+public:
+  /**
+   * @brief Set the maximum number of paths to remember, 0 disables the cache. Must not
+   * be called while the cache is in use
+   */
+  void setCapacity(size_t capacity) noexcept;
+
+  // check whether a path is known to not exist
+  [[nodiscard]] bool contains(std::string_view path) const noexcept;
+
+  /**
+   * @brief Get the current generation of the cache, which changes with every clear.
+   * Has to be read before searching the file tree for a path that may be inserted
+   */
+  [[nodiscard]] uint64_t generation() const noexcept;
+
+  /**
+   * @brief Remember that a path does not exist
+   * @param path Path that was not found
+   * @param generation Generation read before the path was searched. The path is not
+   * inserted if the cache was cleared since, because it may have been created meanwhile
+   */
+  void insert(std::string_view path, uint64_t generation) noexcept;
+
+  // forget all paths, has to be called whenever a path is created
+  void clear() noexcept;
+
+private:
+  struct Hash
+  {
+    using is_transparent = void;
+    size_t operator()(std::string_view path) const noexcept;
+  };
+
+  struct Equal
+  {
+    using is_transparent = void;
+    bool operator()(std::string_view lhs, std::string_view rhs) const noexcept;
+  };
+
+  static constexpr size_t bloomBits = 1 << 16;
+
+  [[nodiscard]] bool mayContain(size_t hash) const noexcept;
+
+  size_t m_capacity = 0;
+  std::atomic<uint64_t> m_generation{0};
+  std::bitset<bloomBits> m_bloom;
+  std::unordered_set<std::string, Hash, Equal> m_paths;
+  mutable std::shared_mutex m_mtx;
+};
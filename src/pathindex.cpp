@@ -0,0 +1,198 @@
+#include "pathindex.h"
+
+#include "ascii.h"
+#include "epoch.h"
+#include "logger.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace
+{
+constexpr size_t minSlots = 64;
+
+constexpr char foldAscii(char c) noexcept
+{
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+}  // namespace
+
+PathIndex::~PathIndex()
+{
+  deleteTable(m_table.load(memory_order_relaxed), true);
+}
+
+PathIndex::Node* PathIndex::tombstone() noexcept
+{
+  static Node marker;
+  return &marker;
+}
+
+size_t PathIndex::hashOf(string_view path) noexcept
+{
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : path) {
+    hash ^= static_cast<unsigned char>(foldAscii(c));
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool PathIndex::equals(string_view lhs, string_view rhs) noexcept
+{
+  return ranges::equal(lhs, rhs, [](char a, char b) {
+    return foldAscii(a) == foldAscii(b);
+  });
+}
+
+shared_ptr<VirtualFileTreeItem> PathIndex::find(string_view path) const noexcept
+{
+  const Table* table = m_table.load(memory_order_acquire);
+  if (table == nullptr) {
+    return nullptr;
+  }
+
+  // paths with non ASCII characters are converted like the indexed ones, the buffer
+  // keeps its memory so it only allocates for the longest path of the thread
+  thread_local string pathLc;
+  if (!isAscii(path)) {
+    path = toLower(path, pathLc);
+  }
+
+  const size_t hash = hashOf(path);
+  for (size_t pos = hash & table->mask;; pos = (pos + 1) & table->mask) {
+    const Node* node = table->slots[pos].load(memory_order_acquire);
+    if (node == nullptr) {
+      return nullptr;
+    }
+    if (node != tombstone() && node->hash == hash && equals(node->pathLc, path)) {
+      return node->item.lock();
+    }
+  }
+}
+
+void PathIndex::insert(string_view pathLc,
+                       const shared_ptr<VirtualFileTreeItem>& item) noexcept
+{
+  try {
+    // keep the load factor including tombstones below 1/2
+    const Table* table = m_table.load(memory_order_relaxed);
+    if (table == nullptr || (m_used + 1) * 2 > table->mask + 1) {
+      rehash(max(minSlots, bit_ceil((m_count + 1) * 4)));
+    }
+
+    auto* node = new Node{hashOf(pathLc), string(pathLc), item};
+    table      = m_table.load(memory_order_relaxed);
+
+    atomic<Node*>* free = nullptr;
+    for (size_t pos = node->hash & table->mask;; pos = (pos + 1) & table->mask) {
+      atomic<Node*>& slot = table->slots[pos];
+      Node* existing      = slot.load(memory_order_relaxed);
+      if (existing == nullptr) {
+        if (free == nullptr) {
+          free = &slot;
+          ++m_used;
+        }
+        break;
+      }
+      if (existing == tombstone()) {
+        if (free == nullptr) {
+          free = &slot;
+        }
+        continue;
+      }
+      if (existing->hash == node->hash && existing->pathLc == node->pathLc) {
+        // readers may still be looking at the replaced node
+        slot.store(node, memory_order_release);
+        epoch::retire(existing);
+        return;
+      }
+    }
+
+    free->store(node, memory_order_release);
+    ++m_count;
+  } catch (const bad_alloc&) {
+    // lookups of the path fall back to walking the tree
+    logger::warn("out of memory while indexing '{}'", pathLc);
+  }
+}
+
+void PathIndex::erase(string_view pathLc) noexcept
+{
+  const Table* table = m_table.load(memory_order_relaxed);
+  if (table == nullptr) {
+    return;
+  }
+
+  const size_t hash = hashOf(pathLc);
+  for (size_t pos = hash & table->mask;; pos = (pos + 1) & table->mask) {
+    atomic<Node*>& slot = table->slots[pos];
+    Node* node          = slot.load(memory_order_relaxed);
+    if (node == nullptr) {
+      return;
+    }
+    if (node != tombstone() && node->hash == hash && node->pathLc == pathLc) {
+      slot.store(tombstone(), memory_order_release);
+      epoch::retire(node);
+      --m_count;
+      return;
+    }
+  }
+}
+
+void PathIndex::clear() noexcept
+{
+  if (Table* table = m_table.exchange(nullptr, memory_order_acq_rel)) {
+    epoch::retire(table, [](void* p) {
+      deleteTable(static_cast<Table*>(p), true);
+    });
+  }
+  m_count = 0;
+  m_used  = 0;
+}
+
+void PathIndex::rehash(size_t slotCount) noexcept(false)
+{
+  auto* table = new Table{slotCount - 1, make_unique<atomic<Node*>[]>(slotCount)};
+
+  Table* old = m_table.load(memory_order_relaxed);
+  if (old != nullptr) {
+    for (size_t i = 0; i <= old->mask; ++i) {
+      Node* node = old->slots[i].load(memory_order_relaxed);
+      if (node == nullptr || node == tombstone()) {
+        continue;
+      }
+      size_t pos = node->hash & table->mask;
+      while (table->slots[pos].load(memory_order_relaxed) != nullptr) {
+        pos = (pos + 1) & table->mask;
+      }
+      table->slots[pos].store(node, memory_order_relaxed);
+    }
+  }
+
+  m_table.store(table, memory_order_release);
+  m_used = m_count;
+  if (old != nullptr) {
+    // the nodes have been moved to the new table
+    epoch::retire(old, [](void* p) {
+      deleteTable(static_cast<Table*>(p), false);
+    });
+  }
+}
+
+void PathIndex::deleteTable(Table* table, bool deleteNodes) noexcept
+{
+  if (table == nullptr) {
+    return;
+  }
+  if (deleteNodes) {
+    for (size_t i = 0; i <= table->mask; ++i) {
+      Node* node = table->slots[i].load(memory_order_relaxed);
+      if (node != tombstone()) {
+        delete node;
+      }
+    }
+  }
+  delete table;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+class VirtualFileTreeItem;
+
+// maps the full lower case virtual paths of the items of a file tree, without leading
+// '/', to the items, so a path is resolved with a single hash table probe instead of
+// walking the tree. Lookups ignore case like the tree: ASCII paths are folded while
+// hashing and comparing, other paths are converted with toLower into a per thread
+// buffer. Modifications have to be serialized by the owning tree item, lookups only
+// need an EpochGuard: nodes never change once inserted and replaced nodes and tables
+// are retired
+class PathIndex
+{
+public:
+  PathIndex() noexcept = default;
+  ~PathIndex();
+
+  PathIndex(const PathIndex&)            = delete;
+  PathIndex& operator=(const PathIndex&) = delete;
+
+  // look up an item, returns nullptr if the path is not indexed
+  [[nodiscard]] std::shared_ptr<VirtualFileTreeItem>
+  find(std::string_view path) const noexcept;
+
+  // add or replace an item, the index is left unchanged if memory allocation fails
+  void insert(std::string_view pathLc,
+              const std::shared_ptr<VirtualFileTreeItem>& item) noexcept;
+
+  void erase(std::string_view pathLc) noexcept;
+  void clear() noexcept;
+
+private:
+  struct Node
+  {
+    size_t hash;
+    std::string pathLc;
+    std::weak_ptr<VirtualFileTreeItem> item;
+  };
+
+  // open addressing table, erased nodes leave a tombstone so probe sequences of other
+  // nodes are not interrupted
+  struct Table
+  {
+    size_t mask;
+    std::unique_ptr<std::atomic<Node*>[]> slots;
+  };
+
+  // marks a slot whose node has been erased
+  [[nodiscard]] static Node* tombstone() noexcept;
+
+  [[nodiscard]] static size_t hashOf(std::string_view path) noexcept;
+  [[nodiscard]] static bool equals(std::string_view lhs, std::string_view rhs) noexcept;
+
+  // replace the table by one of the given size containing the current nodes
+  void rehash(size_t slotCount) noexcept(false);
+
+  static void deleteTable(Table* table, bool deleteNodes) noexcept;
+
+  std::atomic<Table*> m_table = nullptr;
+  size_t m_count              = 0;  // nodes
+  size_t m_used               = 0;  // nodes and tombstones
+};
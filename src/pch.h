@@ -1,17 +1,25 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <bitset>
 #include <cerrno>
+#include <condition_variable>
 #include <csignal>
 #include <cstdint>
 #include <cstring>
+#include <deque>
 #include <dirent.h>
 #include <err.h>
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <poll.h>
@@ -19,15 +27,21 @@
 #include <sched.h>
 #include <set>
 #include <shared_mutex>
+#include <stop_token>
 #include <string>
 #include <string_view>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -37,6 +51,7 @@ extern "C"
 }
 
 // icu
+#include <unicode/ucasemap.h>
 #include <unicode/unistr.h>
 
 // spdlog
@@ -50,3 +65,4 @@ extern "C"
 #endif
 #include <fuse.h>
 #include <fuse_common.h>
+#include <fuse_lowlevel.h>
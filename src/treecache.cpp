@@ -0,0 +1,295 @@
+#include "treecache.h"
+
+#include "logger.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace
+{
+constexpr char magic[8]       = {'U', 'S', 'V', 'F', 'S', 'T', 'C', '\0'};
+constexpr uint32_t version    = 2;
+constexpr string_view fileExt = ".treecache";
+}  // namespace
+
+struct TreeCache::Header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t dirCount;
+  uint64_t entryCount;
+  uint64_t stringsSize;
+};
+
+struct TreeCache::DirRecord
+{
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+  int64_t ctimeSec;
+  int64_t ctimeNsec;
+  uint64_t pathOffset;
+  uint64_t firstEntry;
+  uint32_t pathLength;
+  uint32_t entryCount;
+};
+
+struct TreeCache::EntryRecord
+{
+  uint64_t nameOffset;
+  uint32_t nameLength;
+  uint16_t type;
+  uint16_t symlink;
+};
+
+TreeCache::~TreeCache() noexcept
+{
+  unmap();
+}
+
+string TreeCache::fileName(string_view cacheDir, string_view mountpoint) noexcept
+{
+  // FNV-1a, std::hash is not guaranteed to be stable between builds
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : mountpoint) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return format("{}/{:016x}{}", cacheDir, hash, fileExt);
+}
+
+bool TreeCache::load(const string& file) noexcept
+{
+  unmap();
+
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    if (errno != ENOENT) {
+      logger::warn("error opening tree cache {}: {}", file, strerror(errno));
+    }
+    return false;
+  }
+
+  struct stat st = {};
+  if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    logger::warn("ignoring invalid tree cache {}", file);
+    close(fd);
+    return false;
+  }
+
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    logger::warn("error mapping tree cache {}: {}", file, strerror(errno));
+    return false;
+  }
+  m_data = data;
+  m_size = st.st_size;
+
+  // validate the sizes of all tables, the offsets of the records are checked on use
+  const auto* header = static_cast<const Header*>(m_data);
+  const size_t entriesOffset =
+      sizeof(Header) + size_t{header->dirCount} * sizeof(DirRecord);
+  if (memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version ||
+      header->entryCount > m_size / sizeof(EntryRecord) ||
+      header->stringsSize > m_size ||
+      entriesOffset + header->entryCount * sizeof(EntryRecord) + header->stringsSize !=
+          m_size) {
+    logger::warn("ignoring outdated or invalid tree cache {}", file);
+    unmap();
+    return false;
+  }
+
+  m_header  = header;
+  m_dirs    = reinterpret_cast<const DirRecord*>(static_cast<const char*>(m_data) +
+                                                 sizeof(Header));
+  m_entries = reinterpret_cast<const EntryRecord*>(static_cast<const char*>(m_data) +
+                                                   entriesOffset);
+  m_strings = reinterpret_cast<const char*>(m_entries + header->entryCount);
+  logger::debug("loaded tree cache {} with {} directories", file, header->dirCount);
+  return true;
+}
+
+bool TreeCache::lookup(string_view path, const struct stat& st,
+                       vector<Entry>& entries) const noexcept
+{
+  entries.clear();
+  const DirRecord* record = findRecord(path, st);
+  if (record == nullptr || record->firstEntry > m_header->entryCount ||
+      record->entryCount > m_header->entryCount - record->firstEntry) {
+    return false;
+  }
+
+  try {
+    entries.reserve(record->entryCount);
+    for (const EntryRecord& entry :
+         span(m_entries + record->firstEntry, record->entryCount)) {
+      const string_view name = stringAt(entry.nameOffset, entry.nameLength);
+      if (name.empty() || entry.type > static_cast<uint16_t>(Type::dir)) {
+        entries.clear();
+        return false;
+      }
+      entries.emplace_back(std::string(name), static_cast<Type>(entry.type),
+                           entry.symlink != 0);
+    }
+  } catch (const bad_alloc&) {
+    entries.clear();
+    return false;
+  }
+  return true;
+}
+
+void TreeCache::store(std::string path, const struct stat& st,
+                      vector<Entry> entries) noexcept
+{
+  // directories that were taken from the cache do not modify it
+  const bool modified = findRecord(path, st) == nullptr;
+
+  scoped_lock lock(m_mtx);
+  m_modified |= modified;
+  try {
+    m_directories.emplace_back(std::move(path), st.st_dev, st.st_ino, st.st_mtim,
+                               st.st_ctim, std::move(entries));
+  } catch (const bad_alloc&) {
+    // the directory is read again next time
+    m_modified = true;
+  }
+}
+
+bool TreeCache::save(const std::string& file) noexcept
+{
+  // a directory may have been linked more than once, keep the last listing
+  ranges::stable_sort(m_directories, {}, &Directory::path);
+  const auto duplicates = ranges::unique(m_directories.rbegin(), m_directories.rend(),
+                                         {}, &Directory::path);
+  m_directories.erase(m_directories.begin(), duplicates.begin().base());
+
+  if (!m_modified && m_header != nullptr &&
+      m_header->dirCount == m_directories.size()) {
+    logger::debug("tree cache {} is up to date", file);
+    return true;
+  }
+
+  try {
+    Header header   = {};
+    header.version  = version;
+    header.dirCount = static_cast<uint32_t>(m_directories.size());
+    memcpy(header.magic, magic, sizeof(magic));
+
+    vector<DirRecord> dirs;
+    vector<EntryRecord> entries;
+    std::string strings;
+    dirs.reserve(m_directories.size());
+
+    const auto addString = [&strings](string_view s) {
+      const uint64_t offset = strings.size();
+      strings += s;
+      return offset;
+    };
+
+    for (const Directory& directory : m_directories) {
+      DirRecord& record = dirs.emplace_back();
+      record.dev        = directory.dev;
+      record.ino        = directory.ino;
+      record.mtimeSec   = directory.mtime.tv_sec;
+      record.mtimeNsec  = directory.mtime.tv_nsec;
+      record.ctimeSec   = directory.ctime.tv_sec;
+      record.ctimeNsec  = directory.ctime.tv_nsec;
+      record.pathOffset = addString(directory.path);
+      record.pathLength = static_cast<uint32_t>(directory.path.size());
+      record.firstEntry = entries.size();
+      record.entryCount = static_cast<uint32_t>(directory.entries.size());
+      for (const Entry& entry : directory.entries) {
+        entries.push_back({.nameOffset = addString(entry.name),
+                           .nameLength = static_cast<uint32_t>(entry.name.size()),
+                           .type       = static_cast<uint16_t>(entry.type),
+                           .symlink    = entry.symlink});
+      }
+    }
+    header.entryCount  = entries.size();
+    header.stringsSize = strings.size();
+
+    error_code ec;
+    fs::create_directories(fs::path(file).parent_path(), ec);
+    if (ec) {
+      logger::error("error creating directory for tree cache {}: {}", file,
+                    ec.message());
+      return false;
+    }
+
+    // write to a temporary file first so a crash never leaves a truncated cache
+    const std::string tmpFile = file + ".tmp";
+    {
+      ofstream out(tmpFile, ios::binary | ios::trunc);
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      out.write(reinterpret_cast<const char*>(dirs.data()),
+                static_cast<streamsize>(dirs.size() * sizeof(DirRecord)));
+      out.write(reinterpret_cast<const char*>(entries.data()),
+                static_cast<streamsize>(entries.size() * sizeof(EntryRecord)));
+      out.write(strings.data(), static_cast<streamsize>(strings.size()));
+      out.close();
+      if (!out) {
+        logger::error("error writing tree cache {}", tmpFile);
+        fs::remove(tmpFile, ec);
+        return false;
+      }
+    }
+    if (rename(tmpFile.c_str(), file.c_str()) == -1) {
+      logger::error("error renaming {} to {}: {}", tmpFile, file, strerror(errno));
+      fs::remove(tmpFile, ec);
+      return false;
+    }
+  } catch (const bad_alloc&) {
+    logger::error("error saving tree cache {}: {}", file, strerror(ENOMEM));
+    return false;
+  }
+
+  logger::debug("saved tree cache {} with {} directories", file, m_directories.size());
+  return true;
+}
+
+void TreeCache::unmap() noexcept
+{
+  if (m_data != nullptr) {
+    munmap(m_data, m_size);
+  }
+  m_data    = nullptr;
+  m_size    = 0;
+  m_header  = nullptr;
+  m_dirs    = nullptr;
+  m_entries = nullptr;
+  m_strings = nullptr;
+}
+
+const TreeCache::DirRecord* TreeCache::findRecord(string_view path,
+                                                  const struct stat& st) const noexcept
+{
+  if (m_header == nullptr) {
+    return nullptr;
+  }
+
+  const span dirs(m_dirs, m_header->dirCount);
+  const auto it = ranges::lower_bound(dirs, path, {}, [this](const DirRecord& record) {
+    return stringAt(record.pathOffset, record.pathLength);
+  });
+  if (it == dirs.end() || stringAt(it->pathOffset, it->pathLength) != path) {
+    return nullptr;
+  }
+
+  if (it->dev != st.st_dev || it->ino != st.st_ino ||
+      it->mtimeSec != st.st_mtim.tv_sec || it->mtimeNsec != st.st_mtim.tv_nsec ||
+      it->ctimeSec != st.st_ctim.tv_sec || it->ctimeNsec != st.st_ctim.tv_nsec) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+string_view TreeCache::stringAt(uint64_t offset, uint32_t length) const noexcept
+{
+  // corrupted offsets result in an empty string, which does not match any path
+  if (offset > m_header->stringsSize || length > m_header->stringsSize - offset) {
+    return {};
+  }
+  return {m_strings + offset, length};
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "virtualfiletreeitem.h"
+
+// persistent cache of the directory listings a mount was built from, so directories
+// that did not change since the last run do not have to be read again. A directory is
+// considered unchanged if its device, inode, mtime and ctime match the cached ones,
+// which catches entries being created, removed or renamed in it.
+//
+// The cache file is memory mapped and used in place: a header followed by the directory
+// records sorted by path, the entry records of all directories and a string table
+class TreeCache
+{
+public:
+  struct Entry
+  {
+    std::string name;
+    Type type;
+    // the type is the type of the link target, it is resolved again whenever the
+    // cached listing is used
+    bool symlink = false;
+  };
+
+  TreeCache() = default;
+  ~TreeCache() noexcept;
+
+  TreeCache(const TreeCache&)            = delete;
+  TreeCache& operator=(const TreeCache&) = delete;
+
+  /**
+   * @brief Get the name of the cache file of a mount point inside the cache directory
+   */
+  [[nodiscard]] static std::string fileName(std::string_view cacheDir,
+                                            std::string_view mountpoint) noexcept;
+
+  /**
+   * @brief Map a cache file. Missing, outdated or corrupted files leave the cache empty
+   * @return True if the file was loaded
+   */
+  bool load(const std::string& file) noexcept;
+
+  /**
+   * @brief Get the cached listing of a directory
+   * @param path Real path of the directory
+   * @param st Current attributes of the directory
+   * @param entries Receives the entries of the directory
+   * @return True if the directory is cached and did not change since
+   */
+  bool lookup(std::string_view path, const struct stat& st,
+              std::vector<Entry>& entries) const noexcept;
+
+  /**
+   * @brief Record the listing of a directory, the recorded directories replace the
+   * contents of the cache file once it is saved. May be called from multiple threads
+   */
+  void store(std::string path, const struct stat& st,
+             std::vector<Entry> entries) noexcept;
+
+  /**
+   * @brief Write the recorded directories to a cache file. The file is only written if
+   * they differ from the loaded ones and is replaced atomically
+   * @return True on success
+   */
+  bool save(const std::string& file) noexcept;
+
+private:
+  struct Header;
+  struct DirRecord;
+  struct EntryRecord;
+
+  struct Directory
+  {
+    std::string path;
+    uint64_t dev;
+    uint64_t ino;
+    timespec mtime;
+    timespec ctime;
+    std::vector<Entry> entries;
+  };
+
+  void unmap() noexcept;
+
+  // the record of a directory if it is cached and did not change since
+  [[nodiscard]] const DirRecord* findRecord(std::string_view path,
+                                            const struct stat& st) const noexcept;
+
+  [[nodiscard]] std::string_view stringAt(uint64_t offset,
+                                          uint32_t length) const noexcept;
+
+  // the mapped cache file
+  void* m_data  = nullptr;
+  size_t m_size = 0;
+  const Header* m_header       = nullptr;
+  const DirRecord* m_dirs      = nullptr;
+  const EntryRecord* m_entries = nullptr;
+  const char* m_strings        = nullptr;
+
+  // whether a directory was read from disk instead of taken from the cache
+  bool m_modified = false;
+  std::vector<Directory> m_directories;
+  std::mutex m_mtx;
+};
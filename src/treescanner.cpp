@@ -0,0 +1,373 @@
+#include "treescanner.h"
+
+#include "epoch.h"
+#include "fdmap.h"
+#include "logger.h"
+#include "treecache.h"
+#include "usvfs.h"
+
+using namespace std;
+
+namespace
+{
+
+// more threads than this do not read directories any faster
+constexpr unsigned int maxThreads = 16;
+constexpr size_t direntBufferSize = 32 * 1024;
+
+// a directory on the path from the root to a scanned directory
+struct Ancestor
+{
+  dev_t dev;
+  ino_t ino;
+  shared_ptr<const Ancestor> parent;
+};
+
+struct Task
+{
+  shared_ptr<VirtualFileTreeItem> item;
+  DirId parentDir;    // the parent directory in the DirFdCache, invalidDir for the root
+  string path;        // real path of the directory
+  size_t nameOffset;  // offset of the path relative to the parent directory
+  shared_ptr<const Ancestor> parent;  // the parent directory, nullptr for the root
+};
+
+// whether a directory is its own ancestor, which happens if a symbolic link points to
+// a directory above it
+bool isAncestor(const Ancestor* ancestor, const struct stat& st) noexcept
+{
+  for (; ancestor != nullptr; ancestor = ancestor->parent.get()) {
+    if (ancestor->dev == st.st_dev && ancestor->ino == st.st_ino) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// read the type of a directory entry, symbolic links get the type of their target.
+// Only links and entries of file systems that do not report the type need a stat
+TreeCache::Entry readEntry(int dirFd, const dirent64& dirent) noexcept(false)
+{
+  TreeCache::Entry entry{dirent.d_name, file};
+  unsigned char type = dirent.d_type;
+
+  struct stat st = {};
+  if (type == DT_UNKNOWN &&
+      fstatat(dirFd, dirent.d_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+    type = S_ISLNK(st.st_mode) ? DT_LNK : S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+  }
+
+  if (type == DT_LNK) {
+    entry.symlink = true;
+    if (fstatat(dirFd, dirent.d_name, &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+      type = DT_DIR;
+    }
+  }
+
+  if (type == DT_DIR) {
+    entry.type = dir;
+  }
+  return entry;
+}
+
+// update the types of the symbolic links of a cached listing, their targets can change
+// without changing the directory containing the links
+void resolveLinks(int parentFd, string_view dirName, vector<TreeCache::Entry>& entries)
+{
+  const string_view separator = dirName.ends_with('/') ? "" : "/";
+  for (TreeCache::Entry& entry : entries) {
+    if (!entry.symlink) {
+      continue;
+    }
+    const string path = format("{}{}{}", dirName, separator, entry.name);
+    struct stat st    = {};
+    if (fstatat(parentFd, path.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+      entry.type = dir;
+    } else {
+      entry.type = file;
+    }
+  }
+}
+
+void readDirectory(int dirFd, const string& path, vector<TreeCache::Entry>& entries)
+{
+  entries.clear();
+
+  alignas(dirent64) char buffer[direntBufferSize];
+  for (;;) {
+    const long bytes = syscall(SYS_getdents64, dirFd, buffer, sizeof(buffer));
+    if (bytes == -1) {
+      throw runtime_error(
+          format("error reading directory {}: {}", path, strerror(errno)));
+    }
+    if (bytes == 0) {
+      break;
+    }
+
+    for (long offset = 0; offset < bytes;) {
+      const auto* entry = reinterpret_cast<const dirent64*>(buffer + offset);
+      offset += entry->d_reclen;
+
+      const string_view name = entry->d_name;
+      if (name == "." || name == "..") {
+        continue;
+      }
+      entries.push_back(readEntry(dirFd, *entry));
+    }
+  }
+}
+
+// work stealing scanner, every worker owns a queue of directories to scan. Workers take
+// the most recently found directory from their own queue, which keeps the memory of
+// the queues small, and steal the oldest directory from another queue when their own
+// runs empty. Workers are started on demand while there are more directories to scan
+// than workers
+class Scanner
+{
+public:
+  Scanner(FdMap& fdMap, TreeCache* cache, bool pinned, const SkipFunction& skip,
+          unsigned int threads)
+      : m_fdMap(fdMap), m_cache(cache), m_pinned(pinned), m_skip(skip),
+        m_queues(threads)
+  {}
+
+  void run(Task root) noexcept(false)
+  {
+    m_pending = 1;
+    m_queues[0].tasks.push_back(std::move(root));
+    m_workers = 1;
+
+    // the calling thread is the first worker
+    work(0);
+
+    for (;;) {
+      vector<jthread> threads;
+      {
+        scoped_lock lock(m_threadsMtx);
+        threads.swap(m_threads);
+      }
+      if (threads.empty()) {
+        break;
+      }
+      // joined by the destructor of jthread
+    }
+
+    if (m_failed) {
+      throw runtime_error(m_error);
+    }
+  }
+
+private:
+  struct Queue
+  {
+    mutex mtx;
+    deque<Task> tasks;
+  };
+
+  FdMap& m_fdMap;
+  TreeCache* m_cache;
+  bool m_pinned;
+  const SkipFunction& m_skip;
+  vector<Queue> m_queues;
+  atomic<size_t> m_pending = 0;  // directories that are queued or being scanned
+  atomic<size_t> m_workers = 0;
+  atomic<bool> m_failed    = false;
+  string m_error;  // first error, written once before m_failed is set
+  mutex m_errorMtx;
+  mutex m_idleMtx;
+  condition_variable m_idleCv;
+  mutex m_threadsMtx;
+  vector<jthread> m_threads;
+
+  void work(size_t index) noexcept
+  {
+    Task task;
+    while (m_pending > 0 && !m_failed) {
+      if (!pop(index, task)) {
+        // all remaining directories are being scanned by other workers, wait for them
+        // to find more
+        unique_lock lock(m_idleMtx);
+        m_idleCv.wait_for(lock, 1ms);
+        continue;
+      }
+
+      try {
+        scan(index, task);
+      } catch (const exception& e) {
+        scoped_lock lock(m_errorMtx);
+        if (!m_failed) {
+          m_error  = e.what();
+          m_failed = true;
+        }
+      }
+      task = {};
+      if (m_pending.fetch_sub(1) == 1 || m_failed) {
+        m_idleCv.notify_all();
+      }
+    }
+  }
+
+  bool pop(size_t index, Task& task) noexcept
+  {
+    {
+      Queue& queue = m_queues[index];
+      scoped_lock lock(queue.mtx);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+      }
+    }
+
+    const size_t workers = m_workers;
+    for (size_t i = 1; i < workers; ++i) {
+      Queue& queue = m_queues[(index + i) % workers];
+      scoped_lock lock(queue.mtx);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void push(size_t index, Task task) noexcept(false)
+  {
+    {
+      Queue& queue = m_queues[index];
+      scoped_lock lock(queue.mtx);
+      queue.tasks.push_back(std::move(task));
+    }
+    if (m_pending.fetch_add(1) + 1 > m_workers) {
+      startWorker();
+    }
+    m_idleCv.notify_one();
+  }
+
+  void startWorker() noexcept
+  {
+    scoped_lock lock(m_threadsMtx);
+    const size_t index = m_workers;
+    if (index >= m_queues.size() || m_pending <= index || m_failed) {
+      return;
+    }
+
+    try {
+      m_threads.emplace_back([this, index] {
+        work(index);
+      });
+      // publish the worker after its thread started, so an empty queue is never
+      // skipped by the stealing workers before it is used
+      ++m_workers;
+    } catch (const exception& e) {
+      // the running workers scan the remaining directories
+      logger::warn("error starting scanner thread: {}", e.what());
+    }
+  }
+
+  void scan(size_t index, Task& task) noexcept(false)
+  {
+    // the file descriptors of the cache stay open until the guard is left
+    EpochGuard guard;
+    const int parentFd = task.parentDir == invalidDir
+                             ? AT_FDCWD
+                             : m_fdMap.cache()->get(task.parentDir);
+    if (parentFd == -1) {
+      throw runtime_error(format("error opening parent directory of {}: {}", task.path,
+                                 strerror(errno)));
+    }
+    const char* name = task.path.c_str() + task.nameOffset;
+
+    struct stat st = {};
+    if (fstatat(parentFd, name, &st, 0) == -1) {
+      throw runtime_error(
+          format("error reading attributes of {}: {}", task.path, strerror(errno)));
+    }
+
+    // directories with a cached listing are only opened once they are used
+    vector<TreeCache::Entry> entries;
+    int fd             = -1;
+    const bool descend = !isAncestor(task.parent.get(), st);
+    if (!descend) {
+      // linked directories that contain the link are added, but not descended into
+      logger::debug("not descending into {}, it contains itself", task.path);
+    } else if (m_cache != nullptr && m_cache->lookup(task.path, st, entries)) {
+      logger::trace("using cached listing of {}", task.path);
+      resolveLinks(parentFd, name, entries);
+    } else {
+      fd = openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd == -1) {
+        throw runtime_error(
+            format("error opening directory {}: {}", task.path, strerror(errno)));
+      }
+      try {
+        readDirectory(fd, task.path, entries);
+      } catch (...) {
+        close(fd);
+        throw;
+      }
+    }
+    if (fd == -1 && m_pinned) {
+      // pinned directories are not opened by path later, so they are opened even if
+      // they are not read
+      fd = openat(parentFd, name, OPEN_FLAGS | O_CLOEXEC);
+      if (fd == -1) {
+        throw runtime_error(
+            format("error opening directory {}: {}", task.path, strerror(errno)));
+      }
+    }
+
+    // the cache takes over the file descriptor, it can be read and used for lookups
+    // like the O_PATH ones it opens. Directories it already knows from other links keep
+    // their file descriptor and share the entry
+    const DirId dirId = m_fdMap.insert(task.path, fd, m_pinned, &st);
+    if (dirId == invalidDir) {
+      throw runtime_error(format("error adding directory {}", task.path));
+    }
+    task.item->setRealDirs(task.parentDir, dirId);
+    if (!descend) {
+      return;
+    }
+
+    auto self = make_shared<const Ancestor>(st.st_dev, st.st_ino, task.parent);
+    const string_view separator = task.path.ends_with('/') ? "" : "/";
+    for (const TreeCache::Entry& entry : entries) {
+      if (m_skip && m_skip(entry.name, entry.type)) {
+        continue;
+      }
+
+      string path = format("{}{}{}", task.path, separator, entry.name);
+      logger::debug("adding '{}' to file tree", path);
+      auto item = task.item->add(entry.name, path, entry.type);
+      if (item == nullptr) {
+        throw runtime_error(format("error adding {} to file tree", path));
+      }
+      if (entry.type == dir) {
+        // directories get their own ids once they are scanned
+        const size_t nameOffset = path.size() - entry.name.size();
+        push(index, {std::move(item), dirId, std::move(path), nameOffset, self});
+      } else {
+        item->setRealDirs(dirId, invalidDir);
+      }
+    }
+
+    if (m_cache != nullptr) {
+      m_cache->store(task.path, st, std::move(entries));
+    }
+  }
+};
+
+}  // namespace
+
+void scanDirectoryTree(const std::string& root, VirtualFileTreeItem& fileTree,
+                       FdMap& fdMap, TreeCache* cache, bool pinned,
+                       const SkipFunction& skip, unsigned int threads) noexcept(false)
+{
+  if (threads == 0) {
+    threads = clamp(thread::hardware_concurrency(), 1u, maxThreads);
+  }
+
+  Scanner scanner(fdMap, cache, pinned, skip, threads);
+  scanner.run({fileTree.shared_from_this(), invalidDir, root, 0, nullptr});
+}
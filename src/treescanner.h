@@ -0,0 +1,33 @@
+#pragma once
+
+#include "virtualfiletreeitem.h"
+
+class FdMap;
+class TreeCache;
+
+using SkipFunction = std::function<bool(const std::string& name, Type type)>;
+
+/**
+ * @brief Add the contents of a directory tree on disk to a file tree and register each
+ * directory in the DirFdCache of the FdMap. Directories are read with getdents64 by a
+ * pool of worker threads that take directories from their own queue and steal from the
+ * others once it runs empty. Each worker adds the entries of a directory directly to
+ * the item of that directory, so adding an item does not walk the tree from the root
+ * @param root Real path of the directory to scan
+ * @param fileTree Item that receives the contents of root
+ * @param fdMap Receives root and each scanned directory, the directories that were read
+ * keep their file descriptors open while the cache allows it. The items also get the
+ * ids of their directories
+ * @param cache Optional cache that provides the listings of unchanged directories and
+ * records the listings of all scanned directories
+ * @param pinned Whether to keep the file descriptors of all directories open, which is
+ * required for directories that are mounted over
+ * @param skip Optional function that returns true for items that should not be added,
+ * skipped directories are not descended into
+ * @param threads Maximum number of threads to use, 0 uses one per core
+ * @throws std::runtime_error if a directory cannot be read or an item cannot be added
+ */
+void scanDirectoryTree(const std::string& root, VirtualFileTreeItem& fileTree,
+                       FdMap& fdMap, TreeCache* cache, bool pinned,
+                       const SkipFunction& skip = {},
+                       unsigned int threads     = 0) noexcept(false);
@@ -16,52 +16,110 @@ namespace fs = std::filesystem;
   }
 
 #define FIND_ITEM()                                                                    \
-  auto item = state->fileTree->find(path);                                             \
+  if (state->negativeCache.contains(path)) {                                           \
+    return -ENOENT;                                                                    \
+  }                                                                                    \
+  const uint64_t negativeGeneration = state->negativeCache.generation();               \
+  auto item                         = state->fileTree->find(path);                     \
   if (item == nullptr) {                                                               \
+    state->negativeCache.insert(path, negativeGeneration);                             \
     return -ENOENT;                                                                    \
   }
 
 #define GET_PATHS()                                                                    \
-  const string realPath   = item->realPath();                                          \
-  const string parentPath = getParentPath(realPath);                                   \
-  const string fileName   = getFileNameFromPath(realPath);
+  const string realPath = item->realPath();                                            \
+  const char* fileName  = getFileNamePtr(realPath);                                    \
+  /* keeps the directory file descriptors from the cache open */                       \
+  EpochGuard epochGuard;                                                               \
+  const int parentFd = state->parentFd(*item, realPath);
 
 namespace
 {
+// snapshot of a directory created by usvfs_opendir
+struct DirHandle
+{
+  vector<shared_ptr<VirtualFileTreeItem>> entries;
+};
+
 MountState* getState()
 {
   const auto* context = fuse_get_context();
   return static_cast<MountState*>(context ? context->private_data : nullptr);
 }
 
-int createParentDir(MountState* state, string_view realParentPath, string_view fileName,
-                    mode_t mode)
+// get the attributes of the real file, returns 0 on success or -errno on error. The
+// attributes may come from the cache of a network file system if bulk is set, which
+// readdirplus does for every entry, or if usvfs caches them anyway
+int statItem(MountState* state, const VirtualFileTreeItem* item, struct stat* stbuf,
+             bool bulk = false)
 {
-  // create parent directory
-  string parentName = getFileNameFromPath(realParentPath);
-  int grandParentFd = state->fdMap.at(getParentPath(realParentPath));
-  logger::trace("creating parent directory {}", getParentPath(realParentPath));
-  if (mkdirat(grandParentFd, parentName.c_str(), mode) == -1) {
-    const int e = errno;
-    logger::error("error creating parent directory, mkdirat failed: {}", realParentPath,
-                  fileName, strerror(e));
-    return -e;
+  if (item->cachedAttributes(*stbuf)) {
+    return 0;
   }
+  const uint64_t version = item->attributesVersion();
+  const string realPath  = item->realPath();
+  // keeps the directory file descriptors from the cache open
+  EpochGuard guard;
+  const bool dontSync = bulk || state->cacheOptions.attributeCacheTimeout > 0;
 
-  // open parent directory
-  int parentFd = openat(grandParentFd, parentName.c_str(), OPEN_FLAGS);
-  if (parentFd == -1) {
+  int res;
+  if (item->isDir()) {
+    res = statAttributes(state->dirFd(*item, realPath), "",
+                         AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH, dontSync, stbuf);
+  } else {
+    res = statAttributes(state->parentFd(*item, realPath), getFileNamePtr(realPath),
+                         AT_SYMLINK_NOFOLLOW, dontSync, stbuf);
+  }
+
+  if (res == -1) {
     const int e = errno;
-    logger::error("error opening parent directory '{}': {}", realParentPath,
-                  strerror(e));
+    logger::error("statx failed for '{}': {}", realPath, strerror(e));
     return -e;
   }
+  state->cacheAttributes(*item, *stbuf, version);
+  return 0;
+}
+
+// create a buffer vector that refers to a range of a file descriptor, which allows
+// libfuse to splice the data instead of copying it through a user space buffer
+fuse_bufvec createFdBuffer(int fd, size_t size, off_t offset)
+{
+  fuse_bufvec buf  = {};
+  buf.count        = 1;
+  buf.buf[0].size  = size;
+  buf.buf[0].flags = static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+  buf.buf[0].fd    = fd;
+  buf.buf[0].pos   = offset;
+  return buf;
+}
+
+// drop the cached attributes of the item at a path after its real file was changed
+void invalidateAttributes(const MountState* state, string_view path)
+{
+  if (state == nullptr || state->cacheOptions.attributeCacheTimeout <= 0) {
+    return;
+  }
+  if (const auto item = state->fileTree->find(path, true); item != nullptr) {
+    item->invalidateAttributes();
+  }
+}
 
-  // insert fd into fd map
-  logger::trace("adding fd {} for '{}'", parentFd, realParentPath);
-  state->fdMap[realParentPath] = parentFd;
+// whether an opened file may be changed through its file descriptor
+bool isWritable(const fuse_file_info* fi)
+{
+  return (fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC) != 0;
+}
 
-  return parentFd;
+// queue the invalidation of the kernel caches of the parent directory of a changed
+// item, including its cached directory listing, and drop its cached attributes
+void invalidateParent(MountState* state, string_view path)
+{
+  string parentPath = getParentPath(path);
+  if (parentPath.empty()) {
+    parentPath = "/";
+  }
+  invalidateAttributes(state, parentPath);
+  state->invalidator.invalidate(std::move(parentPath));
 }
 }  // namespace
 
@@ -90,35 +148,19 @@ int usvfs_getattr(const char* path, struct stat* stbuf, fuse_file_info* fi) noex
     pathToUse.erase(pathToUse.size() - directorySuffixLength);
   }
 
-  const auto item = state->fileTree->find(pathToUse);
-
-  if (item == nullptr) {
+  if (state->negativeCache.contains(pathToUse)) {
     return -ENOENT;
   }
 
-  int res;
-  int fd;
-  string fdPath;
-  string file;
-  if (item->isDir()) {
-    fdPath = item->realPath();
-    fd     = state->fdMap.at(fdPath);
-    res    = fstatat(fd, "", stbuf, AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH);
-  } else {
-    fdPath = getParentPath(item->realPath());
-    file   = getFileNameFromPath(item->realPath());
-    fd     = state->fdMap.at(fdPath);
-    res    = fstatat(fd, file.c_str(), stbuf, AT_SYMLINK_NOFOLLOW);
-  }
+  const uint64_t negativeGeneration = state->negativeCache.generation();
+  const auto item                   = state->fileTree->find(pathToUse);
 
-  if (res == -1) {
-    const int e = errno;
-    logger::error("usvfs_getattr(path='{}'): fstatat(fd={}:'{}', file='{}') failed: {}",
-                  path, fd, fdPath, file, strerror(e));
-    return -e;
+  if (item == nullptr) {
+    state->negativeCache.insert(pathToUse, negativeGeneration);
+    return -ENOENT;
   }
 
-  return 0;
+  return statItem(state, item.get(), stbuf);
 }
 
 int usvfs_readlink(const char* path, char* buf, size_t size) noexcept
@@ -128,13 +170,14 @@ int usvfs_readlink(const char* path, char* buf, size_t size) noexcept
   GET_STATE()
   FIND_ITEM()
 
+  const string realPath = item->realPath();
+  EpochGuard guard;
   ssize_t res;
   if (item->isDir()) {
-    const string dir = item->realPath();
-    res              = readlinkat(state->fdMap.at(dir), "", buf, size);
+    res = readlinkat(state->dirFd(*item, realPath), "", buf, size);
   } else {
-    const string dir = item->getParent().lock()->realPath();
-    res = readlinkat(state->fdMap.at(dir), item->fileName().c_str(), buf, size);
+    res = readlinkat(state->parentFd(*item, realPath), getFileNamePtr(realPath), buf,
+                     size);
   }
   if (res == -1) {
     const int e = errno;
@@ -162,8 +205,16 @@ int usvfs_mkdir(const char* path, mode_t mode) noexcept
     // deleted file: {}", existing->filePath());
     logger::info("Rerouting file creation to original location of deleted file: {}",
                  existing->filePath());
-    existing->setDeleted(false);
-    existing->setName(fileName);
+    // other trees may share the deleted item
+    const auto item = state->fileTree->unshare(path);
+    if (item == nullptr) {
+      return -errno;
+    }
+    item->setDeleted(false);
+    item->setName(fileName);
+    item->invalidateAttributes();
+    state->negativeCache.clear();
+    invalidateParent(state, path);
     return 0;
   }
 
@@ -180,37 +231,40 @@ int usvfs_mkdir(const char* path, mode_t mode) noexcept
 
   logger::trace("usvfs_mkdir, path={}: creating directory in {}", path, realParentPath);
 
-  // create the directory on disk
-  int parentFd = state->fdMap.at(realParentPath);
-  if (parentFd == -1 && !state->upperDir.empty()) {
-    // parent path does not exist, this should only happen when upperDir is used
-    parentFd = createParentDir(state, realParentPath, fileName, mode);
-    if (parentFd < 0) {
-      return parentFd;
+  // create the directory on disk, the guard keeps the directory file descriptors from
+  // the cache open
+  {
+    EpochGuard guard;
+    int parentFd = state->upperDir.empty() ? state->dirFd(*parentItem, realParentPath)
+                                           : state->fdMap.at(realParentPath);
+    if (parentFd == -1 && !state->upperDir.empty()) {
+      // parent path does not exist, this should only happen when upperDir is used
+      parentFd = state->createParentDir(realParentPath, mode);
+      if (parentFd < 0) {
+        return parentFd;
+      }
     }
-  }
 
-  if (mkdirat(parentFd, fileName.c_str(), mode) < 0) {
-    const int e = errno;
-    logger::error("usvfs_mkdir(path='{}'): mkdirat failed: {}", path, strerror(e));
-    return -e;
+    if (mkdirat(parentFd, fileName.c_str(), mode) < 0) {
+      const int e = errno;
+      logger::error("usvfs_mkdir(path='{}'): mkdirat failed: {}", path, strerror(e));
+      return -e;
+    }
   }
 
-  // open and save the file descriptor
-  int fd = openat(parentFd, fileName.c_str(), OPEN_FLAGS);
-  if (fd < 0) {
-    const int e = errno;
-    logger::error("usvfs_mkdir(path='{}'): openat failed: {}", path, strerror(e));
-    return -e;
+  const DirId dirId = state->addDirectory(realPath);
+  if (dirId == invalidDir) {
+    return -EIO;
   }
-  logger::trace("adding fd {} for {}", fd, realPath);
-  state->fdMap[realPath] = fd;
 
   // add the directory to the file tree
   const auto newItem = state->fileTree->add(path, realPath, dir);
   if (newItem == nullptr) {
     return -EIO;
   }
+  newItem->setRealDirs(state->fdMap.id(realParentPath), dirId);
+  state->negativeCache.clear();
+  invalidateParent(state, path);
 
   return 0;
 }
@@ -222,9 +276,9 @@ int usvfs_unlink(const char* path) noexcept
   FIND_ITEM()
   GET_PATHS()
 
-  logger::trace("unlinkat {}, path: {}", parentPath, fileName);
+  logger::trace("unlinkat {}", realPath);
 
-  if (unlinkat(state->fdMap.at(parentPath), fileName.c_str(), 0) == -1) {
+  if (unlinkat(parentFd, fileName, 0) == -1) {
     const int e = errno;
     logger::error("usvfs_unlink(path='{}'): unlink failed for '{}': {}", path, realPath,
                   strerror(e));
@@ -234,6 +288,7 @@ int usvfs_unlink(const char* path) noexcept
   if (!state->fileTree->erase(path, false)) {
     return -errno;
   }
+  invalidateParent(state, path);
   return 0;
 }
 
@@ -256,15 +311,18 @@ int usvfs_rmdir(const char* path) noexcept
 
   GET_PATHS()
 
-  if (unlinkat(state->fdMap.at(parentPath), fileName.c_str(), AT_REMOVEDIR) == -1) {
+  if (unlinkat(parentFd, fileName, AT_REMOVEDIR) == -1) {
     const int e = errno;
     logger::error("usvfs_rmdir(path='{}'): unlink failed for '{}': {}", path, realPath,
                   strerror(e));
     return -e;
   }
 
-  // mark the item as deleted
-  item->setDeleted(true);
+  // mark the item as deleted, other trees may share it
+  if (!state->fileTree->erase(path, false)) {
+    return -errno;
+  }
+  invalidateParent(state, path);
 
   return 0;
 }
@@ -281,6 +339,11 @@ int usvfs_rename(const char* from, const char* to, const unsigned int flags) noe
 
   GET_STATE()
 
+  if ((flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) != 0) {
+    return -EINVAL;
+  }
+  const bool exchange = (flags & RENAME_EXCHANGE) != 0;
+
   // get old item
   const auto oldItem = state->fileTree->find(from);
   if (oldItem == nullptr) {
@@ -290,10 +353,16 @@ int usvfs_rename(const char* from, const char* to, const unsigned int flags) noe
   }
 
   // look for existing item
-  if (state->fileTree->find(to) != nullptr && flags & RENAME_NOREPLACE) {
+  const auto target = state->fileTree->find(to);
+  if (target != nullptr && flags & RENAME_NOREPLACE) {
     logger::error("usvfs_rename(from='{}',to='{}'): target path exists", from, to);
     return -EEXIST;
   }
+  if (exchange && target == nullptr) {
+    logger::error("usvfs_rename(from='{}',to='{}'): target path does not exist", from,
+                  to);
+    return -ENOENT;
+  }
 
   // create paths
   const string newParentPath = getParentPath(to);
@@ -307,38 +376,84 @@ int usvfs_rename(const char* from, const char* to, const unsigned int flags) noe
   const string newRealParentPath = state->upperDir.empty()
                                        ? newParentItem->realPath()
                                        : state->upperDir + newParentItem->filePath();
-  const string oldRealParentPath = getParentPath(oldItem->realPath());
+  const string oldRealPath       = oldItem->realPath();
+  const string oldRealParentPath = getParentPath(oldRealPath);
   const string newFileName       = getFileNameFromPath(to);
+  const string newRealPath       = newRealParentPath + "/" + newFileName;
+  const string targetRealPath    = target != nullptr ? target->realPath() : "";
+
+  if (exchange && targetRealPath != newRealPath) {
+    // the target is stored in another directory, so it cannot be swapped on disk
+    return -EXDEV;
+  }
+
+  // rename on disk, the guard keeps the directory file descriptors from the cache open
+  {
+    EpochGuard guard;
+    int oldFd = state->parentFd(*oldItem, oldRealPath);
+    int newFd = state->upperDir.empty()
+                    ? state->dirFd(*newParentItem, newRealParentPath)
+                    : state->fdMap.at(newRealParentPath);
+    if (newFd == -1 && !state->upperDir.empty()) {
+      // parent path does not exist in the upper directory yet
+      newFd = state->createParentDir(newRealParentPath, 0755);
+      if (newFd < 0) {
+        return newFd;
+      }
+    }
 
-  // rename on disk
-  int oldFd = state->fdMap[oldRealParentPath];
-  int newFd = state->fdMap[newRealParentPath];
-
-  if (renameat2(oldFd, oldItem->fileName().c_str(), newFd, newFileName.c_str(),
-                flags & RENAME_EXCHANGE ? RENAME_EXCHANGE : 0) != 0) {
-    logger::error("usvfs_rename(from='{}',to='{}'): renameat2({}:'{}', {}, {}:'{}', "
-                  "{}) failed: {}",
-                  from, to, oldFd, oldRealParentPath, oldItem->fileName(), newFd,
-                  newRealParentPath, newFileName, strerror(errno));
-    return -errno;
+    if (renameat2(oldFd, getFileNamePtr(oldRealPath), newFd, newFileName.c_str(),
+                  flags) != 0) {
+      logger::error("usvfs_rename(from='{}',to='{}'): renameat2({}:'{}', {}, {}:'{}', "
+                    "{}) failed: {}",
+                    from, to, oldFd, oldRealParentPath, getFileNamePtr(oldRealPath),
+                    newFd, newRealParentPath, newFileName, strerror(errno));
+      return -errno;
+    }
   }
 
-  // create new item
-  const auto newItem =
-      state->fileTree->add(to, newRealParentPath + to, oldItem->getType());
+  // move the items instead of adding them again, so the children of a renamed
+  // directory come along
+  const auto newItem = state->fileTree->move(from, to, exchange);
   if (newItem == nullptr) {
-    logger::error(
-        "usvfs_rename(from='{}',to='{}'): error inserting new path to file tree", from,
-        to);
-    return -errno;
+    const int e = errno;
+    logger::error("usvfs_rename(from='{}',to='{}'): error moving the item in the file "
+                  "tree: {}",
+                  from, to, strerror(e));
+    return -e;
   }
-
-  // remove old item
-  if (!state->fileTree->erase(from)) {
-    logger::error("usvfs_rename(from='{}',to='{}'): error removing '{}' from file tree",
-                  from, to, from);
-    return -errno;
+  if (!exchange && target != nullptr && target->isDir() &&
+      targetRealPath == newRealPath) {
+    // the replaced directory is gone
+    state->fdMap.erase(targetRealPath);
+  }
+
+  // the kernel refers to the items by path, so copies of shared items need no
+  // invalidation
+  vector<MountState::Relocation> relocations;
+  bool copied = false;
+  try {
+    state->collectRelocations(to, newItem, oldRealPath, newRealPath, relocations,
+                              copied);
+    if (exchange) {
+      if (const auto swapped = state->fileTree->find(from); swapped != nullptr) {
+        state->collectRelocations(from, swapped, targetRealPath, oldRealPath,
+                                  relocations, copied);
+      }
+    }
+  } catch (const std::bad_alloc&) {
+    logger::error("usvfs_rename(from='{}',to='{}'): error updating the real paths: {}",
+                  from, to, strerror(ENOMEM));
+  }
+  state->applyRelocations(relocations);
+  newItem->invalidateAttributes();
+  if (exchange) {
+    invalidateAttributes(state, from);
   }
+  state->negativeCache.clear();
+
+  invalidateParent(state, from);
+  invalidateParent(state, to);
 
   return 0;
 }
@@ -360,6 +475,7 @@ int usvfs_chmod(const char* path, mode_t mode, fuse_file_info* fi) noexcept
       logger::error("usvfs_chmod(path='{}'): fchmod failed: {}", path, strerror(e));
       return -e;
     }
+    invalidateAttributes(getState(), path);
     return 0;
   }
 
@@ -367,12 +483,12 @@ int usvfs_chmod(const char* path, mode_t mode, fuse_file_info* fi) noexcept
   FIND_ITEM()
   GET_PATHS()
 
-  int fd = state->fdMap.at(parentPath);
-  if (fchmodat(fd, fileName.c_str(), mode, 0) == -1) {
+  if (fchmodat(parentFd, fileName, mode, 0) == -1) {
     const int e = errno;
     logger::error("usvfs_chmod(path='{}'): fchmodat failed: {}", path, strerror(e));
     return -e;
   }
+  item->invalidateAttributes();
   return 0;
 }
 
@@ -387,6 +503,7 @@ int usvfs_chown(const char* path, uid_t uid, gid_t gid, fuse_file_info* fi) noex
       logger::error("usvfs_chown(path='{}'): fchown failed: {}", path, strerror(e));
       return -e;
     }
+    invalidateAttributes(getState(), path);
     return 0;
   }
 
@@ -394,11 +511,12 @@ int usvfs_chown(const char* path, uid_t uid, gid_t gid, fuse_file_info* fi) noex
   FIND_ITEM()
   GET_PATHS()
 
-  if (fchownat(state->fdMap.at(parentPath), fileName.c_str(), uid, gid, 0) == -1) {
+  if (fchownat(parentFd, fileName, uid, gid, 0) == -1) {
     const int e = errno;
     logger::error("usvfs_chown(path='{}'): fchownat failed: {}", path, strerror(e));
     return -e;
   }
+  item->invalidateAttributes();
   return 0;
 }
 
@@ -413,6 +531,7 @@ int usvfs_truncate(const char* path, off_t size, fuse_file_info* fi) noexcept
       logger::error("usvfs_truncate: ftruncate failed: {}", strerror(e));
       return -e;
     }
+    invalidateAttributes(getState(), path);
     return 0;
   }
 
@@ -420,12 +539,11 @@ int usvfs_truncate(const char* path, off_t size, fuse_file_info* fi) noexcept
   FIND_ITEM()
   GET_PATHS()
 
-  const int parentFd = state->fdMap.at(parentPath);
-  const int fd       = openat(parentFd, fileName.c_str(), O_WRONLY);
+  const int fd = openat(parentFd, fileName, O_WRONLY);
   if (fd == -1) {
     const int e = errno;
-    logger::error("usvfs_truncate(path='{}'): openat({}:'{}', {}, O_WRONLY) failed: {}",
-                  path, parentFd, parentPath, fileName, strerror(e));
+    logger::error("usvfs_truncate(path='{}'): openat({}:'{}', O_WRONLY) failed: {}",
+                  path, parentFd, realPath, strerror(e));
     return -e;
   }
 
@@ -434,6 +552,7 @@ int usvfs_truncate(const char* path, off_t size, fuse_file_info* fi) noexcept
     logger::error("usvfs_truncate(path='{}'): ftruncate failed: {}", path, strerror(e));
     return -e;
   }
+  item->invalidateAttributes();
 
   return 0;
 }
@@ -443,16 +562,37 @@ int usvfs_open(const char* path, fuse_file_info* fi) noexcept
   logger::trace("usvfs_open(path='{}', flags={})", path, fi->flags);
   GET_STATE()
   FIND_ITEM()
-  GET_PATHS()
 
-  const int result = openat(state->fdMap.at(parentPath), fileName.c_str(), fi->flags);
-  if (result == -1) {
+  // opening a FIFO blocks until its other end is opened, so the directory is duplicated
+  // instead of keeping the EpochGuard
+  const string realPath = item->realPath();
+  int parentFd;
+  {
+    EpochGuard guard;
+    parentFd = fcntl(state->parentFd(*item, realPath), F_DUPFD_CLOEXEC, 0);
+  }
+  if (parentFd == -1) {
     const int e = errno;
+    logger::error("usvfs_open(path='{}'): error duplicating parent fd: {}", path,
+                  strerror(e));
+    return -e;
+  }
+
+  const int result = openat(parentFd, getFileNamePtr(realPath), fi->flags);
+  const int e      = errno;
+  close(parentFd);
+  if (result == -1) {
     logger::error("usvfs_open(path='{}'): openat failed: {}", path, strerror(e));
     return -e;
   }
 
   fi->fh = result;
+  state->openPassthrough(fi);
+  if (isWritable(fi)) {
+    // writes through passthrough files are not seen by usvfs, so the attributes are
+    // also dropped when the file is released
+    item->invalidateAttributes();
+  }
 
   return 0;
 }
@@ -476,6 +616,12 @@ int usvfs_release(const char* path, fuse_file_info* fi) noexcept
 {
   logger::trace("usvfs_release(path='{}')", path);
   if (fi && fi->fh != 0) {
+    if (auto* state = getState(); state != nullptr) {
+      state->releasePassthrough(fi);
+      if (path != nullptr && isWritable(fi)) {
+        invalidateAttributes(state, path);
+      }
+    }
     close(static_cast<int>(fi->fh));
     fi->fh = 0;
   }
@@ -493,6 +639,7 @@ int usvfs_write(const char* path, const char* buf, const size_t size,
     logger::error("usvfs_write(path='{}'): pwrite failed: {}", path, strerror(e));
     return -e;
   }
+  invalidateAttributes(getState(), path);
   return static_cast<int>(result);
 }
 
@@ -501,6 +648,7 @@ int usvfs_statfs(const char* path, struct statvfs* stbuf) noexcept
   logger::trace("usvfs_statfs(path='{}')", path);
 
   GET_STATE()
+  EpochGuard guard;
   const int fd = state->fdMap.at(state->mountpoint);
   if (fstatvfs(fd, stbuf) < 0) {
     const int e = errno;
@@ -529,42 +677,76 @@ int usvfs_fsync(const char* path, int isdatasync, fuse_file_info* fi) noexcept
   return -ENOSYS;
 }
 
-int usvfs_readdir(const char* path, void* buf, const fuse_fill_dir_t filler,
-                  off_t /*offset*/, fuse_file_info* /*fi*/,
-                  fuse_readdir_flags flags) noexcept
+int usvfs_opendir(const char* path, fuse_file_info* fi) noexcept
 {
-  logger::trace("usvfs_readdir(path='{}', flags={})", path, static_cast<int>(flags));
-
+  logger::trace("usvfs_opendir(path='{}')", path);
   GET_STATE()
+  FIND_ITEM()
 
-  const auto tree = state->fileTree->find(path);
-  if (tree == nullptr) {
-    return -ENOENT;
+  if (!item->isDir()) {
+    return -ENOTDIR;
+  }
+
+  auto* handle = new (nothrow) DirHandle;
+  if (handle == nullptr) {
+    return -ENOMEM;
   }
 
-  const fuse_fill_dir_flags fill_flags = flags & FUSE_READDIR_PLUS
-                                             ? FUSE_FILL_DIR_PLUS
-                                             : static_cast<fuse_fill_dir_flags>(0);
+  // getChildren() returns a snapshot, other worker threads may modify the tree while
+  // the directory is being listed
+  for (const auto& child : item->getChildren() | views::values) {
+    if (!child->isDeleted()) {
+      handle->entries.emplace_back(child);
+    }
+  }
+
+  // let the kernel keep the listing across opens, the operations that change the tree
+  // invalidate the listing of the parent directory
+  fi->fh            = reinterpret_cast<uint64_t>(handle);
+  fi->cache_readdir = true;
+  fi->keep_cache    = true;
+  return 0;
+}
 
-  // Standard entries
-  filler(buf, ".", nullptr, 0, fill_flags);
-  filler(buf, "..", nullptr, 0, fill_flags);
+int usvfs_readdir(const char* path, void* buf, const fuse_fill_dir_t filler,
+                  off_t offset, fuse_file_info* fi, fuse_readdir_flags flags) noexcept
+{
+  logger::trace("usvfs_readdir(path='{}', offset={}, flags={})", path, offset,
+                static_cast<int>(flags));
 
-  for (const auto& [itemName, item] : tree->getChildren()) {
-    GET_PATHS()
+  GET_STATE()
 
-    struct stat stbuf;
-    int fd = state->fdMap.at(parentPath);
-    if (fstatat(fd, fileName.c_str(), &stbuf, 0) == -1) {
-      const int e = errno;
-      logger::error(
-          "usvfs_readdir(path='{}'): fstatat({}:'{}', '{}'), itemName: '{}' failed: {}",
-          path, fd, parentPath, fileName, itemName, strerror(e));
-      return -e;
+  const auto* handle = reinterpret_cast<DirHandle*>(fi->fh);
+  if (handle == nullptr) {
+    return -EBADF;
+  }
+
+  const bool plus = (flags & FUSE_READDIR_PLUS) != 0;
+
+  // offset 0 and 1 are '.' and '..', the children follow. The offset passed to the
+  // filler is the offset of the next entry, the filler returns 1 once the buffer is
+  // full
+  const auto entryCount = static_cast<off_t>(handle->entries.size()) + 2;
+  for (off_t i = offset; i < entryCount; ++i) {
+    struct stat stbuf{};
+    fuse_fill_dir_flags fillFlags = static_cast<fuse_fill_dir_flags>(0);
+    string name;
+    if (i < 2) {
+      name          = i == 0 ? "." : "..";
+      stbuf.st_mode = S_IFDIR;
+    } else {
+      const auto& item = handle->entries[i - 2];
+      name             = item->fileName();
+      // the kernel only needs the file type unless it asked for the attributes
+      if (plus && statItem(state, item.get(), &stbuf, true) == 0) {
+        fillFlags = FUSE_FILL_DIR_PLUS;
+      } else {
+        stbuf         = {};
+        stbuf.st_mode = item->isDir() ? S_IFDIR : S_IFREG;
+      }
     }
 
-    if (filler(buf, item->fileName().c_str(), &stbuf, 0, fill_flags) != 0) {
-      logger::error("usvfs_readdir(path='{}'): filler function returned error", path);
+    if (filler(buf, name.c_str(), &stbuf, i + 1, fillFlags) != 0) {
       break;
     }
   }
@@ -575,10 +757,8 @@ int usvfs_readdir(const char* path, void* buf, const fuse_fill_dir_t filler,
 int usvfs_releasedir(const char* path, fuse_file_info* fi) noexcept
 {
   logger::trace("usvfs_releasedir(path='{}')", path);
-  if (fi && fi->fh != 0) {
-    close(static_cast<int>(fi->fh));
-    fi->fh = 0;
-  }
+  delete reinterpret_cast<DirHandle*>(fi->fh);
+  fi->fh = 0;
   return 0;
 }
 
@@ -590,6 +770,125 @@ int usvfs_fsyncdir(const char* path, int, fuse_file_info* fi) noexcept
   return -ENOSYS;
 }
 
+int usvfs_write_buf(const char* path, fuse_bufvec* buf, off_t off,
+                    fuse_file_info* fi) noexcept
+{
+  const size_t size = fuse_buf_size(buf);
+  logger::trace("usvfs_write_buf(path='{}', size={}, offset={})", path, size, off);
+
+  fuse_bufvec dst = createFdBuffer(static_cast<int>(fi->fh), size, off);
+
+  const ssize_t res = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+  if (res < 0) {
+    logger::error("usvfs_write_buf(path='{}'): fuse_buf_copy failed: {}", path,
+                  strerror(static_cast<int>(-res)));
+  } else {
+    invalidateAttributes(getState(), path);
+  }
+  return static_cast<int>(res);
+}
+
+int usvfs_read_buf(const char* path, fuse_bufvec** bufp, size_t size, off_t off,
+                   fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_read_buf(path='{}', size={}, offset={})", path, size, off);
+
+  // the buffer is freed by libfuse using free()
+  auto* src = static_cast<fuse_bufvec*>(malloc(sizeof(fuse_bufvec)));
+  if (src == nullptr) {
+    return -ENOMEM;
+  }
+
+  *src  = createFdBuffer(static_cast<int>(fi->fh), size, off);
+  *bufp = src;
+  return 0;
+}
+
+int usvfs_fallocate(const char* path, int mode, off_t offset, off_t length,
+                    fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_fallocate(path='{}', mode={}, offset={}, length={})", path, mode,
+                offset, length);
+  if (fallocate(static_cast<int>(fi->fh), mode, offset, length) == -1) {
+    const int e = errno;
+    logger::error("usvfs_fallocate(path='{}'): fallocate failed: {}", path,
+                  strerror(e));
+    return -e;
+  }
+  invalidateAttributes(getState(), path);
+  return 0;
+}
+
+ssize_t usvfs_copy_file_range(const char* path_in, fuse_file_info* fi_in,
+                              off_t offset_in, const char* path_out,
+                              fuse_file_info* fi_out, off_t offset_out, size_t size,
+                              int flags) noexcept
+{
+  logger::trace("usvfs_copy_file_range(path_in='{}', offset_in={}, path_out='{}', "
+                "offset_out={}, size={}, flags={})",
+                path_in, offset_in, path_out, offset_out, size, flags);
+
+  // lets the file system of the backing files perform the copy, e.g. using reflinks
+  const ssize_t res =
+      copy_file_range(static_cast<int>(fi_in->fh), &offset_in,
+                      static_cast<int>(fi_out->fh), &offset_out, size, flags);
+  if (res == -1) {
+    const int e = errno;
+    logger::error("usvfs_copy_file_range(path_in='{}', path_out='{}'): "
+                  "copy_file_range failed: {}",
+                  path_in, path_out, strerror(e));
+    return -e;
+  }
+  invalidateAttributes(getState(), path_out);
+  return res;
+}
+
+off_t usvfs_lseek(const char* path, off_t off, int whence, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_lseek(path='{}', off={}, whence={})", path, off, whence);
+  const off_t res = lseek(static_cast<int>(fi->fh), off, whence);
+  if (res == -1) {
+    const int e = errno;
+    // ENXIO is expected when there is no data or hole past the offset
+    if (e != ENXIO) {
+      logger::error("usvfs_lseek(path='{}'): lseek failed: {}", path, strerror(e));
+    }
+    return -e;
+  }
+  return res;
+}
+
+void* usvfs_init(fuse_conn_info* conn, fuse_config* cfg) noexcept
+{
+  logger::trace("usvfs_init()");
+
+  auto* state = getState();
+  if (state == nullptr) {
+    logger::error("error getting state");
+    return nullptr;
+  }
+
+  const FuseCacheOptions& options = state->cacheOptions;
+  logger::debug("usvfs_init: entry_timeout={}, attr_timeout={}, negative_timeout={}, "
+                "kernel_cache={}, auto_cache={}",
+                options.entryTimeout, options.attrTimeout, options.negativeTimeout,
+                options.kernelCache, options.autoCache);
+
+  cfg->entry_timeout    = options.entryTimeout;
+  cfg->attr_timeout     = options.attrTimeout;
+  cfg->negative_timeout = options.negativeTimeout;
+  cfg->kernel_cache     = options.kernelCache;
+  cfg->auto_cache       = options.autoCache;
+
+  state->negativeCache.setCapacity(options.negativeLookupCacheSize);
+  state->fileTree->setPathIndexEnabled(options.pathIndex);
+
+  state->applyConnectionOptions(conn);
+
+  // the return value replaces the private data passed to fuse_new()
+  return state;
+}
+
 int usvfs_create(const char* path, mode_t mode, fuse_file_info* fi) noexcept
 {
   logger::trace("usvfs_create(path='{}', mode={})", path, mode);
@@ -598,36 +897,55 @@ int usvfs_create(const char* path, mode_t mode, fuse_file_info* fi) noexcept
   const string fileName   = getFileNameFromPath(path);
   const string parentPath = getParentPath(path);
   string realParentPath;
-  if (state->upperDir.empty()) {
-    auto parentItem = state->fileTree->find(parentPath);
-    if (parentItem == nullptr) {
-      logger::error("usvfs_create(path='{}'): target parent directory '{}' does not "
-                    "exist in file tree",
-                    path, parentPath);
-      return -ENOENT;
+  int parentFd;
+  {
+    EpochGuard guard;
+    if (state->upperDir.empty()) {
+      auto parentItem = state->fileTree->find(parentPath);
+      if (parentItem == nullptr) {
+        logger::error("usvfs_create(path='{}'): target parent directory '{}' does not "
+                      "exist in file tree",
+                      path, parentPath);
+        return -ENOENT;
+      }
+      realParentPath = parentItem->realPath();
+      parentFd       = state->dirFd(*parentItem, realParentPath);
+    } else {
+      realParentPath = state->upperDir + parentPath;
+      parentFd       = state->fdMap.at(realParentPath);
     }
-    realParentPath = parentItem->realPath();
-  } else {
-    realParentPath = state->upperDir + parentPath;
-  }
-  int parentFd = state->fdMap.at(realParentPath);
-  if (parentFd == -1 && !state->upperDir.empty()) {
-    // parent path does not exist, this should only happen when upperDir is used
-    parentFd = createParentDir(state, realParentPath, fileName, mode);
-    if (parentFd < 0) {
-      return parentFd;
+
+    if (parentFd == -1 && !state->upperDir.empty()) {
+      // parent path does not exist, this should only happen when upperDir is used
+      parentFd = state->createParentDir(realParentPath, mode);
+      if (parentFd < 0) {
+        return parentFd;
+      }
+    }
+
+    // an existing FIFO is opened, which blocks until its other end is opened, so the
+    // directory is duplicated instead of keeping the guard
+    parentFd = fcntl(parentFd, F_DUPFD_CLOEXEC, 0);
+    if (parentFd == -1) {
+      const int e = errno;
+      logger::error("usvfs_create(path='{}'): error duplicating fd of '{}': {}", path,
+                    realParentPath, strerror(e));
+      return -e;
     }
   }
 
   const int fd = openat(parentFd, fileName.c_str(), fi->flags, mode);
+  const int e  = errno;
+  close(parentFd);
   if (fd < 0) {
-    const int e = errno;
-    logger::error("usvfs_create(path='{}'): openat({}:'{}', {}) failed: {}", path,
-                  parentFd, realParentPath, fileName, strerror(e));
+    logger::error("usvfs_create(path='{}'): openat('{}', {}) failed: {}", path,
+                  realParentPath, fileName, strerror(e));
     return -e;
   }
 
   fi->fh = fd;
+  state->openPassthrough(fi);
+  state->negativeCache.clear();
 
   auto item = state->fileTree->find(path);
   if (item == nullptr) {
@@ -639,6 +957,10 @@ int usvfs_create(const char* path, mode_t mode, fuse_file_info* fi) noexcept
                     path, strerror(e));
       return -e;
     }
+    newItem->setRealDirs(state->fdMap.id(realParentPath), invalidDir);
+    invalidateParent(state, path);
+  } else {
+    item->invalidateAttributes();
   }
 
   return 0;
@@ -0,0 +1,1080 @@
+#include "usvfs_ll.h"
+
+#include "inodetable.h"
+#include "logger.h"
+#include "mountstate.h"
+#include "usvfs.h"
+#include "utils.h"
+#include "virtualfiletreeitem.h"
+
+using namespace std;
+
+namespace
+{
+// snapshot of a directory created by usvfs_ll_opendir
+struct DirHandle
+{
+  vector<shared_ptr<VirtualFileTreeItem>> entries;
+  // reply buffer of usvfs_ll_readdir, kept across calls. The kernel does not read a
+  // directory handle concurrently
+  vector<char> buf;
+};
+
+MountState* getState(fuse_req_t req)
+{
+  return static_cast<MountState*>(fuse_req_userdata(req));
+}
+
+VirtualFileTreeItem* getItem(const MountState* state, fuse_ino_t ino)
+{
+  if (ino == FUSE_ROOT_ID) {
+    return state->fileTree.get();
+  }
+  return InodeTable::fromIno(ino);
+}
+
+fuse_ino_t getIno(const MountState* state, const VirtualFileTreeItem* item)
+{
+  if (item == state->fileTree.get()) {
+    return FUSE_ROOT_ID;
+  }
+  return InodeTable::toIno(item);
+}
+
+mode_t toFileType(Type type)
+{
+  switch (type) {
+  case dir:
+    return S_IFDIR;
+  case file:
+    return S_IFREG;
+  default:
+    return 0;
+  }
+}
+
+// whether an opened file may be changed through its file descriptor
+bool isWritable(const fuse_file_info* fi)
+{
+  return (fi->flags & O_ACCMODE) != O_RDONLY || (fi->flags & O_TRUNC) != 0;
+}
+
+// get the attributes of the real file, returns 0 on success or -errno on error
+int statItem(MountState* state, const VirtualFileTreeItem* item, struct stat* stbuf)
+{
+  // keeps the directory file descriptors from the cache and the cached attributes
+  EpochGuard guard;
+  if (!item->cachedAttributes(*stbuf)) {
+    const uint64_t version = item->attributesVersion();
+    const string realPath  = item->realPath();
+
+    // stale attributes of network file systems are fine if usvfs caches them anyway
+    const bool dontSync = state->cacheOptions.attributeCacheTimeout > 0;
+
+    int res;
+    if (item->isDir()) {
+      res = statAttributes(state->dirFd(*item, realPath), "",
+                           AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH, dontSync, stbuf);
+    } else {
+      res = statAttributes(state->parentFd(*item, realPath), getFileNamePtr(realPath),
+                           AT_SYMLINK_NOFOLLOW, dontSync, stbuf);
+    }
+
+    if (res == -1) {
+      const int e = errno;
+      logger::error("statx failed for '{}': {}", realPath, strerror(e));
+      return -e;
+    }
+    state->cacheAttributes(*item, *stbuf, version);
+  }
+
+  // inode numbers of different source directories may collide, use the node id instead
+  stbuf->st_ino = getIno(state, item);
+  return 0;
+}
+
+void replyAttr(fuse_req_t req, MountState* state, const VirtualFileTreeItem* item,
+               const fuse_file_info* fi)
+{
+  struct stat stbuf{};
+  if (fi != nullptr && fi->fh > 0) {
+    if (fstat(static_cast<int>(fi->fh), &stbuf) == -1) {
+      fuse_reply_err(req, errno);
+      return;
+    }
+    stbuf.st_ino = getIno(state, item);
+  } else if (const int res = statItem(state, item, &stbuf); res != 0) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  fuse_reply_attr(req, &stbuf, state->cacheOptions.attrTimeout);
+}
+
+// reply with the entry of an item and increase its lookup count
+void replyEntry(fuse_req_t req, MountState* state,
+                const shared_ptr<VirtualFileTreeItem>& item)
+{
+  fuse_entry_param entry{};
+  if (const int res = statItem(state, item.get(), &entry.attr); res != 0) {
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  entry.ino           = state->inodes.ref(item);
+  entry.attr_timeout  = state->cacheOptions.attrTimeout;
+  entry.entry_timeout = state->cacheOptions.entryTimeout;
+
+  if (fuse_reply_entry(req, &entry) != 0) {
+    // the kernel did not receive the entry, so it will never forget it
+    state->inodes.unref(entry.ino, 1);
+  }
+}
+
+// virtual path of a child of a directory item
+string childPath(const VirtualFileTreeItem* parent, const char* name)
+{
+  return parent->filePath() + "/" + name;
+}
+
+// get the real path of the directory to create new children of a directory item in,
+// which is in the upper directory if one is set, and its file descriptor. Returns the
+// file descriptor or -errno on error
+int createDirFd(MountState* state, const VirtualFileTreeItem* parent,
+                string& realParentPath, mode_t mode)
+{
+  if (parent->isDeleted()) {
+    return -ENOENT;
+  }
+  if (!parent->isDir()) {
+    return -ENOTDIR;
+  }
+
+  if (state->upperDir.empty()) {
+    realParentPath = parent->realPath();
+    const int fd   = state->dirFd(*parent, realParentPath);
+    return fd != -1 ? fd : -EIO;
+  }
+
+  realParentPath = state->upperDir + parent->filePath();
+  const int fd   = state->fdMap.at(realParentPath);
+  if (fd != -1) {
+    return fd;
+  }
+  // parent path does not exist in the upper directory yet
+  return state->createParentDir(realParentPath, mode);
+}
+
+// add an item created through the mount to the file tree. Items that were marked as
+// deleted are restored, existing items are only replaced if replace is set
+shared_ptr<VirtualFileTreeItem> addItem(MountState* state, const string& path,
+                                        const string& realParentPath, const char* name,
+                                        Type type, bool replace = false)
+{
+  const string realPath = realParentPath + "/" + name;
+
+  DirId dirId = invalidDir;
+  if (type == dir) {
+    dirId = state->addDirectory(realPath);
+    if (dirId == invalidDir) {
+      errno = EIO;
+      return nullptr;
+    }
+  }
+
+  const auto item = state->fileTree->add(path, realPath, type, replace);
+  if (item == nullptr) {
+    logger::error("error adding '{}' to file tree: {}", path, strerror(errno));
+    return nullptr;
+  }
+  item->setType(type);
+  item->setRealDirs(state->fdMap.id(realParentPath), dirId);
+  item->invalidateAttributes();
+  return item;
+}
+
+// apply the attributes requested by setattr, returns 0 on success or -errno on error
+int setAttributes(MountState* state, const VirtualFileTreeItem* item,
+                  const struct stat* attr, int toSet, const fuse_file_info* fi)
+{
+  EpochGuard guard;
+  const string realPath = item->realPath();
+  const char* fileName  = getFileNamePtr(realPath);
+  const int parentFd    = state->parentFd(*item, realPath);
+  const int fd          = fi != nullptr && fi->fh > 0 ? static_cast<int>(fi->fh) : -1;
+
+  if (toSet & FUSE_SET_ATTR_MODE) {
+    const int res = fd != -1 ? fchmod(fd, attr->st_mode)
+                             : fchmodat(parentFd, fileName, attr->st_mode, 0);
+    if (res == -1) {
+      return -errno;
+    }
+  }
+
+  if (toSet & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+    const uid_t uid =
+        toSet & FUSE_SET_ATTR_UID ? attr->st_uid : static_cast<uid_t>(-1);
+    const gid_t gid =
+        toSet & FUSE_SET_ATTR_GID ? attr->st_gid : static_cast<gid_t>(-1);
+    const int res = fd != -1 ? fchown(fd, uid, gid)
+                             : fchownat(parentFd, fileName, uid, gid,
+                                        AT_SYMLINK_NOFOLLOW);
+    if (res == -1) {
+      return -errno;
+    }
+  }
+
+  if (toSet & FUSE_SET_ATTR_SIZE) {
+    if (fd != -1) {
+      if (ftruncate(fd, attr->st_size) == -1) {
+        return -errno;
+      }
+    } else {
+      const int tmpFd = openat(parentFd, fileName, O_WRONLY);
+      if (tmpFd == -1) {
+        return -errno;
+      }
+      const int res = ftruncate(tmpFd, attr->st_size);
+      const int e   = errno;
+      close(tmpFd);
+      if (res == -1) {
+        return -e;
+      }
+    }
+  }
+
+  if (toSet & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) {
+    timespec tv[2];
+    tv[0].tv_nsec = UTIME_OMIT;
+    tv[1].tv_nsec = UTIME_OMIT;
+
+    if (toSet & FUSE_SET_ATTR_ATIME_NOW) {
+      tv[0].tv_nsec = UTIME_NOW;
+    } else if (toSet & FUSE_SET_ATTR_ATIME) {
+      tv[0] = attr->st_atim;
+    }
+    if (toSet & FUSE_SET_ATTR_MTIME_NOW) {
+      tv[1].tv_nsec = UTIME_NOW;
+    } else if (toSet & FUSE_SET_ATTR_MTIME) {
+      tv[1] = attr->st_mtim;
+    }
+
+    const int res = fd != -1 ? futimens(fd, tv)
+                             : utimensat(parentFd, fileName, tv,
+                                         AT_SYMLINK_NOFOLLOW);
+    if (res == -1) {
+      return -errno;
+    }
+  }
+
+  return 0;
+}
+}  // namespace
+
+void usvfs_ll_init(void* userdata, fuse_conn_info* conn) noexcept
+{
+  logger::trace("usvfs_ll_init()");
+  static_cast<MountState*>(userdata)->applyConnectionOptions(conn);
+}
+
+void usvfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) noexcept
+{
+  logger::trace("usvfs_ll_lookup(parent={}, name='{}')", parent, name);
+  auto* state = getState(req);
+
+  const auto item = getItem(state, parent)->find(name);
+  if (item == nullptr) {
+    if (state->cacheOptions.negativeTimeout > 0) {
+      // an entry with node id 0 is cached by the kernel as a negative entry
+      fuse_entry_param entry{};
+      entry.entry_timeout = state->cacheOptions.negativeTimeout;
+      fuse_reply_entry(req, &entry);
+    } else {
+      fuse_reply_err(req, ENOENT);
+    }
+    return;
+  }
+
+  replyEntry(req, state, item);
+}
+
+void usvfs_ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) noexcept
+{
+  logger::trace("usvfs_ll_forget(ino={}, nlookup={})", ino, nlookup);
+  getState(req)->inodes.unref(ino, nlookup);
+  fuse_reply_none(req);
+}
+
+void usvfs_ll_forget_multi(fuse_req_t req, size_t count,
+                           fuse_forget_data* forgets) noexcept
+{
+  logger::trace("usvfs_ll_forget_multi(count={})", count);
+  auto* state = getState(req);
+  for (size_t i = 0; i < count; ++i) {
+    state->inodes.unref(forgets[i].ino, forgets[i].nlookup);
+  }
+  fuse_reply_none(req);
+}
+
+void usvfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_getattr(ino={})", ino);
+  auto* state = getState(req);
+  auto* item  = getItem(state, ino);
+
+  if (item->isDeleted()) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+
+  replyAttr(req, state, item, fi);
+}
+
+void usvfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set,
+                      fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_setattr(ino={}, to_set={})", ino, to_set);
+  auto* state = getState(req);
+  auto* item  = getItem(state, ino);
+
+  // some of the attributes may have been applied even if it fails
+  const int res = setAttributes(state, item, attr, to_set, fi);
+  item->invalidateAttributes();
+  if (res != 0) {
+    logger::error("usvfs_ll_setattr(ino={}): failed for '{}': {}", ino,
+                  item->realPath(), strerror(-res));
+    fuse_reply_err(req, -res);
+    return;
+  }
+
+  replyAttr(req, state, item, fi);
+}
+
+void usvfs_ll_readlink(fuse_req_t req, fuse_ino_t ino) noexcept
+{
+  logger::trace("usvfs_ll_readlink(ino={})", ino);
+  auto* state = getState(req);
+  auto* item  = getItem(state, ino);
+
+  const string realPath = item->realPath();
+  EpochGuard guard;
+
+  array<char, PATH_MAX + 1> buf{};
+  const ssize_t res = readlinkat(state->parentFd(*item, realPath),
+                                 getFileNamePtr(realPath), buf.data(), buf.size() - 1);
+  if (res == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_readlink(ino={}): readlinkat failed for '{}': {}", ino,
+                  realPath, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  buf[res] = '\0';
+
+  fuse_reply_readlink(req, buf.data());
+}
+
+void usvfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name,
+                    mode_t mode) noexcept
+{
+  logger::trace("usvfs_ll_mkdir(parent={}, name='{}', mode={})", parent, name, mode);
+  auto* state      = getState(req);
+  auto* parentItem = getItem(state, parent);
+
+  if (parentItem->find(name) != nullptr) {
+    fuse_reply_err(req, EEXIST);
+    return;
+  }
+
+  EpochGuard guard;
+  string realParentPath;
+  const int parentFd = createDirFd(state, parentItem, realParentPath, mode);
+  if (parentFd < 0) {
+    fuse_reply_err(req, -parentFd);
+    return;
+  }
+
+  if (mkdirat(parentFd, name, mode) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_mkdir(parent={}, name='{}'): mkdirat failed: {}", parent,
+                  name, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  const auto item =
+      addItem(state, childPath(parentItem, name), realParentPath, name, dir);
+  if (item == nullptr) {
+    fuse_reply_err(req, errno);
+    return;
+  }
+  parentItem->invalidateAttributes();
+  replyEntry(req, state, item);
+}
+
+void usvfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) noexcept
+{
+  logger::trace("usvfs_ll_unlink(parent={}, name='{}')", parent, name);
+  auto* state      = getState(req);
+  auto* parentItem = getItem(state, parent);
+
+  const auto item = parentItem->find(name);
+  if (item == nullptr) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+
+  EpochGuard guard;
+  const string realPath = item->realPath();
+  if (unlinkat(state->parentFd(*item, realPath), getFileNamePtr(realPath), 0) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_unlink(parent={}, name='{}'): unlinkat failed for '{}': {}",
+                  parent, name, realPath, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  // the item is kept as deleted, the kernel may still refer to it
+  if (!state->fileTree->erase(childPath(parentItem, name), false)) {
+    fuse_reply_err(req, errno);
+    return;
+  }
+  parentItem->invalidateAttributes();
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) noexcept
+{
+  logger::trace("usvfs_ll_rmdir(parent={}, name='{}')", parent, name);
+  auto* state      = getState(req);
+  auto* parentItem = getItem(state, parent);
+
+  const auto item = parentItem->find(name);
+  if (item == nullptr) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  if (!item->isDir()) {
+    fuse_reply_err(req, ENOTDIR);
+    return;
+  }
+  if (!item->isEmpty()) {
+    fuse_reply_err(req, ENOTEMPTY);
+    return;
+  }
+
+  EpochGuard guard;
+  const string realPath = item->realPath();
+  if (unlinkat(state->parentFd(*item, realPath), getFileNamePtr(realPath),
+               AT_REMOVEDIR) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_rmdir(parent={}, name='{}'): unlinkat failed for '{}': {}",
+                  parent, name, realPath, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  if (!state->fileTree->erase(childPath(parentItem, name), false)) {
+    fuse_reply_err(req, errno);
+    return;
+  }
+  parentItem->invalidateAttributes();
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_symlink(fuse_req_t req, const char* link, fuse_ino_t parent,
+                      const char* name) noexcept
+{
+  logger::trace("usvfs_ll_symlink(link='{}', parent={}, name='{}')", link, parent,
+                name);
+  auto* state      = getState(req);
+  auto* parentItem = getItem(state, parent);
+
+  if (parentItem->find(name) != nullptr) {
+    fuse_reply_err(req, EEXIST);
+    return;
+  }
+
+  EpochGuard guard;
+  string realParentPath;
+  const int parentFd = createDirFd(state, parentItem, realParentPath, 0755);
+  if (parentFd < 0) {
+    fuse_reply_err(req, -parentFd);
+    return;
+  }
+
+  if (symlinkat(link, parentFd, name) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_symlink(parent={}, name='{}'): symlinkat failed: {}",
+                  parent, name, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  // links are not followed, so they are files in the tree
+  const auto item =
+      addItem(state, childPath(parentItem, name), realParentPath, name, file);
+  if (item == nullptr) {
+    fuse_reply_err(req, errno);
+    return;
+  }
+  parentItem->invalidateAttributes();
+  replyEntry(req, state, item);
+}
+
+void usvfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+                     fuse_ino_t newparent, const char* newname,
+                     unsigned int flags) noexcept
+{
+  logger::trace("usvfs_ll_rename(parent={}, name='{}', newparent={}, newname='{}', "
+                "flags={})",
+                parent, name, newparent, newname, flags);
+  auto* state         = getState(req);
+  auto* parentItem    = getItem(state, parent);
+  auto* newParentItem = getItem(state, newparent);
+
+  if ((flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) != 0) {
+    fuse_reply_err(req, EINVAL);
+    return;
+  }
+  const bool exchange = (flags & RENAME_EXCHANGE) != 0;
+
+  const auto oldItem = parentItem->find(name);
+  if (oldItem == nullptr) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+  const auto target = newParentItem->find(newname);
+  if ((flags & RENAME_NOREPLACE) != 0 && target != nullptr) {
+    fuse_reply_err(req, EEXIST);
+    return;
+  }
+  if (exchange && target == nullptr) {
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+
+  EpochGuard guard;
+  string newRealParentPath;
+  const int newFd = createDirFd(state, newParentItem, newRealParentPath, 0755);
+  if (newFd < 0) {
+    fuse_reply_err(req, -newFd);
+    return;
+  }
+  const string oldRealPath    = oldItem->realPath();
+  const int oldFd             = state->parentFd(*oldItem, oldRealPath);
+  const string newRealPath    = newRealParentPath + "/" + newname;
+  const string targetRealPath = target != nullptr ? target->realPath() : "";
+
+  if (exchange && targetRealPath != newRealPath) {
+    // the target is stored in another directory, so it cannot be swapped on disk
+    fuse_reply_err(req, EXDEV);
+    return;
+  }
+
+  if (renameat2(oldFd, getFileNamePtr(oldRealPath), newFd, newname, flags) != 0) {
+    const int e = errno;
+    logger::error("usvfs_ll_rename(parent={}, name='{}', newparent={}, newname='{}'): "
+                  "renameat2 failed for '{}': {}",
+                  parent, name, newparent, newname, oldRealPath, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  // the items are moved instead of being added again, so the node ids the kernel knows
+  // stay valid and lookups below a renamed directory find its children right away
+  const string oldPath = childPath(parentItem, name);
+  const string newPath = childPath(newParentItem, newname);
+  const auto newItem   = state->fileTree->move(oldPath, newPath, exchange);
+  if (newItem == nullptr) {
+    const int e = errno;
+    logger::error("usvfs_ll_rename(parent={}, name='{}', newparent={}, newname='{}'): "
+                  "error moving the item in the file tree: {}",
+                  parent, name, newparent, newname, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  if (!exchange && target != nullptr && target->isDir() &&
+      targetRealPath == newRealPath) {
+    // the replaced directory is gone
+    state->fdMap.erase(targetRealPath);
+  }
+
+  vector<MountState::Relocation> relocations;
+  bool copied = newItem != oldItem;
+  try {
+    state->collectRelocations(newPath, newItem, oldRealPath, newRealPath, relocations,
+                              copied);
+    if (exchange) {
+      const auto swapped = state->fileTree->find(oldPath);
+      if (swapped != nullptr) {
+        copied |= swapped != target;
+        state->collectRelocations(oldPath, swapped, targetRealPath, oldRealPath,
+                                  relocations, copied);
+      }
+    }
+  } catch (const std::bad_alloc&) {
+    logger::error("usvfs_ll_rename(parent={}, name='{}'): error updating the real "
+                  "paths: {}",
+                  parent, name, strerror(ENOMEM));
+  }
+  state->applyRelocations(relocations);
+  parentItem->invalidateAttributes();
+  newParentItem->invalidateAttributes();
+
+  if (copied) {
+    // items shared with another tree were copied, so the kernel has to look up the new
+    // nodes
+    state->invalidator.invalidate(newPath);
+    if (exchange) {
+      state->invalidator.invalidate(oldPath);
+    }
+  }
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
+                   const char* newname) noexcept
+{
+  logger::trace("usvfs_ll_link(ino={}, newparent={}, newname='{}')", ino, newparent,
+                newname);
+  auto* state         = getState(req);
+  auto* item          = getItem(state, ino);
+  auto* newParentItem = getItem(state, newparent);
+
+  if (newParentItem->find(newname) != nullptr) {
+    fuse_reply_err(req, EEXIST);
+    return;
+  }
+
+  EpochGuard guard;
+  string newRealParentPath;
+  const int newFd = createDirFd(state, newParentItem, newRealParentPath, 0755);
+  if (newFd < 0) {
+    fuse_reply_err(req, -newFd);
+    return;
+  }
+  const string realPath = item->realPath();
+
+  if (linkat(state->parentFd(*item, realPath), getFileNamePtr(realPath), newFd, newname,
+             0) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_link(ino={}, newparent={}, newname='{}'): linkat failed "
+                  "for '{}': {}",
+                  ino, newparent, newname, realPath, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  const auto newItem = addItem(state, childPath(newParentItem, newname),
+                               newRealParentPath, newname, file);
+  if (newItem == nullptr) {
+    fuse_reply_err(req, errno);
+    return;
+  }
+  // the link count of the file changed
+  item->invalidateAttributes();
+  newParentItem->invalidateAttributes();
+  replyEntry(req, state, newItem);
+}
+
+void usvfs_ll_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_open(ino={}, flags={})", ino, fi->flags);
+  auto* state = getState(req);
+  auto* item  = getItem(state, ino);
+
+  const string realPath = item->realPath();
+
+  // opening a FIFO blocks until its other end is opened, so the directory is duplicated
+  // instead of keeping the EpochGuard
+  int parentFd;
+  {
+    EpochGuard guard;
+    parentFd = fcntl(state->parentFd(*item, realPath), F_DUPFD_CLOEXEC, 0);
+  }
+  if (parentFd == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_open(ino={}): error duplicating parent fd of '{}': {}", ino,
+                  realPath, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  const int fd = openat(parentFd, getFileNamePtr(realPath), fi->flags);
+  const int e  = errno;
+  close(parentFd);
+  if (fd == -1) {
+    logger::error("usvfs_ll_open(ino={}): openat failed for '{}': {}", ino, realPath,
+                  strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  fi->fh         = fd;
+  fi->keep_cache = state->cacheOptions.kernelCache;
+  state->openPassthrough(fi);
+  if (isWritable(fi)) {
+    // writes through passthrough files are not seen by usvfs, so the attributes are
+    // also dropped when the file is released
+    item->invalidateAttributes();
+  }
+  if (fuse_reply_open(req, fi) != 0) {
+    state->releasePassthrough(fi);
+    close(fd);
+  }
+}
+
+void usvfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                   fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_read(ino={}, size={}, off={})", ino, size, off);
+
+  fuse_bufvec buf = {};
+  buf.count       = 1;
+  buf.buf[0].size = size;
+  buf.buf[0].flags = static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+  buf.buf[0].fd    = static_cast<int>(fi->fh);
+  buf.buf[0].pos   = off;
+
+  fuse_reply_data(req, &buf, FUSE_BUF_SPLICE_MOVE);
+}
+
+void usvfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size,
+                    off_t off, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_write(ino={}, size={}, off={})", ino, size, off);
+
+  const ssize_t res = pwrite(static_cast<int>(fi->fh), buf, size, off);
+  if (res == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_write(ino={}): pwrite failed: {}", ino, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  getItem(getState(req), ino)->invalidateAttributes();
+  fuse_reply_write(req, res);
+}
+
+void usvfs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, fuse_bufvec* in_buf, off_t off,
+                        fuse_file_info* fi) noexcept
+{
+  const size_t size = fuse_buf_size(in_buf);
+  logger::trace("usvfs_ll_write_buf(ino={}, size={}, off={})", ino, size, off);
+
+  fuse_bufvec buf = {};
+  buf.count       = 1;
+  buf.buf[0].size = size;
+  buf.buf[0].flags = static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+  buf.buf[0].fd    = static_cast<int>(fi->fh);
+  buf.buf[0].pos   = off;
+
+  // the data is spliced from the FUSE device to the file if the kernel sent it in a
+  // pipe
+  const ssize_t res = fuse_buf_copy(&buf, in_buf, FUSE_BUF_SPLICE_NONBLOCK);
+  if (res < 0) {
+    const int e = static_cast<int>(-res);
+    logger::error("usvfs_ll_write_buf(ino={}): fuse_buf_copy failed: {}", ino,
+                  strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  getItem(getState(req), ino)->invalidateAttributes();
+  fuse_reply_write(req, static_cast<size_t>(res));
+}
+
+void usvfs_ll_flush(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_flush(ino={})", ino);
+
+  // closing a duplicate reports errors of delayed writes on network file systems
+  // without closing the file
+  const int fd = dup(static_cast<int>(fi->fh));
+  if (fd == -1 || close(fd) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_flush(ino={}): failed: {}", ino, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                    fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_fsync(ino={}, datasync={})", ino, datasync);
+  const int fd = static_cast<int>(fi->fh);
+  if ((datasync ? fdatasync(fd) : fsync(fd)) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_fsync(ino={}): failed: {}", ino, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_release(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_release(ino={})", ino);
+  auto* state = getState(req);
+  state->releasePassthrough(fi);
+  if (isWritable(fi)) {
+    getItem(state, ino)->invalidateAttributes();
+  }
+  close(static_cast<int>(fi->fh));
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode,
+                     fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_create(parent={}, name='{}', mode={}, flags={})", parent,
+                name, mode, fi->flags);
+  auto* state      = getState(req);
+  auto* parentItem = getItem(state, parent);
+
+  string realParentPath;
+  int parentFd;
+  {
+    EpochGuard guard;
+    parentFd = createDirFd(state, parentItem, realParentPath, mode);
+    if (parentFd < 0) {
+      fuse_reply_err(req, -parentFd);
+      return;
+    }
+    // an existing FIFO is opened, which blocks until its other end is opened, so the
+    // directory is duplicated instead of keeping the guard
+    parentFd = fcntl(parentFd, F_DUPFD_CLOEXEC, 0);
+    if (parentFd == -1) {
+      const int e = errno;
+      logger::error("usvfs_ll_create(parent={}, name='{}'): error duplicating fd of "
+                    "'{}': {}",
+                    parent, name, realParentPath, strerror(e));
+      fuse_reply_err(req, e);
+      return;
+    }
+  }
+
+  const int fd = openat(parentFd, name, fi->flags, mode);
+  const int e  = errno;
+  close(parentFd);
+  if (fd == -1) {
+    logger::error("usvfs_ll_create(parent={}, name='{}'): openat failed in '{}': {}",
+                  parent, name, realParentPath, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  const string path = childPath(parentItem, name);
+  auto item         = parentItem->find(name);
+  if (item == nullptr) {
+    item = addItem(state, path, realParentPath, name, file);
+    if (item == nullptr) {
+      const int e = errno;
+      close(fd);
+      fuse_reply_err(req, e);
+      return;
+    }
+    parentItem->invalidateAttributes();
+  }
+  item->invalidateAttributes();
+
+  fuse_entry_param entry{};
+  if (fstat(fd, &entry.attr) == -1) {
+    const int e = errno;
+    close(fd);
+    fuse_reply_err(req, e);
+    return;
+  }
+  entry.attr.st_ino   = getIno(state, item.get());
+  entry.ino           = state->inodes.ref(item);
+  entry.attr_timeout  = state->cacheOptions.attrTimeout;
+  entry.entry_timeout = state->cacheOptions.entryTimeout;
+
+  fi->fh         = fd;
+  fi->keep_cache = state->cacheOptions.kernelCache;
+  state->openPassthrough(fi);
+  if (fuse_reply_create(req, &entry, fi) != 0) {
+    state->inodes.unref(entry.ino, 1);
+    state->releasePassthrough(fi);
+    close(fd);
+  }
+}
+
+void usvfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_opendir(ino={})", ino);
+  auto* item = getItem(getState(req), ino);
+
+  if (!item->isDir()) {
+    fuse_reply_err(req, ENOTDIR);
+    return;
+  }
+
+  auto* handle = new (nothrow) DirHandle;
+  if (handle == nullptr) {
+    fuse_reply_err(req, ENOMEM);
+    return;
+  }
+
+  for (const auto& child : item->getChildren() | views::values) {
+    if (!child->isDeleted()) {
+      handle->entries.emplace_back(child);
+    }
+  }
+
+  // let the kernel keep the listing across opens, the kernel drops it when the
+  // directory is changed through the mount and the watcher invalidates it
+  fi->fh            = reinterpret_cast<uint64_t>(handle);
+  fi->cache_readdir = true;
+  fi->keep_cache    = true;
+  if (fuse_reply_open(req, fi) != 0) {
+    delete handle;
+  }
+}
+
+void usvfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                      fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_readdir(ino={}, size={}, off={})", ino, size, off);
+  auto* state  = getState(req);
+  auto* handle = reinterpret_cast<DirHandle*>(fi->fh);
+
+  auto& buf = handle->buf;
+  if (buf.size() < size) {
+    try {
+      buf.resize(size);
+    } catch (const std::bad_alloc&) {
+      fuse_reply_err(req, ENOMEM);
+      return;
+    }
+  }
+  size_t used = 0;
+
+  // offset 0 and 1 are '.' and '..', the children follow. The offset passed to
+  // fuse_add_direntry is the offset of the next entry
+  const auto entryCount = static_cast<off_t>(handle->entries.size()) + 2;
+  for (off_t i = off; i < entryCount; ++i) {
+    struct stat stbuf{};
+    string name;
+    if (i < 2) {
+      name          = i == 0 ? "." : "..";
+      stbuf.st_mode = S_IFDIR;
+    } else {
+      const auto& child = handle->entries[i - 2];
+      name              = child->fileName();
+      stbuf.st_mode     = toFileType(child->getType());
+      stbuf.st_ino      = getIno(state, child.get());
+    }
+
+    const size_t entrySize =
+        fuse_add_direntry(req, buf.data() + used, size - used, name.c_str(), &stbuf,
+                          i + 1);
+    if (entrySize > size - used) {
+      break;
+    }
+    used += entrySize;
+  }
+
+  fuse_reply_buf(req, buf.data(), used);
+}
+
+void usvfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_releasedir(ino={})", ino);
+  delete reinterpret_cast<DirHandle*>(fi->fh);
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync,
+                       fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_fsyncdir(ino={}, datasync={})", ino, datasync);
+  auto* state = getState(req);
+  auto* item  = getItem(state, ino);
+
+  // fi->fh is the snapshot of the directory, the real directory is synced through its
+  // cached file descriptor
+  (void)fi;
+  EpochGuard guard;
+  const int fd = state->dirFd(*item, item->realPath());
+  if (fd == -1 || (datasync ? fdatasync(fd) : fsync(fd)) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_fsyncdir(ino={}): failed: {}", ino, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_statfs(fuse_req_t req, fuse_ino_t ino) noexcept
+{
+  logger::trace("usvfs_ll_statfs(ino={})", ino);
+  auto* state = getState(req);
+
+  struct statvfs stbuf{};
+  EpochGuard guard;
+  const int fd = state->fdMap.at(state->mountpoint);
+  if (fstatvfs(fd, &stbuf) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_statfs: fstatvfs({}:'{}') failed: {}", fd,
+                  state->mountpoint, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+
+  fuse_reply_statfs(req, &stbuf);
+}
+
+void usvfs_ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset,
+                        off_t length, fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_fallocate(ino={}, mode={}, offset={}, length={})", ino, mode,
+                offset, length);
+  if (fallocate(static_cast<int>(fi->fh), mode, offset, length) == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_fallocate(ino={}): fallocate failed: {}", ino, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  getItem(getState(req), ino)->invalidateAttributes();
+  fuse_reply_err(req, 0);
+}
+
+void usvfs_ll_copy_file_range(fuse_req_t req, fuse_ino_t ino_in, off_t off_in,
+                              fuse_file_info* fi_in, fuse_ino_t ino_out, off_t off_out,
+                              fuse_file_info* fi_out, size_t len, int flags) noexcept
+{
+  logger::trace("usvfs_ll_copy_file_range(ino_in={}, off_in={}, ino_out={}, "
+                "off_out={}, len={}, flags={})",
+                ino_in, off_in, ino_out, off_out, len, flags);
+  const int fdIn    = static_cast<int>(fi_in->fh);
+  const int fdOut   = static_cast<int>(fi_out->fh);
+  const ssize_t res = copy_file_range(fdIn, &off_in, fdOut, &off_out, len, flags);
+  if (res == -1) {
+    const int e = errno;
+    logger::error("usvfs_ll_copy_file_range(ino_in={}, ino_out={}): copy_file_range "
+                  "failed: {}",
+                  ino_in, ino_out, strerror(e));
+    fuse_reply_err(req, e);
+    return;
+  }
+  getItem(getState(req), ino_out)->invalidateAttributes();
+  fuse_reply_write(req, static_cast<size_t>(res));
+}
+
+void usvfs_ll_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence,
+                    fuse_file_info* fi) noexcept
+{
+  logger::trace("usvfs_ll_lseek(ino={}, off={}, whence={})", ino, off, whence);
+  const off_t res = lseek(static_cast<int>(fi->fh), off, whence);
+  if (res == -1) {
+    const int e = errno;
+    if (e != ENXIO) {
+      logger::error("usvfs_ll_lseek(ino={}): lseek failed: {}", ino, strerror(e));
+    }
+    fuse_reply_err(req, e);
+    return;
+  }
+  fuse_reply_lseek(req, res);
+}
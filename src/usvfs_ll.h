@@ -0,0 +1,151 @@
+#pragma once
+
+// Operations for the inode based low level API. Node ids are the addresses of the
+// corresponding file tree items, see InodeTable
+
+/** Initialize filesystem
+ *
+ * Applies the connection related cache options of the mount
+ */
+void usvfs_ll_init(void* userdata, fuse_conn_info* conn) noexcept;
+
+/** Look up a directory entry by name and get its attributes.
+ *
+ * Increases the lookup count of the found item, see usvfs_ll_forget
+ */
+void usvfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) noexcept;
+
+/** Forget about an inode
+ *
+ * Decreases the lookup count of the inode by nlookup. The item is released once the
+ * lookup count reaches zero
+ */
+void usvfs_ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) noexcept;
+
+// Forget about multiple inodes, see usvfs_ll_forget
+void usvfs_ll_forget_multi(fuse_req_t req, size_t count,
+                           fuse_forget_data* forgets) noexcept;
+
+/** Get file attributes.
+ *
+ * `fi` may be NULL if the file is not currently open
+ */
+void usvfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept;
+
+/** Set file attributes
+ *
+ * The bits in `to_set` define which attributes of `attr` should be changed. `fi`
+ * will be NULL if the file is not currently open
+ */
+void usvfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set,
+                      fuse_file_info* fi) noexcept;
+
+// Read the target of a symbolic link
+void usvfs_ll_readlink(fuse_req_t req, fuse_ino_t ino) noexcept;
+
+/** Create a directory
+ *
+ * The directory is created in the upper directory if one is set, otherwise in the real
+ * directory of the parent
+ */
+void usvfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name,
+                    mode_t mode) noexcept;
+
+// Remove a file, the item is marked as deleted in the file tree
+void usvfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) noexcept;
+
+// Remove an empty directory, the item is marked as deleted in the file tree
+void usvfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) noexcept;
+
+// Create a symbolic link
+void usvfs_ll_symlink(fuse_req_t req, const char* link, fuse_ino_t parent,
+                      const char* name) noexcept;
+
+/** Rename a file or directory
+ *
+ * RENAME_NOREPLACE and RENAME_EXCHANGE are supported. The items are moved in the file
+ * tree, so they keep their node ids
+ */
+void usvfs_ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+                     fuse_ino_t newparent, const char* newname,
+                     unsigned int flags) noexcept;
+
+// Create a hard link
+void usvfs_ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
+                   const char* newname) noexcept;
+
+/** Open a file
+ *
+ * The file descriptor of the real file is stored in fi->fh
+ */
+void usvfs_ll_open(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept;
+
+/** Read data
+ *
+ * The data is spliced from the file descriptor stored in fi->fh if possible
+ */
+void usvfs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                   fuse_file_info* fi) noexcept;
+
+// Write data
+void usvfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size,
+                    off_t off, fuse_file_info* fi) noexcept;
+
+/** Create and open a file
+ *
+ * Like usvfs_ll_open, the file descriptor of the real file is stored in fi->fh
+ */
+void usvfs_ll_create(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode,
+                     fuse_file_info* fi) noexcept;
+
+/** Write data stored in a buffer vector
+ *
+ * The data is spliced into the file stored in fi->fh if possible instead of being
+ * copied through user space
+ */
+void usvfs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, fuse_bufvec* in_buf, off_t off,
+                        fuse_file_info* fi) noexcept;
+
+// Flush an open file, called on every close of a file descriptor
+void usvfs_ll_flush(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept;
+
+// Synchronize the contents of an open file, only the data if datasync is set
+void usvfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                    fuse_file_info* fi) noexcept;
+
+// Release an open file, closes the file descriptor stored in fi->fh
+void usvfs_ll_release(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept;
+
+/** Open a directory
+ *
+ * Takes a snapshot of the directory entries which is stored in fi->fh, the snapshot is
+ * used by usvfs_ll_readdir to continue at a given offset
+ */
+void usvfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept;
+
+// Read a directory, starting at the given offset
+void usvfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                      fuse_file_info* fi) noexcept;
+
+// Release a directory, frees the snapshot created by usvfs_ll_opendir
+void usvfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, fuse_file_info* fi) noexcept;
+
+// Synchronize the contents of a directory, only the data if datasync is set
+void usvfs_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync,
+                       fuse_file_info* fi) noexcept;
+
+// Get file system statistics
+void usvfs_ll_statfs(fuse_req_t req, fuse_ino_t ino) noexcept;
+
+// Allocate space for an open file
+void usvfs_ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset,
+                        off_t length, fuse_file_info* fi) noexcept;
+
+// Copy a range of data from one open file to another without passing it through FUSE
+void usvfs_ll_copy_file_range(fuse_req_t req, fuse_ino_t ino_in, off_t off_in,
+                              fuse_file_info* fi_in, fuse_ino_t ino_out, off_t off_out,
+                              fuse_file_info* fi_out, size_t len, int flags) noexcept;
+
+// Find the next data or hole after the specified offset
+void usvfs_ll_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence,
+                    fuse_file_info* fi) noexcept;
@@ -1,11 +1,16 @@
 #include "usvfs-fuse/usvfsmanager.h"
 
+#include "dirfdcache.h"
+#include "epoch.h"
 #include "fdmap.h"
 #include "logger.h"
 #include "loghelpers.h"
 #include "mountstate.h"
+#include "treecache.h"
+#include "treescanner.h"
 #include "usvfs-fuse/usvfs_version.h"
 #include "usvfs.h"
+#include "usvfs_ll.h"
 #include "utils.h"
 #include "virtualfiletreeitem.h"
 
@@ -15,51 +20,83 @@ namespace fs = std::filesystem;
 namespace
 {
 
-constexpr int pollTimeout        = 10;
 constexpr size_t stackSize       = 1024 * 1024;       // stack size for cloned child
 constexpr size_t maxLogFileSize  = 1024 * 1024 * 10;  // 10 MiB
 constexpr size_t maxLogFileCount = 10;
+// the soft limit of open files is raised to this if the hard limit allows it
+constexpr rlim_t maxOpenFiles = 524288;
 
-shared_ptr<VirtualFileTreeItem> createFileTree(const string& path, FdMap& fdMap)
+shared_ptr<VirtualFileTreeItem> createFileTree(const string& path, FdMap& fdMap,
+                                               TreeCache* cache)
 {
   logger::debug("creating file tree for {}", path);
-  error_code ec;
   auto fileTree = VirtualFileTreeItem::create("/", path, dir);
+  // the destination is mounted over, so its directories cannot be opened by path later
+  scanDirectoryTree(path, *fileTree, fdMap, cache, true);
+  return fileTree;
+}
 
-  int fd = open(path.c_str(), OPEN_FLAGS);
-  if (fd == -1) {
-    throw runtime_error(
-        format("error opening directory {}: {}", path, strerror(errno)));
+// raise the soft limit of open files, every linked directory may need a file descriptor
+void raiseOpenFileLimit() noexcept
+{
+  rlimit limit = {};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+    logger::warn("getrlimit() failed: {}", strerror(errno));
+    return;
   }
-  logger::trace("adding fd {} for {}", fd, path);
-  fdMap[path] = fd;
 
-  fs::recursive_directory_iterator iter(path, ec);
-  if (ec) {
-    throw runtime_error("error creating file tree: "s + ec.message());
+  const rlim_t previous = limit.rlim_cur;
+  limit.rlim_cur        = min(limit.rlim_max, maxOpenFiles);
+  if (previous >= limit.rlim_cur) {
+    return;
   }
-  for (const fs::directory_entry& entry : iter) {
-    fs::path relative = fs::relative(entry.path(), path);
+  if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+    logger::warn("setrlimit() failed: {}", strerror(errno));
+    return;
+  }
+  logger::debug("raised open file limit from {} to {}", previous, limit.rlim_cur);
+}
 
-    logger::debug("adding '{}' to file tree", relative.string());
-    auto newItem =
-        fileTree->add(relative.string(), entry.path().string(),
-                      entry.status().type() == fs::file_type::directory ? dir : file);
-    if (newItem == nullptr) {
-      throw runtime_error("error adding "s + relative.string() + " to file tree");
-    }
+// half of the open file limit is used for directories, the rest is left for the files
+// opened through the mounts
+size_t defaultDirFdBudget() noexcept
+{
+  rlimit limit = {};
+  if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY) {
+    return maxOpenFiles / 2;
+  }
+  return limit.rlim_cur / 2;
+}
 
-    if (entry.is_directory()) {
-      fd = open(entry.path().string().c_str(), OPEN_FLAGS);
-      if (fd == -1) {
-        throw runtime_error(
-            format("error opening directory {}: {}", path, strerror(errno)));
-      }
-      logger::trace("adding fd {} for {}", fd, entry.path().string());
-      fdMap[entry.path().string()] = fd;
-    }
+// add a directory to the map of a mount. Directories already linked by other calls or
+// into other mounts share their entry in the cache and are not opened again
+DirId addDirectory(FdMap& fdMap, const string& path, bool pinned = false) noexcept
+{
+  const DirId dirId = fdMap.insert(path, -1, pinned);
+  EpochGuard guard;
+  if (dirId == invalidDir || fdMap.cache()->get(dirId) == -1) {
+    logger::error("open() failed for {}: {}", path, strerror(errno));
+    return invalidDir;
+  }
+  return dirId;
+}
+
+// load the tree cache of a mount point, returns nullptr if caching is disabled
+unique_ptr<TreeCache> loadTreeCache(const string& cacheDir,
+                                    const string& mountpoint) noexcept
+{
+  if (cacheDir.empty()) {
+    return nullptr;
+  }
+
+  try {
+    auto cache = make_unique<TreeCache>();
+    cache->load(TreeCache::fileName(cacheDir, mountpoint));
+    return cache;
+  } catch (const bad_alloc&) {
+    logger::error("error loading tree cache for {}: {}", mountpoint, strerror(ENOMEM));
+    return nullptr;
   }
-  return fileTree;
 }
 
 fuse_operations createOperations() noexcept
@@ -89,11 +126,11 @@ fuse_operations createOperations() noexcept
   // listxattr
   // listxattr
   // removexattr
-  // ops.opendir = usvfs_opendir;
+  ops.opendir    = usvfs_opendir;
   ops.readdir    = usvfs_readdir;
   ops.releasedir = usvfs_releasedir;
   ops.fsyncdir   = usvfs_fsyncdir;
-  // init
+  ops.init       = usvfs_init;
   // destroy
   // access
   ops.create = usvfs_create;
@@ -102,15 +139,113 @@ fuse_operations createOperations() noexcept
   ops.bmap = nullptr;
   // ioctl
   // poll
-  // write_buf
-  // read_buf
+  ops.write_buf = usvfs_write_buf;
+  ops.read_buf  = usvfs_read_buf;
   // flock
-  // fallocate
-  // copy_file_range
-  // lseek
+  ops.fallocate       = usvfs_fallocate;
+  ops.copy_file_range = usvfs_copy_file_range;
+  ops.lseek           = usvfs_lseek;
+  return ops;
+}
+
+fuse_lowlevel_ops createLowLevelOperations() noexcept
+{
+  fuse_lowlevel_ops ops = {};
+  ops.init              = usvfs_ll_init;
+  ops.lookup            = usvfs_ll_lookup;
+  ops.forget            = usvfs_ll_forget;
+  ops.forget_multi      = usvfs_ll_forget_multi;
+  ops.getattr           = usvfs_ll_getattr;
+  ops.setattr           = usvfs_ll_setattr;
+  ops.readlink          = usvfs_ll_readlink;
+  ops.mkdir             = usvfs_ll_mkdir;
+  ops.unlink            = usvfs_ll_unlink;
+  ops.rmdir             = usvfs_ll_rmdir;
+  ops.symlink           = usvfs_ll_symlink;
+  ops.rename            = usvfs_ll_rename;
+  ops.link              = usvfs_ll_link;
+  ops.open              = usvfs_ll_open;
+  ops.read              = usvfs_ll_read;
+  ops.write             = usvfs_ll_write;
+  ops.write_buf         = usvfs_ll_write_buf;
+  ops.flush             = usvfs_ll_flush;
+  ops.fsync             = usvfs_ll_fsync;
+  ops.release           = usvfs_ll_release;
+  ops.opendir           = usvfs_ll_opendir;
+  ops.readdir           = usvfs_ll_readdir;
+  ops.releasedir        = usvfs_ll_releasedir;
+  ops.fsyncdir          = usvfs_ll_fsyncdir;
+  ops.statfs            = usvfs_ll_statfs;
+  ops.fallocate         = usvfs_ll_fallocate;
+  ops.copy_file_range   = usvfs_ll_copy_file_range;
+  ops.lseek             = usvfs_ll_lseek;
+  ops.create            = usvfs_ll_create;
   return ops;
 }
 
+// create the FUSE handle or session for the selected API and mount it
+bool createAndMount(MountState* state, fuse_args* args) noexcept
+{
+  if (state->lowLevel) {
+    const fuse_lowlevel_ops ops = createLowLevelOperations();
+
+    state->session = fuse_session_new(args, &ops, sizeof(fuse_lowlevel_ops), state);
+    if (state->session == nullptr) {
+      logger::error("fuse_session_new() failed for mountpoint {}", state->mountpoint);
+      return false;
+    }
+    if (fuse_session_mount(state->session, state->mountpoint.c_str()) != 0) {
+      fuse_session_destroy(state->session);
+      state->session = nullptr;
+      logger::error("fuse_session_mount() failed for mountpoint {}", state->mountpoint);
+      return false;
+    }
+    return true;
+  }
+
+  const fuse_operations ops = createOperations();
+
+  state->fusePtr = fuse_new(args, &ops, sizeof(fuse_operations), state);
+  if (state->fusePtr == nullptr) {
+    logger::error("fuse_new() failed for mountpoint {}", state->mountpoint);
+    return false;
+  }
+  if (fuse_mount(state->fusePtr, state->mountpoint.c_str()) == -1) {
+    fuse_destroy(state->fusePtr);
+    state->fusePtr = nullptr;
+    logger::error("fuse_mount() failed for mountpoint {}: {}", state->mountpoint,
+                  strerror(errno));
+    return false;
+  }
+  state->session = fuse_get_session(state->fusePtr);
+  return true;
+}
+
+// start sending kernel cache invalidations for a mount. The thread belongs to the
+// calling process, which has to stop it before the mount is destroyed
+void startInvalidator(MountState* state) noexcept
+{
+  if (state->lowLevel) {
+    state->invalidator.start(state->session, state->fileTree);
+  } else {
+    state->invalidator.start(state->fusePtr);
+  }
+}
+
+// the watcher and the invalidator use the mount, they have to be stopped first
+void unmountAndDestroy(MountState* state) noexcept
+{
+  if (state->fusePtr != nullptr) {
+    fuse_unmount(state->fusePtr);
+    fuse_destroy(state->fusePtr);
+    state->fusePtr = nullptr;
+  } else if (state->session != nullptr) {
+    fuse_session_unmount(state->session);
+    fuse_session_destroy(state->session);
+  }
+  state->session = nullptr;
+}
+
 void writeToFile(const string& filename, string_view content) noexcept(false)
 {
   ofstream ofs(filename);
@@ -121,6 +256,71 @@ void writeToFile(const string& filename, string_view content) noexcept(false)
   ofs << content;
 }
 
+// runs the FUSE event loop for the given mount, blocks until it is unmounted
+int runFuseLoop(const MountState* state) noexcept
+{
+  if (state->maxThreads == 0) {
+    return state->lowLevel ? fuse_session_loop(state->session)
+                           : fuse_loop(state->fusePtr);
+  }
+
+  fuse_loop_config* config = fuse_loop_cfg_create();
+  if (config == nullptr) {
+    logger::error("fuse_loop_cfg_create() failed, falling back to single thread");
+    return state->lowLevel ? fuse_session_loop(state->session)
+                           : fuse_loop(state->fusePtr);
+  }
+
+  // use a separate /dev/fuse fd per worker to avoid contention on a single queue
+  fuse_loop_cfg_set_clone_fd(config, 1);
+  fuse_loop_cfg_set_max_threads(config, state->maxThreads);
+  fuse_loop_cfg_set_idle_threads(config, state->maxIdleThreads);
+
+  logger::debug("starting fuse loop for {} with up to {} threads", state->mountpoint,
+                state->maxThreads);
+  const int result = state->lowLevel ? fuse_session_loop_mt(state->session, config)
+                                     : fuse_loop_mt(state->fusePtr, config);
+  fuse_loop_cfg_destroy(config);
+  return result;
+}
+
+// lend the thread local storage of the calling thread to the namespace child of a
+// mount. The child shares the memory of this process, so with the storage of the thread
+// cloning it, both would use the same EpochGuard record, errno and lookup buffers. This
+// thread does nothing but wait until it is released, so the child has it to itself
+void lendTls(promise<void*> tls, int releaseFd) noexcept
+{
+  // signal handlers would run on the storage used by the child
+  sigset_t signals;
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  tls.set_value(__builtin_thread_pointer());
+
+  eventfd_t value;
+  eventfd_read(releaseFd, &value);
+}
+
+// start the thread lending its thread local storage to the namespace child of a mount
+bool startTlsThread(MountState* state) noexcept
+{
+  state->tlsReleaseFd = eventfd(0, EFD_CLOEXEC);
+  if (state->tlsReleaseFd == -1) {
+    logger::error("eventfd() failed: {}", strerror(errno));
+    return false;
+  }
+
+  try {
+    promise<void*> tls;
+    future<void*> result = tls.get_future();
+    state->tlsThread     = thread(lendTls, std::move(tls), state->tlsReleaseFd);
+    state->childTls      = result.get();
+  } catch (const system_error& e) {
+    logger::error("failed to start thread for the namespace child: {}", e.what());
+    return false;
+  }
+  return true;
+}
+
 int childFunc(void* arg) noexcept
 {
   auto* state = static_cast<MountState*>(arg);
@@ -151,33 +351,28 @@ int childFunc(void* arg) noexcept
   int argc           = 3;
   fuse_args args     = FUSE_ARGS_INIT(argc, const_cast<char**>(argv));
 
-  fuse_operations ops = createOperations();
-
-  state->fusePtr = fuse_new(&args, &ops, sizeof(fuse_operations), state);
+  const bool mounted = createAndMount(state, &args);
   fuse_opt_free_args(&args);
-  if (state->fusePtr == nullptr) {
+  if (!mounted) {
     // Couldn't create FUSE handle; drop the mount
-    logger::error("fuse_new() failed");
     return -1;
   }
-  if (fuse_mount(state->fusePtr, state->mountpoint.c_str()) == -1) {
-    fuse_destroy(state->fusePtr);
-    state->fusePtr = nullptr;
-    logger::error("fuse_mount() failed for mountpoint {}: {}", state->mountpoint,
-                  strerror(errno));
+
+  // this process shares the memory of the parent, but not its threads. The parent
+  // starts the threads of the mount once it is told that the mount exists
+  if (eventfd_write(state->readyFd, 1) == -1) {
+    logger::error("eventfd_write() failed: {}", strerror(errno));
+    unmountAndDestroy(state);
     return -1;
   }
 
   // set signal handlers
-  fuse_session* session = fuse_get_session(state->fusePtr);
-  fuse_set_signal_handlers(session);
+  fuse_set_signal_handlers(state->session);
 
   // enter loop; this blocks until unmounted or interrupted by the signal handler
-  fuse_loop(state->fusePtr);
+  runFuseLoop(state);
 
-  fuse_unmount(state->fusePtr);
-  fuse_destroy(state->fusePtr);
-  state->fusePtr = nullptr;
+  unmountAndDestroy(state);
 
   return 0;
 }
@@ -206,7 +401,7 @@ bool UsvfsManager::usvfsVirtualLinkFile(const std::string& source,
   const fs::path srcPath = fs::path(source);
   const fs::path dstPath = fs::path(destination);
 
-  FdMap fdMap;
+  FdMap fdMap(m_dirFds);
 
   string dstDir = dstPath.parent_path().string();
 
@@ -222,14 +417,11 @@ bool UsvfsManager::usvfsVirtualLinkFile(const std::string& source,
       // destination exists, add to the existing file tree
       auto result = state->fileTree->add(dstPath.filename().string(), source, file);
       if (result != nullptr) {
-        string parentDir = getParentPath(source);
-        int fd           = open(parentDir.c_str(), OPEN_FLAGS);
-        if (fd == -1) {
-          logger::error("open() failed for {}: {}", parentDir, strerror(errno));
+        const DirId parentDir = addDirectory(state->fdMap, getParentPath(source));
+        if (parentDir == invalidDir) {
           return false;
         }
-        logger::trace("adding fd {} for {}", fd, parentDir);
-        state->fdMap[parentDir] = fd;
+        result->setRealDirs(parentDir, invalidDir);
       }
       return result != nullptr;
     }
@@ -238,39 +430,31 @@ bool UsvfsManager::usvfsVirtualLinkFile(const std::string& source,
   string srcParentDir = getParentPath(source);
   string dstParentDir = getParentPath(destination);
 
-  // open a file descriptor for the source parent directory
-  int fd = open(srcParentDir.c_str(), OPEN_FLAGS);
-  if (fd == -1) {
-    logger::error("open() failed for {}: {}", srcParentDir, strerror(errno));
-    return false;
-  }
-  logger::trace("adding fd {} for {}", fd, srcParentDir);
-  fdMap[srcParentDir] = fd;
-
-  // open a file descriptor for the destination parent directory
-  fd = open(dstParentDir.c_str(), OPEN_FLAGS);
-  if (fd == -1) {
-    logger::error("open() failed for {}: {}", dstParentDir, strerror(errno));
+  const DirId srcParentId = addDirectory(fdMap, srcParentDir);
+  if (srcParentId == invalidDir ||
+      addDirectory(fdMap, dstParentDir, true) == invalidDir) {
     return false;
   }
-  logger::trace("adding fd {} for {}", fd, dstParentDir);
-  fdMap[dstParentDir] = fd;
 
   // create the file tree for existing files
+  unique_ptr<TreeCache> treeCache = loadTreeCache(m_treeCacheDir, dstDir);
   shared_ptr<VirtualFileTreeItem> destinationFileTree =
-      createFileTree(dstParentDir, fdMap);
+      createFileTree(dstParentDir, fdMap, treeCache.get());
 
   auto result =
       destinationFileTree->add(dstPath.filename().string(), source, file, true);
   if (result == nullptr) {
     return false;
   }
+  result->setRealDirs(srcParentId, invalidDir);
 
   // prepare state and enqueue to the pending list (no mounting yet)
   auto state        = make_unique<MountState>();
   state->fileTree   = std::move(destinationFileTree);
   state->mountpoint = dstDir;
-  state->fdMap      = fdMap;
+  state->fdMap      = std::move(fdMap);
+  state->treeCache  = std::move(treeCache);
+  state->watcher.addRoot(dstParentDir);
   m_pendingMounts.emplace_back(std::move(state));
 
   return true;
@@ -284,75 +468,61 @@ bool UsvfsManager::usvfsVirtualLinkDirectoryStatic(const std::string& source,
 
   logger::trace("{}, source: {}, destination: {}", __FUNCTION__, source, destination);
 
-  error_code ec;
-  FdMap fdMap;
-  {
-    int fd = open(source.c_str(), OPEN_FLAGS);
-    if (fd == -1) {
-      logger::error("error opening {}: {}", source, strerror(errno));
-      return false;
+  FdMap fdMap(m_dirFds);
+
+  // check if destination exists in pending mounts
+  MountState* pendingState = nullptr;
+  for (const auto& state : m_pendingMounts) {
+    if (state->mountpoint == destination) {
+      pendingState = state.get();
+      break;
     }
-    logger::trace("adding fd {} for {}", fd, source);
-    fdMap[source] = fd;
   }
 
+  unique_ptr<TreeCache> treeCache;
+  if (pendingState == nullptr) {
+    treeCache = loadTreeCache(m_treeCacheDir, destination);
+  }
+  TreeCache* cache = pendingState != nullptr ? pendingState->treeCache.get()
+                                             : treeCache.get();
+
+  // the lists are copied, so the watcher keeps skipping the items skipped here
+  const SkipFunction skip =
+      [directories = m_skipDirectories, suffixes = m_skipFileSuffixes](
+          const string& name, Type type) {
+        return type == dir ? fileNameInSkipDirectories(name, directories)
+                           : fileNameInSkipSuffixes(name, suffixes);
+      };
+
   auto sourceFileTree = VirtualFileTreeItem::create("/", source, dir);
   if (flags & linkFlag::RECURSIVE) {
     // create the file tree
-    fs::recursive_directory_iterator iter(source, ec);
-    if (ec) {
-      logger::error("error creating recursive_directory_iterator: {}", ec.message());
+    try {
+      scanDirectoryTree(source, *sourceFileTree, fdMap, cache, false, skip);
+    } catch (const exception& e) {
+      logger::error("error creating file tree for {}: {}", source, e.what());
       return false;
     }
-    for (const fs::directory_entry& entry : iter) {
-      // check if the directory should be skipped
-      string fileName = entry.path().filename().string();
-      if ((entry.is_directory() && fileNameInSkipDirectories(fileName)) ||
-          (!entry.is_directory() && fileNameInSkipSuffixes(fileName))) {
-        continue;
-      }
-
-      fs::path relative = fs::relative(entry.path(), source);
-
-      logger::debug("adding '{}' to file tree", relative.string());
-      auto newItem = sourceFileTree->add(
-          relative.string(), entry.path().string(),
-          entry.status().type() == filesystem::file_type::directory ? dir : file);
-      if (newItem == nullptr) {
-        logger::error("error adding '{}' to file tree", relative.string());
-        return false;
-      }
-      if (entry.is_directory()) {
-        int fd = open(entry.path().string().c_str(), OPEN_FLAGS);
-        if (fd == -1) {
-          logger::error("open('{}') failed: {}", entry.path().string(),
-                        strerror(errno));
-          return false;
-        }
-        fdMap[entry.path().string()] = fd;
-        logger::trace("adding fd {} for {}, real path: {}", fd, fileName,
-                      newItem->realPath());
-      }
-    }
   } else {
+    if (addDirectory(fdMap, source) == invalidDir) {
+      return false;
+    }
     // TODO: check what upstream usvfs really does in this case
   }
 
-  // check if destination exists in pending mounts
-  for (const auto& state : m_pendingMounts) {
-    if (state->mountpoint == destination) {
-      // destination exists, merge file trees
-      *state->fileTree += *sourceFileTree;
-      for (const auto& [path, fd] : fdMap) {
-        state->fdMap[path] = fd;
-      }
-      return true;
+  if (pendingState != nullptr) {
+    // destination exists, merge file trees
+    *pendingState->fileTree += *sourceFileTree;
+    pendingState->fdMap.merge(std::move(fdMap));
+    if (flags & linkFlag::RECURSIVE) {
+      pendingState->watcher.addRoot(source, skip);
     }
+    return true;
   }
 
   // create the file tree for existing files
   shared_ptr<VirtualFileTreeItem> destinationFileTree =
-      createFileTree(destination, fdMap);
+      createFileTree(destination, fdMap, cache);
 
   *destinationFileTree += *sourceFileTree;
 
@@ -360,7 +530,12 @@ bool UsvfsManager::usvfsVirtualLinkDirectoryStatic(const std::string& source,
   auto state        = make_unique<MountState>();
   state->fileTree   = std::move(destinationFileTree);
   state->mountpoint = destination;
-  state->fdMap      = fdMap;
+  state->fdMap      = std::move(fdMap);
+  state->treeCache  = std::move(treeCache);
+  state->watcher.addRoot(destination);
+  if (flags & linkFlag::RECURSIVE) {
+    state->watcher.addRoot(source, skip);
+  }
 
   m_pendingMounts.emplace_back(std::move(state));
 
@@ -680,6 +855,9 @@ bool UsvfsManager::unmount() noexcept
 
   for (std::unique_ptr<MountState>& mount : m_mounts) {
     logger::debug("unmounting {}", mount->mountpoint);
+    // the threads of the mount were started by this process, also in namespace mode
+    mount->watcher.stop();
+    mount->invalidator.stop();
     if (m_useMountNamespace) {
       if (mount->pidFd == -1) {
         logger::warn("mount pidFd is -1");
@@ -698,12 +876,14 @@ bool UsvfsManager::unmount() noexcept
       }
       logger::debug("usvfs exited with code {}", info.si_status);
     } else {
-      fuse_unmount(mount->fusePtr);
-      fuse_destroy(mount->fusePtr);
+      unmountAndDestroy(mount.get());
     }
   }
   m_mounts.clear();
 
+  const DirFdCache::Stats stats = m_dirFds->stats();
+  logger::debug("directory file descriptors: {} hits, {} misses, {} evictions",
+                stats.hits, stats.misses, stats.evictions);
   return true;
 }
 
@@ -726,6 +906,57 @@ void UsvfsManager::setUseMountNamespace(bool value) noexcept
   m_useMountNamespace = value;
 }
 
+void UsvfsManager::setUseLowLevelApi(bool value) noexcept
+{
+  scoped_lock lock(m_mtx);
+  m_useLowLevelApi = value;
+}
+
+void UsvfsManager::setCacheOptions(const FuseCacheOptions& options) noexcept
+{
+  scoped_lock lock(m_mtx);
+  m_cacheOptions = options;
+}
+
+void UsvfsManager::setPassthrough(bool value) noexcept
+{
+  scoped_lock lock(m_mtx);
+  m_passthrough = value;
+}
+
+void UsvfsManager::setTreeCacheDir(std::string directory) noexcept
+{
+  scoped_lock lock(m_mtx);
+  m_treeCacheDir = std::move(directory);
+}
+
+void UsvfsManager::setWatchSources(bool value) noexcept
+{
+  scoped_lock lock(m_mtx);
+  m_watchSources = value;
+}
+
+void UsvfsManager::setDirectoryFdBudget(size_t budget) noexcept
+{
+  scoped_lock lock(m_mtx);
+  m_dirFds->setBudget(budget != 0 ? budget : defaultDirFdBudget());
+}
+
+DirectoryFdStats UsvfsManager::directoryFdStats() const noexcept
+{
+  shared_lock lock(m_mtx);
+  const DirFdCache::Stats stats = m_dirFds->stats();
+  return {stats.hits, stats.misses, stats.evictions, stats.open, stats.pinned};
+}
+
+void UsvfsManager::setFuseThreads(unsigned int maxThreads,
+                                  unsigned int maxIdleThreads) noexcept
+{
+  scoped_lock lock(m_mtx);
+  m_fuseMaxThreads     = maxThreads;
+  m_fuseMaxIdleThreads = maxIdleThreads;
+}
+
 UsvfsManager::UsvfsManager() noexcept
 {
   umask(0);
@@ -736,6 +967,9 @@ UsvfsManager::UsvfsManager() noexcept
     logger->set_pattern("%H:%M:%S.%e [%L] %v");
     logger->set_level(spdlog::level::info);
   }
+
+  raiseOpenFileLimit();
+  m_dirFds = make_shared<DirFdCache>(defaultDirFdBudget());
 }
 
 void UsvfsManager::run_fuse(std::unique_ptr<MountState> state)
@@ -746,22 +980,10 @@ void UsvfsManager::run_fuse(std::unique_ptr<MountState> state)
   int argc           = 3;
   fuse_args args     = FUSE_ARGS_INIT(argc, const_cast<char**>(argv));
 
-  fuse_operations ops = createOperations();
-
-  MountState* raw = state.get();
-  raw->fusePtr    = fuse_new(&args, &ops, sizeof(fuse_operations), raw);
+  MountState* raw    = state.get();
+  const bool mounted = createAndMount(raw, &args);
   fuse_opt_free_args(&args);
-  if (!raw->fusePtr) {
-    logger::error("fuse_new() failed for mountpoint {}", raw->mountpoint);
-    raw->status = MountState::failure;
-    lock.unlock();
-    raw->cv.notify_all();
-    return;
-  }
-  if (fuse_mount(raw->fusePtr, raw->mountpoint.c_str()) == -1) {
-    fuse_destroy(raw->fusePtr);
-    raw->fusePtr = nullptr;
-    logger::error("fuse_mount() failed for mountpoint {}", raw->mountpoint);
+  if (!mounted) {
     raw->status = MountState::failure;
     lock.unlock();
     raw->cv.notify_all();
@@ -770,12 +992,13 @@ void UsvfsManager::run_fuse(std::unique_ptr<MountState> state)
 
   m_mounts.emplace_back(std::move(state));
 
+  startInvalidator(raw);
   raw->status = MountState::success;
   lock.unlock();
   raw->cv.notify_all();
 
   // Enter loop; this blocks until unmounted
-  fuse_loop(raw->fusePtr);
+  runFuseLoop(raw);
 }
 
 bool UsvfsManager::fileNameInSkipSuffixes(const std::string& fileName) const noexcept
@@ -849,22 +1072,50 @@ bool UsvfsManager::mountInternal() noexcept
   vector<unique_ptr<MountState>> toMount;
   toMount.swap(m_pendingMounts);
 
-  int fd;
-  if (!m_upperDir.empty()) {
-    fd = open(m_upperDir.c_str(), OPEN_FLAGS);
-    if (fd == -1) {
-      logger::error("failed to open upper directory '{}': {}", m_upperDir,
-                    strerror(errno));
-      return false;
+  // save the listings the file trees were built from for the next launch, failing to
+  // do so only makes the next launch slower
+  for (const auto& state : toMount) {
+    if (state->treeCache != nullptr && !m_treeCacheDir.empty()) {
+      state->treeCache->save(TreeCache::fileName(m_treeCacheDir, state->mountpoint));
     }
+    state->treeCache.reset();
   }
 
   // start a thread or process for each pending mount
   for (auto& state : toMount) {
+    state->maxThreads     = m_fuseMaxThreads;
+    state->maxIdleThreads = m_fuseMaxIdleThreads;
+    if (m_useMountNamespace && state->maxThreads != 0) {
+      // the child running the loop is a process sharing the memory of this one, which
+      // cannot start threads of its own
+      logger::warn("worker threads are not supported with a mount namespace, using the "
+                   "single-threaded loop for {}",
+                   state->mountpoint);
+      state->maxThreads = 0;
+    }
+    state->lowLevel     = m_useLowLevelApi;
+    state->cacheOptions = m_cacheOptions;
+    state->passthrough  = m_passthrough;
+    if (m_watchSources && !m_useLowLevelApi &&
+        state->cacheOptions.negativeTimeout > 0) {
+      // the high level API cannot drop the cached failed lookup of a single name, so
+      // files added to the linked directories would stay missing until it expires
+      logger::warn("negative timeout is not supported when watching the sources of "
+                   "high level mounts, disabling it for {}",
+                   state->mountpoint);
+      state->cacheOptions.negativeTimeout = 0;
+    }
     if (!m_upperDir.empty()) {
+      // all mounts share the file descriptor of the upper directory
+      if (addDirectory(state->fdMap, m_upperDir) == invalidDir) {
+        logger::error("failed to open upper directory '{}'", m_upperDir);
+        return false;
+      }
       state->upperDir = m_upperDir;
-      logger::trace("adding fd {} for {}", fd, m_upperDir);
-      state->fdMap[m_upperDir] = fd;
+    }
+    // the watches have to be added before the destination directories are mounted over
+    if (m_watchSources) {
+      state->watcher.start(state.get());
     }
     if (m_useMountNamespace) {
       // allocate memory to be used for the stack of the child.
@@ -890,36 +1141,52 @@ bool UsvfsManager::mountInternal() noexcept
         state->nsFd = m_nsPidFd;
       }
 
+      // the child signals the eventfd once it is mounted and exits on error
+      state->readyFd = eventfd(0, EFD_CLOEXEC);
+      if (state->readyFd == -1) {
+        logger::error("eventfd() failed: {}", strerror(errno));
+        return false;
+      }
+
+      if (!startTlsThread(state.get())) {
+        return false;
+      }
+
       int result = clone(childFunc, state->stackTop,
-                         flags | SIGCHLD | CLONE_PIDFD | CLONE_FILES | CLONE_VM,
-                         state.get(), &state->pidFd);
+                         flags | SIGCHLD | CLONE_PIDFD | CLONE_FILES | CLONE_VM |
+                             CLONE_SETTLS,
+                         state.get(), &state->pidFd, state->childTls);
       if (state->pidFd == -1 || result == -1) {
         logger::error("clone() failed: {}", strerror(errno));
+        close(state->readyFd);
+        state->readyFd = -1;
         return false;
       }
 
-      // check for error in child
-      // todo: improve this to not determine success with a timeout
-      pollfd pfd = {state->pidFd, POLLIN, 0};
-      result     = poll(&pfd, 1, pollTimeout);
+      pollfd pfds[] = {{state->pidFd, POLLIN, 0}, {state->readyFd, POLLIN, 0}};
+      do {
+        result = poll(pfds, size(pfds), -1);
+      } while (result == -1 && errno == EINTR);
+      const int e = errno;
+      close(state->readyFd);
+      state->readyFd = -1;
       if (result == -1) {
-        logger::error("poll() failed: {}", strerror(errno));
+        logger::error("poll() failed: {}", strerror(e));
         return false;
       }
-      if (result == 1) {
-        const int e    = errno;
+      if ((pfds[1].revents & POLLIN) == 0) {
         siginfo_t info = {};
-        if (waitid(P_PIDFD, state->pidFd, &info, WEXITED | WNOHANG) == -1 &&
-            e != EAGAIN) {
+        if (waitid(P_PIDFD, state->pidFd, &info, WEXITED) == -1) {
           logger::error("waitid() failed: {}", strerror(errno));
           return false;
         }
-        if (info.si_code != 0) {
-          logger::error("child exited with status {}", info.si_code);
-          return false;
-        }
+        logger::error("child exited with status {}", info.si_status);
+        return false;
       }
 
+      // the child only runs the FUSE loop, the threads of the mount run in this process
+      startInvalidator(state.get());
+
       // store pid fd to access namespace
       if (m_nsPidFd == -1) {
         m_nsPidFd = state->pidFd;
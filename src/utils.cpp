@@ -1,5 +1,8 @@
 #include "utils.h"
 
+#include "ascii.h"
+#include "casefolding.h"
+
 using namespace std;
 using namespace icu;
 
@@ -10,23 +13,13 @@ bool iequals(const std::string_view lhs, const std::string_view rhs) noexcept
   }
 
   // try a fast ASCII comparison first
-  bool is_ascii = true;
-  for (size_t i = 0; i < lhs.length(); ++i) {
-    const auto a = static_cast<unsigned char>(lhs[i]);
-    const auto b = static_cast<unsigned char>(rhs[i]);
-
-    if (a > 127 || b > 127) {
-      is_ascii = false;
-      break;
-    }
-    if (tolower(a) != tolower(b)) {
-      return false;
-    }
+  if (const auto result = asciiIEquals(lhs.data(), rhs.data(), lhs.length())) {
+    return *result;
   }
-
-  if (is_ascii) {
-    return true;
+  if (const auto result = unicodeIEquals(lhs, rhs)) {
+    return *result;
   }
+
   const auto a = UnicodeString::fromUTF8(lhs);
   const auto b = UnicodeString::fromUTF8(rhs);
 
@@ -60,76 +53,81 @@ bool istartsWith(const std::string_view lhs, const std::string_view rhs) noexcep
 }
 
 std::string toLower(const std::string_view str) noexcept
+{
+  string result;
+  toLower(str, result);
+  return result;
+}
+
+std::string_view toLower(const std::string_view str, std::string& result) noexcept
 {
   // try using ASCII first
-  bool is_ascii = true;
-  for (const unsigned char c : str) {
-    if (c > 127) {
-      is_ascii = false;
-      break;
-    }
+  if (isAscii(str)) {
+    result.resize(str.length());
+    asciiToLower(str.data(), result.data(), str.length());
+    return result;
+  }
+  if (unicodeToLower(str, result)) {
+    return result;
   }
 
-  string result;
-  result.reserve(str.length());
+  // map the UTF-8 string directly instead of converting it to a UnicodeString, so no
+  // memory is allocated if result is large enough
+  thread_local const unique_ptr<UCaseMap, decltype(&ucasemap_close)> caseMap = [] {
+    UErrorCode status = U_ZERO_ERROR;
+    return unique_ptr<UCaseMap, decltype(&ucasemap_close)>(
+        ucasemap_open(nullptr, U_FOLD_CASE_DEFAULT, &status), &ucasemap_close);
+  }();
+  if (caseMap == nullptr) {
+    auto unicodeStr = UnicodeString::fromUTF8(str);
+    unicodeStr.toLower();
+    result.clear();
+    unicodeStr.toUTF8String(result);
+    return result;
+  }
 
-  if (is_ascii) {
-    for (const char c : str) {
-      result.push_back(static_cast<char>(tolower(c)));
+  // try with the current capacity first and grow the buffer if the result is longer
+  result.resize(max(result.capacity(), str.length()));
+  for (;;) {
+    UErrorCode status    = U_ZERO_ERROR;
+    const int32_t length = ucasemap_utf8ToLower(
+        caseMap.get(), result.data(), static_cast<int32_t>(result.size()), str.data(),
+        static_cast<int32_t>(str.length()), &status);
+    if (status == U_BUFFER_OVERFLOW_ERROR) {
+      result.resize(length);
+      continue;
+    }
+    if (U_FAILURE(status)) {
+      // keep the input unchanged if it cannot be mapped
+      result.assign(str);
+      return result;
     }
+    result.resize(length);
     return result;
   }
-
-  auto unicodeStr = UnicodeString::fromUTF8(str);
-  unicodeStr.toLower();
-
-  unicodeStr.toUTF8String(result);
-  return result;
 }
 
 void toLowerInplace(std::string& str) noexcept
 {
   // try using ASCII first
-  bool is_ascii = true;
-  for (const unsigned char c : str) {
-    if (c > 127) {
-      is_ascii = false;
-      break;
-    }
-  }
-
-  if (is_ascii) {
-    for (char& c : str) {
-      c = static_cast<char>(tolower(c));
-    }
+  if (isAscii(str)) {
+    asciiToLower(str.data(), str.data(), str.length());
     return;
   }
 
-  auto unicodeStr = UnicodeString::fromUTF8(str);
-  unicodeStr.toLower();
-
-  str.clear();
-  unicodeStr.toUTF8String(str);
+  string result;
+  toLower(str, result);
+  str = std::move(result);
 }
 
 std::string toUpper(const std::string_view str) noexcept
 {
-  // try using ASCII first
-  bool is_ascii = true;
-  for (const unsigned char c : str) {
-    if (c > 127) {
-      is_ascii = false;
-      break;
-    }
-  }
-
   string result;
-  result.reserve(str.length());
 
-  if (is_ascii) {
-    for (const char c : str) {
-      result.push_back(static_cast<char>(toupper(c)));
-    }
+  // try using ASCII first
+  if (isAscii(str)) {
+    result.resize(str.length());
+    asciiToUpper(str.data(), result.data(), str.length());
     return result;
   }
 
@@ -143,18 +141,8 @@ std::string toUpper(const std::string_view str) noexcept
 void toUpperInplace(std::string& str) noexcept
 {
   // try using ASCII first
-  bool is_ascii = true;
-  for (const unsigned char c : str) {
-    if (c > 127) {
-      is_ascii = false;
-      break;
-    }
-  }
-
-  if (is_ascii) {
-    for (char& c : str) {
-      c = static_cast<char>(toupper(c));
-    }
+  if (isAscii(str)) {
+    asciiToUpper(str.data(), str.data(), str.length());
     return;
   }
 
@@ -174,6 +162,12 @@ std::string getFileNameFromPath(const std::string_view path) noexcept
   return string(path.substr(pos + 1));
 }
 
+const char* getFileNamePtr(const std::string& path) noexcept
+{
+  const size_t pos = path.find_last_of('/');
+  return pos == string::npos ? path.c_str() : path.c_str() + pos + 1;
+}
+
 std::string getParentPath(const std::string_view path) noexcept
 {
   const size_t pos = path.find_last_of('/');
@@ -183,6 +177,36 @@ std::string getParentPath(const std::string_view path) noexcept
   return string(path.substr(0, pos));
 }
 
+int statAttributes(int dirFd, const char* path, int flags, bool dontSync,
+                   struct stat* st) noexcept
+{
+  constexpr unsigned int mask = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID |
+                                STATX_GID | STATX_ATIME | STATX_MTIME | STATX_CTIME |
+                                STATX_SIZE | STATX_BLOCKS;
+
+  struct statx stx;
+  if (statx(dirFd, path, flags | (dontSync ? AT_STATX_DONT_SYNC : 0), mask, &stx) ==
+      -1) {
+    return -1;
+  }
+
+  *st            = {};
+  st->st_dev     = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  st->st_ino     = stx.stx_ino;
+  st->st_mode    = stx.stx_mode;
+  st->st_nlink   = stx.stx_nlink;
+  st->st_uid     = stx.stx_uid;
+  st->st_gid     = stx.stx_gid;
+  st->st_rdev    = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+  st->st_size    = static_cast<off_t>(stx.stx_size);
+  st->st_blksize = stx.stx_blksize;
+  st->st_blocks  = static_cast<blkcnt_t>(stx.stx_blocks);
+  st->st_atim    = {stx.stx_atime.tv_sec, stx.stx_atime.tv_nsec};
+  st->st_mtim    = {stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec};
+  st->st_ctim    = {stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec};
+  return 0;
+}
+
 std::vector<std::string_view> createEnv() noexcept
 {
   // determine vector size
@@ -4,16 +4,31 @@
 #include <string_view>
 #include <vector>
 
+#include <sys/stat.h>
+
 bool iequals(std::string_view lhs, std::string_view rhs) noexcept;
 bool iendsWith(std::string_view lhs, std::string_view rhs) noexcept;
 bool istartsWith(std::string_view lhs, std::string_view rhs) noexcept;
 std::string toLower(std::string_view str) noexcept;
+
+/**
+ * @brief Convert a string to lower case, reusing the memory of result. Does not
+ * allocate if the capacity of result is sufficient
+ * @return View of result
+ */
+std::string_view toLower(std::string_view str, std::string& result) noexcept;
 std::string toUpper(std::string_view str) noexcept;
 void toUpperInplace(std::string& str) noexcept;
 void toLowerInplace(std::string& str) noexcept;
 
 std::string getFileNameFromPath(std::string_view path) noexcept;
 
+/**
+ * @brief Get the file name of a path without copying it
+ * @return Pointer into path, the name is the end of path and therefore null terminated
+ */
+const char* getFileNamePtr(const std::string& path) noexcept;
+
 /**
  * @brief Returns the parent path of the provided path.
  * @note Returns empty string instead of "/"
@@ -21,3 +36,16 @@ std::string getFileNameFromPath(std::string_view path) noexcept;
 std::string getParentPath(std::string_view path) noexcept;
 
 std::vector<std::string_view> createEnv() noexcept;
+
+/**
+ * @brief Get the attributes FUSE replies with using statx, so file systems like NFS or
+ * SMB can skip fetching the fields that are not requested
+ * @param dontSync Allow network file systems to return their cached attributes instead
+ * of asking the server, for callers that accept attributes that are slightly out of
+ * date
+ * @note The inode number is not requested, usvfs replaces it with its own or lets
+ * libfuse assign one
+ * @return 0 on success, -1 with errno set on error
+ */
+int statAttributes(int dirFd, const char* path, int flags, bool dontSync,
+                   struct stat* st) noexcept;
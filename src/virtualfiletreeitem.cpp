@@ -1,25 +1,50 @@
 #include "virtualfiletreeitem.h"
 
 #include "logger.h"
+#include "pathindex.h"
 #include "utils.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
+namespace
+{
+// lower case a path component for looking it up in the children of an item. Components
+// that are lower case already are returned as they are, others are converted into a
+// buffer of the calling thread, so lookups do not allocate memory
+string_view foldName(string_view name) noexcept
+{
+  const bool isLower = ranges::none_of(name, [](unsigned char c) {
+    return (c >= 'A' && c <= 'Z') || c > 127;
+  });
+  if (isLower) {
+    return name;
+  }
+
+  thread_local string buffer;
+  return toLower(name, buffer);
+}
+
+// number of shared items copied by unshareChild on this thread, so the tree operations
+// know whether indexed items have been replaced
+thread_local size_t unsharedItems = 0;
+}  // namespace
+
 VirtualFileTreeItem::VirtualFileTreeItem(
     std::string path, std::string realPath, Type type,
     std::weak_ptr<VirtualFileTreeItem> parent) noexcept(false)
-    : m_fileName(std::move(path)), m_realPath(std::move(realPath)),
-      m_parent(std::move(parent)), m_type(type), m_deleted(false)
+    : m_fileName(new string(std::move(path))),
+      m_realPath(new string(std::move(realPath))), m_parent(std::move(parent)),
+      m_type(type), m_deleted(false)
 {
-  logger::trace("VirtualFileTreeItem(path='{}', realPath= '{}')", m_fileName,
-                m_realPath);
-  if (m_fileName.empty()) {
+  logger::trace("VirtualFileTreeItem(path='{}', realPath= '{}')", *m_fileName.load(),
+                *m_realPath.load());
+  if (m_fileName.load()->empty()) {
     errno = EINVAL;
     throw runtime_error("filename is empty");
   }
 
-  if (m_realPath.empty()) {
+  if (m_realPath.load()->empty()) {
     errno = EINVAL;
     throw runtime_error("real path is empty");
   }
@@ -28,11 +53,13 @@ VirtualFileTreeItem::VirtualFileTreeItem(
 VirtualFileTreeItem::VirtualFileTreeItem(
     std::string path, std::string realPath,
     std::weak_ptr<VirtualFileTreeItem> parent) noexcept(false)
-    : m_fileName(std::move(path)), m_realPath(std::move(realPath)),
-      m_parent(std::move(parent)), m_deleted(false)
+    : m_fileName(new string(std::move(path))),
+      m_realPath(new string(std::move(realPath))), m_parent(std::move(parent)),
+      m_deleted(false)
 {
-  if (fs::exists(m_realPath)) {
-    if (fs::status(m_realPath).type() == fs::file_type::directory) {
+  const string& real = *m_realPath.load();
+  if (fs::exists(real)) {
+    if (fs::status(real).type() == fs::file_type::directory) {
       m_type = dir;
     } else {
       m_type = file;
@@ -81,32 +108,37 @@ VirtualFileTreeItem::VirtualFileTreeItem(
 {}
 
 VirtualFileTreeItem::VirtualFileTreeItem(const VirtualFileTreeItem& other) noexcept
-    : m_fileName(other.m_fileName), m_realPath(other.m_realPath), m_type(other.m_type),
-      m_deleted(other.m_deleted)
+    : m_fileName(new string(*other.m_fileName.load())),
+      m_realPath(new string(*other.m_realPath.load())), m_type(other.m_type.load()),
+      m_deleted(other.m_deleted.load()), m_realParentDir(other.m_realParentDir.load()),
+      m_realDir(other.m_realDir.load())
 {}
 
+VirtualFileTreeItem::~VirtualFileTreeItem()
+{
+  delete m_attributes.load(memory_order_relaxed);
+
+  // children that outlive this item are not linked by it anymore
+  const auto self = weak_from_this();
+  for (const auto& child : m_children | views::values) {
+    if (child.use_count() > 1) {
+      child->removeParent(self);
+    }
+  }
+}
+
 VirtualFileTreeItem&
 VirtualFileTreeItem::operator+=(const VirtualFileTreeItem& other) noexcept
 {
+  if (this == &other) {
+    return *this;
+  }
+
   unique_lock lock(m_mtx);
   shared_lock lock_other(other.m_mtx);
 
-  m_realPath = other.m_realPath;
-  m_fileName = other.m_fileName;
-
-  for (const auto& [name, item] : other.m_children) {
-    // try to insert a nullptr
-    auto [it, wasInserted] = m_children.try_emplace(name, nullptr);
-    if (wasInserted) {
-      // item did not exist, replace nullptr with a clone
-      it->second = item->clone();
-    } else {
-      // item already exists, merge recursively
-      *it->second += *item;
-    }
-    it->second->m_parent = weak_from_this();
-  }
-
+  string pathLc;
+  mergeInternal(other, m_index.load(), pathLc);
   return *this;
 }
 
@@ -132,7 +164,19 @@ VirtualFileTreeItem::add(std::string_view path, std::string realPath, Type type,
     path.remove_prefix(1);
   }
 
-  return addInternal(path, toLower(path), std::move(realPath), type, updateExisting);
+  unsharedItems = 0;
+  auto item = addInternal(path, std::move(realPath), type, updateExisting);
+  if (PathIndex* index = m_index.load(); item != nullptr && index != nullptr) {
+    if (unsharedItems != 0) {
+      // the copies of shared ancestors replace them in the index
+      EpochGuard guard;
+      reindexPath(*index, path, false);
+    } else {
+      thread_local string pathLc;
+      index->insert(toLower(path, pathLc), item);
+    }
+  }
+  return item;
 }
 
 std::shared_ptr<VirtualFileTreeItem>
@@ -157,9 +201,11 @@ std::shared_ptr<VirtualFileTreeItem> VirtualFileTreeItem::clone() const noexcept
 {
   shared_lock lock(m_mtx);
   try {
-    auto cloned = make_shared<VirtualFileTreeItem>(Passkey{}, m_fileName, m_realPath,
-                                                   m_type, m_parent);
-    cloned->cloneChildrenFrom(*this);
+    // the clone is a separate tree that shares the children
+    auto cloned = copy(m_parent);
+    if (m_index.load() != nullptr) {
+      cloned->setPathIndexEnabled(true);
+    }
     return cloned;
   } catch (const std::bad_alloc&) {
     errno = ENOMEM;
@@ -169,19 +215,17 @@ std::shared_ptr<VirtualFileTreeItem> VirtualFileTreeItem::clone() const noexcept
 
 std::weak_ptr<VirtualFileTreeItem> VirtualFileTreeItem::getParent() const noexcept
 {
-  shared_lock lock(m_mtx);
-  return m_parent;
+  scoped_lock lock(m_parentMtx);
+  return parentInternal();
 }
 
 Type VirtualFileTreeItem::getType() const noexcept
 {
-  shared_lock lock(m_mtx);
   return m_type;
 }
 
 void VirtualFileTreeItem::setType(Type type) noexcept
 {
-  unique_lock lock(m_mtx);
   m_type = type;
 }
 
@@ -200,13 +244,230 @@ bool VirtualFileTreeItem::erase(std::string_view path, bool reallyErase) noexcep
     path.remove_prefix(1);
   }
 
-  return eraseInternal(toLower(path), reallyErase);
+  PathIndex* index = m_index.load();
+  if (index == nullptr) {
+    return eraseInternal(path, reallyErase);
+  }
+
+  EpochGuard guard;
+  unsharedItems = 0;
+  if (!reallyErase) {
+    // items marked as deleted stay in the index, find checks the deleted flag. Marking
+    // a shared item copies it together with its descendants
+    if (!eraseInternal(path, reallyErase)) {
+      return false;
+    }
+    if (unsharedItems != 0) {
+      reindexPath(*index, path, true);
+    }
+    return true;
+  }
+
+  const auto item = findInternal(path, true);
+  if (!eraseInternal(path, reallyErase)) {
+    return false;
+  }
+
+  thread_local string pathLc;
+  index->erase(toLower(path, pathLc));
+  if (item != nullptr) {
+    shared_lock itemLock(item->m_mtx);
+    item->unindexChildren(*index, pathLc);
+  }
+  if (unsharedItems != 0) {
+    const size_t pos = path.rfind('/');
+    reindexPath(*index, pos != string_view::npos ? path.substr(0, pos) : "", false);
+  }
+  return true;
+}
+
+std::shared_ptr<VirtualFileTreeItem>
+VirtualFileTreeItem::unshare(std::string_view path) noexcept
+{
+  unique_lock lock(m_mtx);
+
+  if (path.empty() || path == "/") {
+    errno = EINVAL;
+    return nullptr;
+  }
+
+  // remove leading '/'
+  if (path[0] == '/') {
+    path.remove_prefix(1);
+  }
+
+  EpochGuard guard;
+  unsharedItems = 0;
+  auto item     = unshareInternal(path);
+  if (PathIndex* index = m_index.load(); item != nullptr && index != nullptr) {
+    // the copies share the children, so only the items on the path are indexed again
+    if (unsharedItems != 0) {
+      reindexPath(*index, path, false);
+    }
+  }
+  return item;
+}
+
+std::shared_ptr<VirtualFileTreeItem>
+VirtualFileTreeItem::move(std::string_view from, std::string_view to,
+                          bool exchange) noexcept
+{
+  unique_lock lock(m_mtx);
+
+  // remove leading '/'
+  if (!from.empty() && from[0] == '/') {
+    from.remove_prefix(1);
+  }
+  if (!to.empty() && to[0] == '/') {
+    to.remove_prefix(1);
+  }
+  if (from.empty() || to.empty()) {
+    logger::error("move: paths must not be empty");
+    errno = EINVAL;
+    return nullptr;
+  }
+  // an item cannot become its own descendant or replace its ancestor
+  const auto isBelow = [](string_view path, string_view parent) {
+    return path.size() > parent.size() && path[parent.size()] == '/' &&
+           istartsWith(path, parent);
+  };
+  if (isBelow(to, from) || isBelow(from, to)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+
+  const size_t fromPos = from.rfind('/');
+  const size_t toPos   = to.rfind('/');
+  const string_view fromParentPath =
+      fromPos != string_view::npos ? from.substr(0, fromPos) : "";
+  const string_view toParentPath =
+      toPos != string_view::npos ? to.substr(0, toPos) : "";
+  const string_view fromName =
+      fromPos != string_view::npos ? from.substr(fromPos + 1) : from;
+  const string_view toName = toPos != string_view::npos ? to.substr(toPos + 1) : to;
+
+  EpochGuard guard;
+  unsharedItems = 0;
+
+  // only shared parents are copied, the moved items are linked into their new parent
+  const auto self = shared_from_this();
+  const auto fromParent =
+      fromParentPath.empty() ? self : unshareInternal(fromParentPath);
+  if (fromParent == nullptr) {
+    return nullptr;
+  }
+  const auto toParent = toParentPath.empty() ? self : unshareInternal(toParentPath);
+  if (toParent == nullptr) {
+    return nullptr;
+  }
+
+  // lock the parents, an ancestor has the shorter path and is locked first
+  const bool fromFirst = fromParentPath.size() <= toParentPath.size();
+  auto* first          = fromFirst ? fromParent.get() : toParent.get();
+  auto* second         = fromFirst ? toParent.get() : fromParent.get();
+  unique_lock<shared_mutex> firstLock;
+  unique_lock<shared_mutex> secondLock;
+  if (first != this) {
+    firstLock = unique_lock(first->m_mtx);
+  }
+  if (second != first && second != this) {
+    secondLock = unique_lock(second->m_mtx);
+  }
+
+  try {
+    const auto* fromEntry = fromParent->m_children.find(foldName(fromName));
+    if (fromEntry == nullptr || fromEntry->second->isDeleted()) {
+      errno = ENOENT;
+      logger::debug("{} not found", from);
+      return nullptr;
+    }
+    const string fromKey = fromEntry->first;
+    const string toKey(foldName(toName));
+
+    // the item is renamed, so other trees sharing it have to keep their copy
+    const auto item = fromParent->unshareChild(*fromEntry);
+    if (item == nullptr) {
+      return nullptr;
+    }
+
+    if (fromParent == toParent && fromKey == toKey) {
+      // only the case of the name changes, the indexed paths stay the same
+      if (!exchange) {
+        item->setName(string(toName));
+      }
+      return item;
+    }
+
+    shared_ptr<VirtualFileTreeItem> target;
+    if (const auto* toEntry = toParent->m_children.find(toKey)) {
+      target = exchange ? toParent->unshareChild(*toEntry) : toEntry->second;
+      if (target == nullptr) {
+        return nullptr;
+      }
+    }
+    if (exchange && (target == nullptr || target->isDeleted())) {
+      errno = ENOENT;
+      logger::debug("{} not found", to);
+      return nullptr;
+    }
+
+    // the old paths are removed from the index before the items are moved
+    PathIndex* index = m_index.load();
+    if (index != nullptr) {
+      const auto unindex = [index](string_view path,
+                                   const VirtualFileTreeItem& removed) {
+        string pathLc = toLower(path);
+        index->erase(pathLc);
+        shared_lock itemLock(removed.m_mtx);
+        removed.unindexChildren(*index, pathLc);
+      };
+      unindex(from, *item);
+      if (target != nullptr) {
+        unindex(to, *target);
+      }
+    }
+
+    // the new parent is linked before the old one is removed, so the descendants stay
+    // attached
+    item->addParent(toParent);
+    if (target != nullptr) {
+      toParent->m_children.replace(toKey, item);
+    } else {
+      toParent->m_children.try_emplace(toKey, item);
+    }
+    if (exchange) {
+      target->addParent(fromParent);
+      fromParent->m_children.replace(fromKey, target);
+      target->setName(string(fromName));
+    } else {
+      fromParent->m_children.erase(fromKey);
+    }
+    item->setName(string(toName));
+    item->removeParent(fromParent);
+    if (target != nullptr) {
+      target->removeParent(toParent);
+    }
+
+    if (index != nullptr) {
+      reindexPath(*index, to, true);
+      if (exchange) {
+        reindexPath(*index, from, true);
+      } else if (unsharedItems != 0) {
+        reindexPath(*index, fromParentPath, false);
+      }
+    }
+    return item;
+  } catch (const std::bad_alloc&) {
+    logger::error("out of memory while moving '{}' to '{}'", from, to);
+    errno = ENOMEM;
+    return nullptr;
+  }
 }
 
 std::shared_ptr<VirtualFileTreeItem>
 VirtualFileTreeItem::find(std::string_view path, bool includeDeleted) noexcept
 {
-  shared_lock lock(m_mtx);
+  EpochGuard guard;
 
   if (path == "/" || path.empty()) {
     return shared_from_this();
@@ -216,20 +477,58 @@ VirtualFileTreeItem::find(std::string_view path, bool includeDeleted) noexcept
     path.remove_prefix(1);
   }
 
-  return findInternal(toLower(path), includeDeleted);
+  if (const PathIndex* index = m_index.load()) {
+    if (auto item = index->find(path); item != nullptr) {
+      if (!item->isDeleted() || includeDeleted) {
+        return item;
+      }
+      logger::debug("'{}' has been deleted, returning nullptr", path);
+      errno = ENOENT;
+      return nullptr;
+    }
+  }
+
+  return findInternal(path, includeDeleted);
+}
+
+void VirtualFileTreeItem::setPathIndexEnabled(bool enabled) noexcept
+{
+  unique_lock lock(m_mtx);
+  if (!enabled) {
+    m_index.store(nullptr);
+    return;
+  }
+  if (m_index.load() != nullptr) {
+    return;
+  }
+
+  // fill the index before publishing it, lookups walk the tree until then
+  auto* index = new (nothrow) PathIndex;
+  if (index == nullptr) {
+    logger::error("out of memory while creating the path index");
+    return;
+  }
+  string pathLc;
+  indexChildren(*index, pathLc);
+  m_index.store(index);
 }
 
 std::string VirtualFileTreeItem::fileName() const noexcept
 {
-  shared_lock lock(m_mtx);
-  return m_fileName;
+  EpochGuard guard;
+  return *m_fileName.load();
 }
 
 std::string VirtualFileTreeItem::filePath() const noexcept
 {
-  shared_lock lock(m_mtx);
-  if (const auto parent = m_parent.lock()) {
-    return parent->filePath() + "/" + m_fileName;
+  // copy the members and release the lock before visiting the parent
+  unique_lock lock(m_parentMtx);
+  const auto parent = parentInternal();
+  string fileName   = *m_fileName.load();
+  lock.unlock();
+
+  if (parent) {
+    return parent->filePath() + "/" + fileName;
   }
 
   return "";
@@ -237,8 +536,8 @@ std::string VirtualFileTreeItem::filePath() const noexcept
 
 std::string VirtualFileTreeItem::realPath() const noexcept
 {
-  shared_lock lock(m_mtx);
-  return m_realPath;
+  EpochGuard guard;
+  return *m_realPath.load();
 }
 
 void VirtualFileTreeItem::setName(std::string name) noexcept
@@ -248,8 +547,13 @@ void VirtualFileTreeItem::setName(std::string name) noexcept
     errno = EINVAL;
     return;
   }
+  auto* fileName = new (nothrow) string(std::move(name));
+  if (fileName == nullptr) {
+    errno = ENOMEM;
+    return;
+  }
   unique_lock lock(m_mtx);
-  m_fileName = std::move(name);
+  m_fileName.store(fileName);
 }
 
 void VirtualFileTreeItem::setRealPath(std::string realPath) noexcept
@@ -260,56 +564,162 @@ void VirtualFileTreeItem::setRealPath(std::string realPath) noexcept
     return;
   }
 
+  auto* path = new (nothrow) string(std::move(realPath));
+  if (path == nullptr) {
+    errno = ENOMEM;
+    return;
+  }
+  unique_lock lock(m_mtx);
+  // readers that get the new path must not get the directories of the old one
+  m_realParentDir = invalidDir;
+  m_realDir       = invalidDir;
+  invalidateAttributes();
+  m_realPath.store(path);
+}
+
+DirId VirtualFileTreeItem::realParentDir() const noexcept
+{
+  return m_realParentDir;
+}
+
+DirId VirtualFileTreeItem::realDir() const noexcept
+{
+  return m_realDir;
+}
+
+void VirtualFileTreeItem::setRealDirs(DirId parentDir, DirId dir) noexcept
+{
   unique_lock lock(m_mtx);
-  m_realPath = std::move(realPath);
+  m_realParentDir = parentDir;
+  m_realDir       = dir;
+}
+
+bool VirtualFileTreeItem::cachedAttributes(struct stat& st) const noexcept
+{
+  const CachedAttributes* attributes = m_attributes.load(memory_order_acquire);
+  if (attributes == nullptr) {
+    return false;
+  }
+
+  const uint64_t sequence = attributes->sequence.load(memory_order_acquire);
+  if ((sequence & 1) != 0) {
+    return false;
+  }
+  uint64_t words[CachedAttributes::statWords];
+  for (size_t i = 0; i < CachedAttributes::statWords; ++i) {
+    words[i] = attributes->st[i].load(memory_order_relaxed);
+  }
+  const auto expires     = attributes->expires.load(memory_order_relaxed);
+  const uint64_t version = attributes->version.load(memory_order_relaxed);
+  atomic_thread_fence(memory_order_acquire);
+  if (attributes->sequence.load(memory_order_relaxed) != sequence) {
+    return false;
+  }
+
+  if (version != m_attributesVersion.load(memory_order_acquire) ||
+      expires <= chrono::steady_clock::now().time_since_epoch().count()) {
+    return false;
+  }
+  memcpy(&st, words, sizeof(st));
+  return true;
+}
+
+uint64_t VirtualFileTreeItem::attributesVersion() const noexcept
+{
+  return m_attributesVersion.load(memory_order_acquire);
+}
+
+void VirtualFileTreeItem::cacheAttributes(
+    const struct stat& st, uint64_t version,
+    chrono::steady_clock::duration timeout) const noexcept
+{
+  if (version != m_attributesVersion.load(memory_order_acquire)) {
+    return;
+  }
+
+  CachedAttributes* attributes = m_attributes.load(memory_order_acquire);
+  if (attributes == nullptr) {
+    auto* created = new (nothrow) CachedAttributes;
+    if (created == nullptr) {
+      return;
+    }
+    if (m_attributes.compare_exchange_strong(attributes, created,
+                                             memory_order_acq_rel)) {
+      attributes = created;
+    } else {
+      delete created;
+    }
+  }
+
+  // another thread filling the cache at the same time wins
+  uint64_t sequence = attributes->sequence.load(memory_order_relaxed);
+  if ((sequence & 1) != 0 ||
+      !attributes->sequence.compare_exchange_strong(sequence, sequence + 1,
+                                                    memory_order_relaxed)) {
+    return;
+  }
+  atomic_thread_fence(memory_order_release);
+
+  uint64_t words[CachedAttributes::statWords] = {};
+  memcpy(words, &st, sizeof(st));
+  for (size_t i = 0; i < CachedAttributes::statWords; ++i) {
+    attributes->st[i].store(words[i], memory_order_relaxed);
+  }
+  // an invalidation racing with this is detected by readers through the version
+  const auto expires = chrono::steady_clock::now() + timeout;
+  attributes->expires.store(expires.time_since_epoch().count(), memory_order_relaxed);
+  attributes->version.store(version, memory_order_relaxed);
+
+  attributes->sequence.store(sequence + 2, memory_order_release);
+}
+
+void VirtualFileTreeItem::invalidateAttributes() const noexcept
+{
+  m_attributesVersion.fetch_add(1, memory_order_acq_rel);
 }
 
 bool VirtualFileTreeItem::isDeleted() const noexcept
 {
-  shared_lock lock(m_mtx);
   return m_deleted;
 }
 
 void VirtualFileTreeItem::setDeleted(bool deleted) noexcept
 {
-  unique_lock lock(m_mtx);
   m_deleted = deleted;
 }
 
 bool VirtualFileTreeItem::isEmpty() const noexcept
 {
-  shared_lock lock(m_mtx);
+  EpochGuard guard;
   return isEmptyInternal();
 }
 
-const FileMap& VirtualFileTreeItem::getChildren() const noexcept
+FileMap VirtualFileTreeItem::getChildren() const noexcept
 {
-  shared_lock lock(m_mtx);
+  EpochGuard guard;
   return m_children;
 }
 
 bool VirtualFileTreeItem::isDir() const noexcept
 {
-  shared_lock lock(m_mtx);
   return m_type == dir;
 }
 
 bool VirtualFileTreeItem::isFile() const noexcept
 {
-  shared_lock lock(m_mtx);
   return m_type == file;
 }
 
 std::vector<std::string>
 VirtualFileTreeItem::getAllItemPaths(bool includeRoot) const noexcept
 {
-  shared_lock lock(m_mtx);
   vector<string> result;
-  result.reserve(m_children.size() + 1);
-
-  if (!m_parent.expired() || includeRoot) {
+  if (!getParent().expired() || includeRoot) {
     result.emplace_back(filePath());
   }
+
+  shared_lock lock(m_mtx);
+  result.reserve(m_children.size() + 1);
   for (const auto& item : m_children | views::values) {
     auto allItemPaths = item->getAllItemPaths();
     result.insert(result.end(), allItemPaths.begin(), allItemPaths.end());
@@ -322,14 +732,14 @@ void VirtualFileTreeItem::dumpTree(std::ostream& os, int level) const noexcept
   shared_lock lock(m_mtx);
 
   // append '/' to directories
-  string filename = fileName();
-  if (isDir()) {
+  string filename = *m_fileName.load();
+  if (m_type == dir) {
     if (!filename.ends_with('/')) {
       filename.append("/");
     }
   }
 
-  os << string(level, ' ') << filename << " -> " << realPath() << '\n';
+  os << string(level, ' ') << filename << " -> " << *m_realPath.load() << '\n';
   for (const auto& child : m_children | views::values) {
     child->dumpTree(os, level + 1);
   }
@@ -338,40 +748,21 @@ void VirtualFileTreeItem::dumpTree(std::ostream& os, int level) const noexcept
 std::shared_ptr<VirtualFileTreeItem>
 VirtualFileTreeItem::findInternal(std::string_view path, bool includeDeleted) noexcept
 {
-  const size_t pos = path.find('/');
-  if (pos != string::npos) {
-    // path is inside a subdirectory
-    const string_view subDirectory = path.substr(0, pos);
-    const auto it                  = m_children.find(subDirectory);
-    if (it == m_children.end()) {
-      logger::debug("could not find '{}'", path);
-      errno = ENOENT;
-      return nullptr;
-    }
-
-    const size_t nextPos = path.find('/', subDirectory.length());
-    if (nextPos == string_view::npos) {
-      // no further subdirectories
-      if (!it->second->isDeleted() || includeDeleted) {
-        return it->second;
-      }
-      logger::debug("'{}' has been deleted, returning nullptr", path);
-      errno = ENOENT;
-      return nullptr;
-    }
-    return it->second->findInternal(path.substr(nextPos + 1), includeDeleted);
-  }
-
-  // path is not in a subdirectory
-  const auto it = m_children.find(path);
-  if (it == m_children.end()) {
+  const size_t pos  = path.find('/');
+  const auto* entry = m_children.find(foldName(path.substr(0, pos)));
+  if (entry == nullptr) {
     logger::debug("could not find '{}'", path);
     errno = ENOENT;
     return nullptr;
   }
 
-  if (!it->second->isDeleted() || includeDeleted) {
-    return it->second;
+  if (pos != string_view::npos) {
+    // path is inside a subdirectory
+    return entry->second->findInternal(path.substr(pos + 1), includeDeleted);
+  }
+
+  if (!entry->second->isDeleted() || includeDeleted) {
+    return entry->second;
   }
   logger::debug("'{}' has been deleted, returning nullptr", path);
   errno = ENOENT;
@@ -379,9 +770,8 @@ VirtualFileTreeItem::findInternal(std::string_view path, bool includeDeleted) no
 }
 
 std::shared_ptr<VirtualFileTreeItem>
-VirtualFileTreeItem::addInternal(std::string_view path, std::string_view pathLc,
-                                 std::string realPath, Type type,
-                                 bool updateExisting) noexcept
+VirtualFileTreeItem::addInternal(std::string_view path, std::string realPath,
+                                 Type type, bool updateExisting) noexcept
 {
   if (path == "/") {
     errno = EEXIST;
@@ -391,46 +781,144 @@ VirtualFileTreeItem::addInternal(std::string_view path, std::string_view pathLc,
   // remove leading '/'
   if (path[0] == '/') {
     path.remove_prefix(1);
-    pathLc.remove_prefix(1);
   }
 
   if (const size_t pos = path.find('/', 0); pos != string::npos) {
-    string subDirectory = string(pathLc.substr(0, pos));
+    const auto* foundEntry = m_children.find(foldName(path.substr(0, pos)));
 
-    auto foundEntry = m_children.find(subDirectory);
-
-    if (foundEntry == m_children.end()) {
+    if (foundEntry == nullptr) {
       logger::error("subdirectory does not exist");
       errno = ENOENT;
       return nullptr;
     }
-    return foundEntry->second->addInternal(path.substr(pos + 1), pathLc.substr(pos + 1),
-                                           std::move(realPath), type, updateExisting);
+    const auto child = unshareChild(*foundEntry);
+    if (child == nullptr) {
+      return nullptr;
+    }
+    unique_lock childLock(child->m_mtx);
+    return child->addInternal(path.substr(pos + 1), std::move(realPath), type,
+                              updateExisting);
   }
 
-  auto [it, wasInserted] = m_children.try_emplace(string(pathLc), nullptr);
-  if (!wasInserted) {
-    if (it->second->isDeleted()) {
-      logger::debug("marking item '{}' as not deleted, updating real path to '{}'",
-                    path, realPath);
-      it->second->setDeleted(false);
-      it->second->m_realPath = realPath;
-
-      return it->second;
-    }
-    if (!updateExisting) {
+  const string_view nameLc = foldName(path);
+  if (const auto* existing = m_children.find(nameLc)) {
+    const bool wasDeleted = existing->second->isDeleted();
+    if (!wasDeleted && !updateExisting) {
       logger::error("item '{}' already exists and should not be updated", path);
       errno = EEXIST;
       return nullptr;
     }
+
+    const auto item = unshareChild(*existing);
+    if (item == nullptr) {
+      return nullptr;
+    }
+    if (wasDeleted) {
+      logger::debug("marking item '{}' as not deleted, updating real path to '{}'",
+                    path, realPath);
+      item->setDeleted(false);
+      item->setRealPath(std::move(realPath));
+
+      return item;
+    }
     logger::debug("setting real path of existing item '{}' to '{}'", path, realPath);
-    it->second->m_realPath = realPath;
+    item->setRealPath(std::move(realPath));
+
+    return item;
+  }
 
-    return it->second;
+  auto item = create(string(path), std::move(realPath), type, weak_from_this());
+  if (item == nullptr) {
+    return nullptr;
   }
+  try {
+    m_children.try_emplace(string(nameLc), item);
+  } catch (const std::bad_alloc&) {
+    logger::error("out of memory while adding '{}'", path);
+    errno = ENOMEM;
+    return nullptr;
+  }
+  return item;
+}
 
-  it->second = create(string(path), realPath, type, weak_from_this());
-  return it->second;
+std::shared_ptr<VirtualFileTreeItem>
+VirtualFileTreeItem::unshareInternal(std::string_view path) noexcept
+{
+  const size_t pos  = path.find('/', 0);
+  const auto* entry = m_children.find(foldName(path.substr(0, pos)));
+  if (entry == nullptr) {
+    errno = ENOENT;
+    logger::debug("{} not found", path);
+    return nullptr;
+  }
+
+  const auto child = unshareChild(*entry);
+  if (child == nullptr || pos == string::npos) {
+    return child;
+  }
+  unique_lock childLock(child->m_mtx);
+  return child->unshareInternal(path.substr(pos + 1));
+}
+
+void VirtualFileTreeItem::mergeInternal(const VirtualFileTreeItem& other,
+                                        PathIndex* index, string& pathLc) noexcept
+{
+  try {
+    m_realPath.store(new string(*other.m_realPath.load()));
+    m_fileName.store(new string(*other.m_fileName.load()));
+    m_realParentDir = other.m_realParentDir.load();
+    m_realDir       = other.m_realDir.load();
+    invalidateAttributes();
+  } catch (const std::bad_alloc&) {
+    logger::error("out of memory while merging '{}'", *other.m_fileName.load());
+    return;
+  }
+
+  // only the items added or replaced by the merge are indexed, the others keep their
+  // paths
+  const size_t length = pathLc.length();
+  for (const auto& [name, item] : other.m_children) {
+    if (length != 0) {
+      pathLc += '/';
+    }
+    pathLc += name;
+
+    if (const auto* existing = m_children.find(name)) {
+      // item already exists, merge recursively into a copy owned by this tree unless
+      // both trees share it already
+      if (existing->second != item) {
+        if (const auto child = unshareChild(*existing)) {
+          unique_lock childLock(child->m_mtx);
+          shared_lock otherLock(item->m_mtx);
+          if (index != nullptr) {
+            index->insert(pathLc, child);
+          }
+          child->mergeInternal(*item, index, pathLc);
+        }
+      }
+      pathLc.resize(length);
+      continue;
+    }
+
+    // item did not exist, share it with the other tree
+    try {
+      item->addParent(weak_from_this());
+      try {
+        m_children.try_emplace(name, item);
+      } catch (...) {
+        item->removeParent(weak_from_this());
+        throw;
+      }
+      if (index != nullptr) {
+        index->insert(pathLc, item);
+        shared_lock itemLock(item->m_mtx);
+        item->indexChildren(*index, pathLc);
+      }
+    } catch (const std::bad_alloc&) {
+      logger::error("out of memory while merging '{}'", name);
+    }
+    pathLc.resize(length);
+  }
 }
 
 bool VirtualFileTreeItem::isEmptyInternal() const noexcept
@@ -446,70 +934,271 @@ bool VirtualFileTreeItem::eraseInternal(std::string_view path,
   // check if path is inside a subdirectory
   if (const size_t pos = path.find('/', 0); pos != string::npos) {
     string_view subDir = path.substr(0, pos);
-    const auto it      = m_children.find(subDir);
+    const auto* entry  = m_children.find(foldName(subDir));
 
-    if (it == m_children.end()) {
+    if (entry == nullptr) {
       errno = ENOENT;
       logger::debug("subdirectory {} not found", subDir);
       return false;
     }
 
-    return it->second->eraseInternal(path.substr(pos + 1), reallyErase);
+    const auto child = unshareChild(*entry);
+    if (child == nullptr) {
+      return false;
+    }
+    unique_lock childLock(child->m_mtx);
+    return child->eraseInternal(path.substr(pos + 1), reallyErase);
   }
 
-  const auto it = m_children.find(path);
+  const auto* entry = m_children.find(foldName(path));
 
   // check if the entry exists
-  if (it == m_children.end()) {
+  if (entry == nullptr) {
     errno = ENOENT;
     logger::debug("{} not found", path);
     return false;
   }
 
   // check if the entry is empty
-  if (!it->second->isEmpty()) {
+  if (!entry->second->isEmpty()) {
     errno = ENOTEMPTY;
     return false;
   }
 
   if (reallyErase) {
-    m_children.erase(it);
+    const auto item = entry->second;
+    try {
+      // lookups running concurrently may still see the entry
+      m_children.erase(entry->first);
+    } catch (const std::bad_alloc&) {
+      errno = ENOMEM;
+      return false;
+    }
+    item->removeParent(weak_from_this());
     return true;
   }
 
-  it->second->setDeleted(true);
-  it->second->markAllChildrenAsDeleted();
+  const auto item = unshareChild(*entry);
+  if (item == nullptr) {
+    return false;
+  }
+  unique_lock childLock(item->m_mtx);
+  item->m_deleted = true;
+  item->markAllChildrenAsDeleted();
   return true;
 }
 
 void VirtualFileTreeItem::markAllChildrenAsDeleted() noexcept
 {
-  for (const auto& it : m_children | views::values) {
-    it->m_deleted = true;
-    it->markAllChildrenAsDeleted();
+  for (const auto& entry : m_children) {
+    // shared children are copied, the other trees keep them as they are
+    const auto item = unshareChild(entry);
+    if (item == nullptr) {
+      continue;
+    }
+    unique_lock lock(item->m_mtx);
+    item->m_deleted = true;
+    item->markAllChildrenAsDeleted();
   }
 }
 
-void VirtualFileTreeItem::cloneChildrenFrom(const VirtualFileTreeItem& other) noexcept
+bool VirtualFileTreeItem::isShared() noexcept
 {
-  for (const auto& [name, item] : other.m_children) {
-    auto clonedChild = std::make_shared<VirtualFileTreeItem>(
-        Passkey{}, item->m_fileName, item->m_realPath, item->m_type, weak_from_this());
+  scoped_lock lock(m_parentMtx);
+
+  // parents that have been destroyed do not link this item anymore
+  erase_if(m_otherParents, [](const auto& parent) {
+    return parent.expired();
+  });
+  if (m_parent.expired() && !m_otherParents.empty()) {
+    m_parent = std::move(m_otherParents.back());
+    m_otherParents.pop_back();
+  }
+  return !m_otherParents.empty();
+}
+
+void VirtualFileTreeItem::addParent(std::weak_ptr<VirtualFileTreeItem> parent) noexcept(
+    false)
+{
+  scoped_lock lock(m_parentMtx);
+  if (m_detached || m_parent.expired()) {
+    m_parent   = std::move(parent);
+    m_detached = false;
+    return;
+  }
+  erase_if(m_otherParents, [](const auto& other) {
+    return other.expired();
+  });
+  m_otherParents.emplace_back(std::move(parent));
+}
+
+void VirtualFileTreeItem::removeParent(
+    const std::weak_ptr<VirtualFileTreeItem>& parent) noexcept
+{
+  // compare the owners, the parent may be in its destructor already
+  const auto isParent = [&](const weak_ptr<VirtualFileTreeItem>& other) {
+    return !other.owner_before(parent) && !parent.owner_before(other);
+  };
+
+  {
+    scoped_lock lock(m_parentMtx);
+    if (!isParent(m_parent)) {
+      erase_if(m_otherParents, [&](const auto& other) {
+        return other.expired() || isParent(other);
+      });
+      return;
+    }
+    if (m_detached) {
+      return;
+    }
+
+    erase_if(m_otherParents, [](const auto& other) {
+      return other.expired();
+    });
+    if (!m_otherParents.empty()) {
+      m_parent = std::move(m_otherParents.back());
+      m_otherParents.pop_back();
+      return;
+    }
+    m_detached = true;
+  }
+
+  // this item is not part of a tree anymore, so it does not link its children either
+  EpochGuard guard;
+  const auto self = weak_from_this();
+  for (const auto& child : m_children | views::values) {
+    child->removeParent(self);
+  }
+}
+
+std::shared_ptr<VirtualFileTreeItem>
+VirtualFileTreeItem::parentInternal() const noexcept
+{
+  if (auto parent = m_parent.lock(); parent || m_otherParents.empty()) {
+    return parent;
+  }
+  for (const auto& other : m_otherParents) {
+    if (auto parent = other.lock()) {
+      return parent;
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<VirtualFileTreeItem>
+VirtualFileTreeItem::unshareChild(const FileMap::value_type& entry) noexcept
+{
+  const auto child = entry.second;
+  if (!child->isShared()) {
+    return child;
+  }
+
+  try {
+    shared_lock childLock(child->m_mtx);
+    auto copy = child->copy(weak_from_this());
+    childLock.unlock();
+
+    m_children.replace(entry.first, copy);
+    child->removeParent(weak_from_this());
+    ++unsharedItems;
+    return copy;
+  } catch (const std::bad_alloc&) {
+    logger::error("out of memory while copying '{}'", entry.first);
+    errno = ENOMEM;
+    return nullptr;
+  }
+}
+
+std::shared_ptr<VirtualFileTreeItem>
+VirtualFileTreeItem::copy(std::weak_ptr<VirtualFileTreeItem> parent) const
+    noexcept(false)
+{
+  auto copied = make_shared<VirtualFileTreeItem>(Passkey{}, *m_fileName.load(),
+                                                 *m_realPath.load(), m_type.load(),
+                                                 std::move(parent));
+  copied->m_deleted       = m_deleted.load();
+  copied->m_realParentDir = m_realParentDir.load();
+  copied->m_realDir       = m_realDir.load();
+  copied->m_children      = FileMap(m_children);
+
+  // the children are shared by this item and the copy
+  for (const auto& item : m_children | views::values) {
+    item->addParent(copied);
+  }
+  return copied;
+}
+
+void VirtualFileTreeItem::indexChildren(PathIndex& index,
+                                        std::string& pathLc) const noexcept
+{
+  const size_t length = pathLc.length();
+  for (const auto& [name, item] : m_children) {
+    if (length != 0) {
+      pathLc += '/';
+    }
+    pathLc += name;
+    index.insert(pathLc, item);
 
-    clonedChild->m_deleted = item->m_deleted;
-    clonedChild->cloneChildrenFrom(*item);
+    shared_lock lock(item->m_mtx);
+    item->indexChildren(index, pathLc);
+    pathLc.resize(length);
+  }
+}
+
+void VirtualFileTreeItem::unindexChildren(PathIndex& index,
+                                          std::string& pathLc) const noexcept
+{
+  const size_t length = pathLc.length();
+  for (const auto& [name, item] : m_children) {
+    if (length != 0) {
+      pathLc += '/';
+    }
+    pathLc += name;
+    index.erase(pathLc);
+
+    shared_lock lock(item->m_mtx);
+    item->unindexChildren(index, pathLc);
+    pathLc.resize(length);
+  }
+}
+
+void VirtualFileTreeItem::reindexPath(PathIndex& index, std::string_view path,
+                                      bool withChildren) noexcept
+{
+  string pathLc;
+  const VirtualFileTreeItem* current = this;
+  shared_ptr<VirtualFileTreeItem> item;
+  for (const auto component : path | views::split('/')) {
+    const string_view name(component.begin(), component.end());
+    if (name.empty()) {
+      continue;
+    }
+    const auto* entry = current->m_children.find(foldName(name));
+    if (entry == nullptr) {
+      return;
+    }
+
+    if (!pathLc.empty()) {
+      pathLc += '/';
+    }
+    pathLc += entry->first;
+    index.insert(pathLc, entry->second);
+    item    = entry->second;
+    current = item.get();
+  }
 
-    m_children.emplace(name, std::move(clonedChild));
+  if (withChildren && item != nullptr) {
+    shared_lock lock(item->m_mtx);
+    item->indexChildren(index, pathLc);
   }
 }
 
 std::ostream& operator<<(std::ostream& os,
                          const std::shared_ptr<VirtualFileTreeItem>& item) noexcept
 {
-  shared_lock lock(item->m_mtx);
   os << "file path: " << quoted(item->filePath())
-     << ", real path: " << quoted(item->m_realPath) << '\n';
-  for (const auto& child : item->m_children | views::values) {
+     << ", real path: " << quoted(item->realPath()) << '\n';
+  for (const auto& child : item->getChildren() | views::values) {
     os << child;
   }
 
@@ -1,14 +1,20 @@
 #pragma once
 
-#include <map>
+#include "dirfdcache.h"
+#include "epoch.h"
+#include "filemap.h"
+
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <mutex>
 #include <shared_mutex>
 #include <string>
 #include <vector>
 
-class VirtualFileTreeItem;
-using FileMap =
-    std::map<std::string, std::shared_ptr<VirtualFileTreeItem>, std::less<>>;
+#include <sys/stat.h>
+
+class PathIndex;
 
 enum Type
 {
@@ -25,6 +31,10 @@ class VirtualFileTreeItem : public std::enable_shared_from_this<VirtualFileTreeI
   };
 
 public:
+  // Trees share unchanged subtrees: clone and operator+= link the items of the other
+  // tree instead of copying them. add, erase and operator+= called on the root copy the
+  // shared items on the path to the items they modify, so the other trees do not see
+  // the change. An item stops being shared once the other trees are destroyed
   static std::shared_ptr<VirtualFileTreeItem>
   create(std::string path, std::string realPath, Type type,
          std::weak_ptr<VirtualFileTreeItem> parent = {}) noexcept;
@@ -41,8 +51,12 @@ public:
 
   VirtualFileTreeItem() = delete;
 
-  ~VirtualFileTreeItem() = default;
+  ~VirtualFileTreeItem();
 
+  /**
+   * @brief Merge another tree into this one. Items that only exist in the other tree
+   * are shared with it instead of being copied
+   */
   VirtualFileTreeItem& operator+=(const VirtualFileTreeItem& other) noexcept;
 
   /**
@@ -71,12 +85,14 @@ public:
                                            bool updateExisting = false) noexcept;
 
   /**
-   * @brief Create a deep copy
+   * @brief Create a copy that shares all items with this tree, the items are copied
+   * once either tree modifies them. The path index of the copy is built from scratch
    */
   std::shared_ptr<VirtualFileTreeItem> clone() const noexcept;
 
   /**
    * @brief Get the parent item
+   * @note Items shared between trees return the parent in one of them
    */
   std::weak_ptr<VirtualFileTreeItem> getParent() const noexcept;
 
@@ -100,6 +116,30 @@ public:
    */
   bool erase(std::string_view path, bool reallyErase = true) noexcept;
 
+  /**
+   * @brief Look up a path in the file tree to modify the item with the setters.
+   * Shared items on the path and the item itself are copied first, so the other trees
+   * keep them as they are
+   * @param path Path to look up, deleted items are included
+   * @return Pointer to the item, nullptr if nothing was found or the copies could not
+   * be allocated
+   */
+  [[nodiscard]] std::shared_ptr<VirtualFileTreeItem>
+  unshare(std::string_view path) noexcept;
+
+  /**
+   * @brief Move an item to another path, replacing an existing item there. The moved
+   * item and its descendants keep their identity unless they are shared with another
+   * tree
+   * @param from Path of the item to move
+   * @param to New path of the item, its parent has to exist
+   * @param exchange Whether to swap the items at both paths instead, both have to exist
+   * @return Pointer to the item at the new path, nullptr on error. See errno for error
+   * details
+   */
+  std::shared_ptr<VirtualFileTreeItem> move(std::string_view from, std::string_view to,
+                                            bool exchange = false) noexcept;
+
   /**
    * @brief Look up a path in the file tree
    * @param path Path to look up
@@ -109,6 +149,14 @@ public:
   [[nodiscard]] std::shared_ptr<VirtualFileTreeItem>
   find(std::string_view path, bool includeDeleted = false) noexcept;
 
+  /**
+   * @brief Enable or disable an index of the full paths of all descendants, so lookups
+   * of indexed paths take a single hash table probe instead of walking the tree
+   * @note The index is only kept up to date by add, erase and operator+= called on
+   * this item, so it should only be enabled on the root item of a tree
+   */
+  void setPathIndexEnabled(bool enabled) noexcept;
+
   /**
    * @brief Get the file name
    * @note Returns '/' for root items
@@ -128,6 +176,8 @@ public:
 
   /**
    * @brief Set the file name
+   * @note The setters modify the item in every tree sharing it, items of a tree that
+   * may share them have to be looked up with unshare first
    */
   void setName(std::string name) noexcept;
 
@@ -136,6 +186,52 @@ public:
    */
   void setRealPath(std::string realPath) noexcept;
 
+  /**
+   * @brief Get the real directory containing the item in the DirFdCache of the mount
+   * @return The id of the directory, invalidDir if it is not known
+   * @note setRealPath resets the directories, so read the real path first to get a
+   * matching pair
+   */
+  DirId realParentDir() const noexcept;
+
+  /**
+   * @brief Get the real directory of a directory item in the DirFdCache of the mount
+   * @return The id of the directory, invalidDir if it is not known or the item is a
+   * file
+   */
+  DirId realDir() const noexcept;
+
+  /**
+   * @brief Set the real directories, they stay owned by the FdMap of the mount
+   * @param parentDir Directory containing the item
+   * @param dir The directory itself, invalidDir for files
+   */
+  void setRealDirs(DirId parentDir, DirId dir) noexcept;
+
+  /**
+   * @brief Get the cached attributes of the real file
+   * @return True if attributes are cached, have not expired and were not invalidated
+   */
+  bool cachedAttributes(struct stat& st) const noexcept;
+
+  /**
+   * @brief Get the version of the attributes, which changes on every invalidation. Read
+   * it before reading the attributes of the real file and pass it to cacheAttributes
+   */
+  uint64_t attributesVersion() const noexcept;
+
+  /**
+   * @brief Cache the attributes of the real file until the timeout expires. They are
+   * not cached if the item was invalidated since version was read
+   */
+  void cacheAttributes(const struct stat& st, uint64_t version,
+                       std::chrono::steady_clock::duration timeout) const noexcept;
+
+  /**
+   * @brief Drop the cached attributes, called after the real file was changed
+   */
+  void invalidateAttributes() const noexcept;
+
   /**
    * @brief Check if the item is marked as deleted
    */
@@ -151,7 +247,10 @@ public:
    */
   bool isEmpty() const noexcept;
 
-  [[nodiscard]] const FileMap& getChildren() const noexcept;
+  /**
+   * @brief Get a snapshot of the direct children
+   */
+  [[nodiscard]] FileMap getChildren() const noexcept;
 
   bool isDir() const noexcept;
   bool isFile() const noexcept;
@@ -173,27 +272,100 @@ private:
 
   VirtualFileTreeItem(const VirtualFileTreeItem& other) noexcept;
 
-  std::string m_fileName;
-  std::string m_realPath;
+  // cached attributes are updated in place as a sequence lock, so filling the cache
+  // does not allocate or retire anything. The sequence is odd while a writer copies the
+  // attributes and readers that see it change treat the cache as empty. The attributes
+  // are stored as atomic words, so the copies of readers and writers do not race
+  struct CachedAttributes
+  {
+    static constexpr size_t statWords = (sizeof(struct stat) + 7) / 8;
+
+    std::atomic<uint64_t> sequence = 0;
+    std::atomic<uint64_t> st[statWords];
+    std::atomic<std::chrono::steady_clock::rep> expires;
+    std::atomic<uint64_t> version;
+  };
+
+  // lookups and the getters do not lock, they read the members inside an EpochGuard.
+  // Modifications are serialized by m_mtx, strings are replaced as a whole
+  EpochPtr<const std::string> m_fileName;
+  EpochPtr<const std::string> m_realPath;
+  // the parents linking this item, an item that is shared between trees has more than
+  // one. An item that is not linked anymore is detached and keeps its last parent.
+  // Protected by m_parentMtx, which is never held while locking another item
   std::weak_ptr<VirtualFileTreeItem> m_parent;
-  Type m_type;
-  bool m_deleted;
+  std::vector<std::weak_ptr<VirtualFileTreeItem>> m_otherParents;
+  bool m_detached = false;
+  mutable std::mutex m_parentMtx;
+  std::atomic<Type> m_type;
+  std::atomic<bool> m_deleted;
+  // real directories of m_realPath in the DirFdCache, invalidDir if not known
+  std::atomic<DirId> m_realParentDir = invalidDir;
+  std::atomic<DirId> m_realDir       = invalidDir;
+  // attributes of the real file, allocated when the cache is first filled and owned by
+  // the item. Entries with an older version were invalidated
+  mutable std::atomic<CachedAttributes*> m_attributes = nullptr;
+  mutable std::atomic<uint64_t> m_attributesVersion = 0;
   FileMap m_children;
+  EpochPtr<PathIndex> m_index;  // only set if the path index is enabled
   mutable std::shared_mutex m_mtx;
 
-  // find function without locking
+  // Locking order is always parent before child. The *Internal functions that modify
+  // the tree expect the caller to hold the lock of the item they are called on and
+  // lock descendants themselves before accessing them
+
+  // find function without locking, the caller has to be inside an EpochGuard. The path
+  // is lower cased component by component
   [[nodiscard]] std::shared_ptr<VirtualFileTreeItem>
   findInternal(std::string_view path, bool includeDeleted) noexcept;
 
   // add function without locking for internal use
   std::shared_ptr<VirtualFileTreeItem> addInternal(std::string_view path,
-                                                   std::string_view pathLc,
                                                    std::string realPath, Type type,
                                                    bool updateExisting) noexcept;
 
+  // unshare function without locking for internal use
+  std::shared_ptr<VirtualFileTreeItem> unshareInternal(std::string_view path) noexcept;
+
+  // merge function without locking, the caller holds the locks of both items. The
+  // added and replaced items are inserted into index if it is set, pathLc is the
+  // indexed path of this item
+  void mergeInternal(const VirtualFileTreeItem& other, PathIndex* index,
+                     std::string& pathLc) noexcept;
+
   // isEmpty function without locking
   bool isEmptyInternal() const noexcept;
   bool eraseInternal(std::string_view path, bool reallyErase) noexcept;
   void markAllChildrenAsDeleted() noexcept;
-  void cloneChildrenFrom(const VirtualFileTreeItem& other) noexcept;
+
+  [[nodiscard]] bool isShared() noexcept;
+  void addParent(std::weak_ptr<VirtualFileTreeItem> parent) noexcept(false);
+
+  // unlink the parent, detaches this item from its children if it was the last one
+  void removeParent(const std::weak_ptr<VirtualFileTreeItem>& parent) noexcept;
+
+  // the first parent that still exists, the caller holds m_parentMtx
+  [[nodiscard]] std::shared_ptr<VirtualFileTreeItem> parentInternal() const noexcept;
+
+  // return the child of the entry, a shared child is replaced by a copy owned by this
+  // item first. Returns nullptr if there is not enough memory for the copy. The caller
+  // holds the lock of this item, but not of the child
+  std::shared_ptr<VirtualFileTreeItem>
+  unshareChild(const FileMap::value_type& entry) noexcept;
+
+  // copy this item, the copy shares the children of this item. The caller holds the
+  // lock of this item
+  std::shared_ptr<VirtualFileTreeItem>
+  copy(std::weak_ptr<VirtualFileTreeItem> parent) const noexcept(false);
+
+  // add or remove the descendants of this item to or from the path index, pathLc is
+  // the indexed path of this item. The caller holds the lock of this item
+  void indexChildren(PathIndex& index, std::string& pathLc) const noexcept;
+  void unindexChildren(PathIndex& index, std::string& pathLc) const noexcept;
+
+  // index the items on the path again after shared ancestors have been copied, and the
+  // descendants of the last item if withChildren is set. The caller holds the lock of
+  // this item and is inside an EpochGuard
+  void reindexPath(PathIndex& index, std::string_view path,
+                   bool withChildren) noexcept;
 };
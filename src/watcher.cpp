@@ -0,0 +1,401 @@
+#include "watcher.h"
+
+#include "logger.h"
+#include "mountstate.h"
+#include "utils.h"
+#include "virtualfiletreeitem.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace
+{
+
+constexpr uint32_t watchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                               IN_ATTRIB | IN_CLOSE_WRITE | IN_ONLYDIR;
+constexpr int pollInterval   = 100;  // ms between checks whether to stop
+// time to wait for further events after an event was received, so changes made in
+// quick succession like extracting an archive are applied in a single batch
+constexpr auto batchDelay        = 50ms;
+constexpr size_t maxBatchEvents  = 16384;
+constexpr size_t eventBufferSize = 64 * 1024;
+
+string joinPath(string_view parent, string_view name)
+{
+  return parent.ends_with('/') ? format("{}{}", parent, name)
+                               : format("{}/{}", parent, name);
+}
+
+bool isBelow(string_view path, string_view directory) noexcept
+{
+  return path.size() > directory.size() && path.starts_with(directory) &&
+         path[directory.size()] == '/';
+}
+
+}  // namespace
+
+Watcher::~Watcher()
+{
+  stop();
+}
+
+void Watcher::addRoot(string realPath, SkipFunction skip) noexcept
+{
+  try {
+    m_roots.emplace_back(std::move(realPath), std::move(skip));
+  } catch (const bad_alloc&) {
+    logger::error("error adding watched directory: {}", strerror(ENOMEM));
+  }
+}
+
+void Watcher::start(MountState* state) noexcept
+{
+  stop();
+  m_state = state;
+
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd == -1) {
+    logger::error("inotify_init1() failed: {}", strerror(errno));
+    return;
+  }
+
+  for (size_t i = 0; i < m_roots.size(); ++i) {
+    watchTree(i, m_roots[i].path, "/", false);
+  }
+  logger::debug("watching {} directories for {}", m_watches.size(),
+                m_state->mountpoint);
+
+  try {
+    m_thread = jthread([this](const stop_token& stopToken) {
+      run(stopToken);
+    });
+  } catch (const system_error& e) {
+    logger::error("error starting watcher thread: {}", e.what());
+    stop();
+  }
+}
+
+void Watcher::stop() noexcept
+{
+  if (m_thread.joinable()) {
+    m_thread.request_stop();
+    m_thread.join();
+  }
+  if (m_fd != -1) {
+    close(m_fd);
+    m_fd = -1;
+  }
+  m_watches.clear();
+  m_changed.clear();
+}
+
+void Watcher::run(const stop_token& stopToken) noexcept
+{
+  vector<Event> events;
+  while (!stopToken.stop_requested()) {
+    pollfd pfd    = {m_fd, POLLIN, 0};
+    const int res = poll(&pfd, 1, pollInterval);
+    if (res == -1 && errno != EINTR) {
+      logger::error("poll() failed for inotify: {}", strerror(errno));
+      return;
+    }
+    if (res <= 0) {
+      continue;
+    }
+
+    events.clear();
+    readEvents(events);
+    while (events.size() < maxBatchEvents && !stopToken.stop_requested()) {
+      this_thread::sleep_for(batchDelay);
+      if (!readEvents(events)) {
+        break;
+      }
+    }
+
+    logger::debug("applying {} changes to {}", events.size(), m_state->mountpoint);
+    for (const Event& event : events) {
+      apply(event);
+    }
+
+    // the cache has to be cleared before the kernel looks up the added paths again
+    if (m_added) {
+      m_state->negativeCache.clear();
+    }
+    for (string& path : m_changed) {
+      string parentPath = getParentPath(path);
+      if (parentPath.empty()) {
+        parentPath = "/";
+      }
+      // the modification time of the parent directory changed as well
+      invalidateAttributes(parentPath);
+      invalidateAttributes(path);
+      m_state->invalidator.invalidate(std::move(parentPath));
+      m_state->invalidator.invalidate(std::move(path));
+    }
+    m_changed.clear();
+    m_added = false;
+  }
+}
+
+bool Watcher::readEvents(vector<Event>& events) noexcept
+{
+  alignas(inotify_event) char buffer[eventBufferSize];
+  bool received = false;
+
+  try {
+    for (;;) {
+      const ssize_t bytes = ::read(m_fd, buffer, sizeof(buffer));
+      if (bytes == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+          logger::error("error reading inotify events: {}", strerror(errno));
+        }
+        break;
+      }
+
+      for (ssize_t offset = 0; offset < bytes;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+        offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        events.emplace_back(event->wd, event->mask,
+                            event->len > 0 ? string(event->name) : string());
+      }
+      received = true;
+    }
+  } catch (const bad_alloc&) {
+    logger::error("error reading inotify events: {}", strerror(ENOMEM));
+  }
+  return received;
+}
+
+void Watcher::apply(const Event& event) noexcept
+{
+  if ((event.mask & IN_Q_OVERFLOW) != 0) {
+    logger::warn("inotify queue overflowed, rescanning the linked directories of {}",
+                 m_state->mountpoint);
+    rescan();
+    return;
+  }
+
+  const auto it = m_watches.find(event.wd);
+  if (it == m_watches.end()) {
+    return;
+  }
+  if ((event.mask & IN_IGNORED) != 0) {
+    // the directory was removed or unmounted
+    m_watches.erase(it);
+    return;
+  }
+  if (event.name.empty()) {
+    // events of the watched directory itself are reported for its parent
+    return;
+  }
+
+  try {
+    // copied because adding watches may rehash the map
+    const Watch watch        = it->second;
+    const string realPath    = joinPath(watch.realPath, event.name);
+    const string virtualPath = joinPath(watch.virtualPath, event.name);
+    const Type type          = (event.mask & IN_ISDIR) != 0 ? dir : file;
+
+    if ((event.mask & (IN_DELETE | IN_MOVED_FROM)) != 0) {
+      eraseItem(realPath, virtualPath);
+      if (type == dir) {
+        unwatchTree(realPath);
+      }
+    } else if ((event.mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+      const SkipFunction& skip = m_roots[watch.root].skip;
+      if (skip && skip(event.name, type)) {
+        return;
+      }
+      addItem(realPath, virtualPath, type);
+      if (type == dir) {
+        watchTree(watch.root, realPath, virtualPath, true);
+      }
+    } else if (auto item = m_state->fileTree->find(virtualPath);
+               item != nullptr && item->realPath() == realPath) {
+      // the contents or attributes of the file changed
+      m_changed.push_back(virtualPath);
+    }
+  } catch (const exception& e) {
+    logger::error("error applying change of {}: {}", event.name, e.what());
+  }
+}
+
+void Watcher::rescan() noexcept
+{
+  // items of the watched directories whose real files are gone, with their virtual
+  // paths. They are erased after walking the tree, erasing modifies it
+  vector<pair<shared_ptr<VirtualFileTreeItem>, string>> removed;
+  try {
+    vector<pair<shared_ptr<VirtualFileTreeItem>, string>> pending;
+    pending.emplace_back(m_state->fileTree, "/");
+
+    while (!pending.empty()) {
+      auto [item, virt] = std::move(pending.back());
+      pending.pop_back();
+
+      for (const auto& child : item->getChildren() | views::values) {
+        if (child->isDeleted()) {
+          continue;
+        }
+        string childVirtual        = joinPath(virt, child->fileName());
+        const string childRealPath = child->realPath();
+        const bool watched = ranges::any_of(m_roots, [&](const Root& root) {
+          return isBelow(childRealPath, root.path);
+        });
+
+        struct stat st = {};
+        if (watched && lstat(childRealPath.c_str(), &st) == -1 && errno == ENOENT) {
+          removed.emplace_back(child, std::move(childVirtual));
+        } else if (child->isDir()) {
+          pending.emplace_back(child, std::move(childVirtual));
+        }
+      }
+    }
+  } catch (const exception& e) {
+    logger::error("error rescanning {}: {}", m_state->mountpoint, e.what());
+  }
+
+  for (const auto& [item, virtualPath] : removed) {
+    const string realPath = item->realPath();
+    eraseItem(realPath, virtualPath);
+    if (item->isDir()) {
+      unwatchTree(realPath);
+    }
+  }
+
+  // watching a directory again keeps its watch, the contents created while events were
+  // lost are added
+  for (size_t i = 0; i < m_roots.size(); ++i) {
+    watchTree(i, m_roots[i].path, "/", true);
+  }
+}
+
+void Watcher::watchTree(size_t root, const string& realPath, const string& virtualPath,
+                        bool addItems) noexcept
+{
+  const SkipFunction& skip = m_roots[root].skip;
+
+  try {
+    // real and virtual paths of the directories left to watch
+    vector<pair<string, string>> pending;
+    pending.emplace_back(realPath, virtualPath);
+
+    while (!pending.empty()) {
+      auto [real, virt] = std::move(pending.back());
+      pending.pop_back();
+
+      const int wd = inotify_add_watch(m_fd, real.c_str(), watchMask);
+      if (wd == -1) {
+        // ENOSPC means fs.inotify.max_user_watches is exceeded
+        logger::warn("error watching {}: {}", real, strerror(errno));
+        continue;
+      }
+      m_watches.insert_or_assign(wd, Watch{real, virt, root});
+
+      error_code ec;
+      for (const fs::directory_entry& entry : fs::directory_iterator(real, ec)) {
+        const string name = entry.path().filename().string();
+        const Type type   = entry.is_directory(ec) ? dir : file;
+        if (skip && skip(name, type)) {
+          continue;
+        }
+
+        string itemVirtual = joinPath(virt, name);
+        if (addItems) {
+          addItem(entry.path().string(), itemVirtual, type);
+        }
+        // linked directories are not watched, so links cannot form cycles
+        if (type == dir && !entry.is_symlink(ec)) {
+          pending.emplace_back(entry.path().string(), std::move(itemVirtual));
+        }
+      }
+      if (ec) {
+        logger::warn("error reading directory {}: {}", real, ec.message());
+      }
+    }
+  } catch (const exception& e) {
+    logger::error("error watching {}: {}", realPath, e.what());
+  }
+}
+
+void Watcher::addItem(const string& realPath, const string& virtualPath,
+                      Type type) noexcept
+{
+  // items created through the mount are already in the tree, existing items from
+  // other directories are not replaced
+  if (m_state->fileTree->find(virtualPath) != nullptr) {
+    return;
+  }
+
+  DirId dirId = invalidDir;
+  if (type == dir) {
+    dirId = m_state->addDirectory(realPath);
+    if (dirId == invalidDir) {
+      return;
+    }
+  }
+
+  logger::debug("adding '{}' to file tree of {}", virtualPath, m_state->mountpoint);
+  const auto item = m_state->fileTree->add(virtualPath, realPath, type);
+  if (item == nullptr) {
+    logger::warn("error adding '{}' to file tree: {}", virtualPath, strerror(errno));
+    return;
+  }
+  item->setRealDirs(m_state->fdMap.id(getParentPath(realPath)), dirId);
+  m_changed.push_back(virtualPath);
+  m_added = true;
+}
+
+void Watcher::eraseItem(const string& realPath, const string& virtualPath) noexcept
+{
+  // items removed through the mount are already gone, items from other directories are
+  // kept
+  const auto item = m_state->fileTree->find(virtualPath);
+  if (item == nullptr || item->realPath() != realPath) {
+    return;
+  }
+
+  if (item->isDir()) {
+    for (const auto& [name, child] : item->getChildren()) {
+      const string childRealPath = child->realPath();
+      if (isBelow(childRealPath, realPath)) {
+        eraseItem(childRealPath, joinPath(virtualPath, child->fileName()));
+      }
+    }
+  }
+
+  logger::debug("erasing '{}' from file tree of {}", virtualPath, m_state->mountpoint);
+  if (!m_state->fileTree->erase(virtualPath)) {
+    // directories that still contain items of other directories are kept
+    logger::debug("error erasing '{}' from file tree: {}", virtualPath,
+                  strerror(errno));
+    return;
+  }
+  if (item->isDir()) {
+    // a directory created again at the path gets a new reference
+    m_state->fdMap.erase(realPath);
+  }
+  m_changed.push_back(virtualPath);
+}
+
+void Watcher::invalidateAttributes(const string& virtualPath) noexcept
+{
+  if (m_state->cacheOptions.attributeCacheTimeout <= 0) {
+    return;
+  }
+  if (const auto item = m_state->fileTree->find(virtualPath, true); item != nullptr) {
+    item->invalidateAttributes();
+  }
+}
+
+void Watcher::unwatchTree(const string& realPath) noexcept
+{
+  erase_if(m_watches, [&](const auto& entry) {
+    const auto& [wd, watch] = entry;
+    if (watch.realPath != realPath && !isBelow(watch.realPath, realPath)) {
+      return false;
+    }
+    inotify_rm_watch(m_fd, wd);
+    return true;
+  });
+}
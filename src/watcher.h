@@ -0,0 +1,98 @@
+#pragma once
+
+#include "treescanner.h"
+
+struct MountState;
+
+// keeps the file tree of a mount current while it is mounted by watching the real
+// directories it was built from with inotify. Events are collected into batches, which
+// add and erase the changed items, register new directories in the FdMap and queue the
+// invalidation of the kernel caches and the cached attributes of the changed paths
+//
+// Changes are applied without knowing the order the directories were linked in, so a
+// new file does not replace an existing item with the same virtual path, and a removed
+// file only erases the item if it was backed by that file
+class Watcher
+{
+public:
+  ~Watcher();
+
+  /**
+   * @brief Watch a directory tree that is linked to the root of the mount. Must be
+   * called before start
+   * @param realPath Real path of the directory
+   * @param skip Optional function that returns true for items that are not part of the
+   * file tree, skipped directories are not watched
+   */
+  void addRoot(std::string realPath, SkipFunction skip = {}) noexcept;
+
+  /**
+   * @brief Watch the roots and apply their changes in a separate thread. Has to be
+   * called before the mount is created, otherwise the watched destination directories
+   * would be the mounted ones
+   */
+  void start(MountState* state) noexcept;
+
+  // stop the thread, pending changes are discarded
+  void stop() noexcept;
+
+private:
+  struct Root
+  {
+    std::string path;
+    SkipFunction skip;
+  };
+
+  // a watched real directory and the virtual path it is linked to
+  struct Watch
+  {
+    std::string realPath;
+    std::string virtualPath;
+    size_t root;
+  };
+
+  struct Event
+  {
+    int wd;
+    uint32_t mask;
+    std::string name;
+  };
+
+  void run(const std::stop_token& stopToken) noexcept;
+
+  // read the queued events, returns false if there were none
+  bool readEvents(std::vector<Event>& events) noexcept;
+
+  void apply(const Event& event) noexcept;
+
+  // bring the file tree up to date after events were lost: items whose real files are
+  // gone are erased and the roots are watched again, which adds the missing items
+  void rescan() noexcept;
+
+  // watch a directory and the directories below it. If addItems is set the contents
+  // are also added to the file tree, which is used for directories that were created
+  // or moved into a watched directory
+  void watchTree(size_t root, const std::string& realPath,
+                 const std::string& virtualPath, bool addItems) noexcept;
+
+  void addItem(const std::string& realPath, const std::string& virtualPath,
+               Type type) noexcept;
+
+  void eraseItem(const std::string& realPath, const std::string& virtualPath) noexcept;
+
+  // drop the cached attributes of the item at a virtual path
+  void invalidateAttributes(const std::string& virtualPath) noexcept;
+
+  // stop watching a directory and the directories below it
+  void unwatchTree(const std::string& realPath) noexcept;
+
+  MountState* m_state = nullptr;
+  std::vector<Root> m_roots;
+  std::unordered_map<int, Watch> m_watches;
+  int m_fd = -1;
+  // virtual paths changed by the current batch and whether items were added, which
+  // clears the negative lookup cache
+  std::vector<std::string> m_changed;
+  bool m_added = false;
+  std::jthread m_thread;
+};
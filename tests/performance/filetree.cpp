@@ -1,12 +1,38 @@
+#include "../../src/fdmap.h"
+#include "../../src/utils.h"
 #include "../../src/virtualfiletreeitem.h"
 #include "benchmark_utils.h"
+#include <atomic>
 #include <benchmark/benchmark.h>
 #include <filesystem>
 #include <iostream>
+#include <malloc.h>
 
 using namespace std;
 namespace fs = std::filesystem;
 
+// count heap allocations to verify that lookups do not allocate memory
+static atomic<size_t> allocations = 0;
+
+void* operator new(size_t size)
+{
+  allocations.fetch_add(1, memory_order_relaxed);
+  if (void* p = malloc(size)) {
+    return p;
+  }
+  throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
 #define CREATE_FILE_TREE_WITH_DEPTH()                                                  \
   auto root     = VirtualFileTreeItem::create("/", "/tmp", dir);                       \
   int64_t depth = state.range(0);                                                      \
@@ -90,6 +116,38 @@ static void addMultipleItemsToFiletree(benchmark::State& state)
   }
 }
 
+// build a tree with the given number of directories containing 100 files each, like a
+// large mod setup, and report the heap memory used by the tree
+static void buildLargeFiletree(benchmark::State& state)
+{
+  static constexpr int filesPerDirectory = 100;
+  const int64_t directories              = state.range(0);
+
+  size_t bytes = 0;
+  for (auto _ : state) {
+    const size_t before = mallinfo2().uordblks;
+    START();
+    auto root = VirtualFileTreeItem::create("/", "/tmp", dir);
+    for (int64_t i = 0; i < directories; ++i) {
+      const string dirPath = "/dir" + to_string(i);
+      root->add(dirPath, "/tmp" + dirPath, dir);
+      for (int j = 0; j < filesPerDirectory; ++j) {
+        const string filePath = dirPath + "/file" + to_string(j) + ".dds";
+        root->add(filePath, "/tmp" + filePath, file);
+      }
+    }
+    END();
+    bytes = mallinfo2().uordblks - before;
+    benchmark::DoNotOptimize(root);
+  }
+
+  const int64_t items            = directories * (filesPerDirectory + 1);
+  state.counters["items"]        = static_cast<double>(items);
+  state.counters["bytes"]        = static_cast<double>(bytes);
+  state.counters["bytesPerItem"] = static_cast<double>(bytes) / items;
+  state.SetItemsProcessed(state.iterations() * items);
+}
+
 static void findInFiletree(benchmark::State& state)
 {
   CREATE_FILE_TREE_WITH_DEPTH();
@@ -100,6 +158,87 @@ static void findInFiletree(benchmark::State& state)
   }
 }
 
+static void findInIndexedFiletree(benchmark::State& state)
+{
+  CREATE_FILE_TREE_WITH_DEPTH();
+  root->setPathIndexEnabled(true);
+
+  for (auto _ : state) {
+    auto result = root->find(path);
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+// look up the same path from multiple threads, lookups do not lock the tree
+static void findConcurrently(benchmark::State& state)
+{
+  static shared_ptr<VirtualFileTreeItem> root;
+  static string path;
+  if (state.thread_index() == 0) {
+    root = VirtualFileTreeItem::create("/", "/tmp", dir);
+    path.clear();
+    for (int i = 0; i < 10; ++i) {
+      root->add(path + "/a", "/tmp" + path + "/a", dir);
+      root->add(path + "/b", "/tmp" + path + "/b", dir);
+      path += "/a";
+    }
+    root->setPathIndexEnabled(state.range(0) != 0);
+  }
+
+  for (auto _ : state) {
+    auto result = root->find(path);
+    benchmark::DoNotOptimize(result);
+  }
+
+  // summed over all threads
+  state.SetItemsProcessed(state.iterations());
+}
+
+// look up an upper case path and the directory of its real path like the operations
+// of the high level API do and report the heap allocations per lookup
+static void findWithoutAllocations(benchmark::State& state)
+{
+  CREATE_FILE_TREE_WITH_DEPTH();
+  const string upperPath = toUpper(path);
+  const string realPath  = toUpper("/tmp" + path);
+  FdMap fdMap(make_shared<DirFdCache>(16));
+  fdMap.insert("/tmp" + path);
+
+  // the first lookup sizes the buffers of this thread
+  benchmark::DoNotOptimize(root->find(upperPath));
+  benchmark::DoNotOptimize(fdMap.id(realPath));
+
+  const size_t before = allocations.load();
+  for (auto _ : state) {
+    auto result = root->find(upperPath);
+    benchmark::DoNotOptimize(result);
+    benchmark::DoNotOptimize(fdMap.id(realPath));
+  }
+  state.counters["allocations"] =
+      benchmark::Counter(static_cast<double>(allocations.load() - before),
+                         benchmark::Counter::kAvgIterations);
+}
+
+// look up the last entry of a directory with the given number of entries
+static void findInWideFiletree(benchmark::State& state)
+{
+  auto root           = VirtualFileTreeItem::create("/", "/tmp", dir);
+  const int64_t width = state.range(0);
+  root->add("/textures", "/tmp/textures", dir);
+  for (int64_t i = 0; i < width; ++i) {
+    const string path = "/textures/texture" + to_string(i) + ".dds";
+    if (root->add(path, "/tmp" + path, file) == nullptr) {
+      state.SkipWithError("error building file tree");
+    }
+  }
+
+  const string path = "/textures/texture" + to_string(width - 1) + ".dds";
+  for (auto _ : state) {
+    auto result = root->find(path);
+    benchmark::DoNotOptimize(result);
+  }
+}
+
 static void eraseFromFiletree(benchmark::State& state)
 {
   CREATE_FILE_TREE_WITH_DEPTH();
@@ -112,6 +251,80 @@ static void eraseFromFiletree(benchmark::State& state)
   }
 }
 
+// erase every entry of a directory with the given number of entries
+static void eraseFromWideFiletree(benchmark::State& state)
+{
+  const int64_t width = state.range(0);
+  for (auto _ : state) {
+    auto root = VirtualFileTreeItem::create("/", "/tmp", dir);
+    root->add("/textures", "/tmp/textures", dir);
+    for (int64_t i = 0; i < width; ++i) {
+      const string path = "/textures/texture" + to_string(i) + ".dds";
+      if (root->add(path, "/tmp" + path, file) == nullptr) {
+        state.SkipWithError("error building file tree");
+      }
+    }
+
+    START();
+    for (int64_t i = 0; i < width; ++i) {
+      root->erase("/textures/texture" + to_string(i) + ".dds");
+    }
+    END();
+  }
+}
+
+// clone a tree and modify a deep path, only the items on the path are copied
+static void modifyCopiedFiletree(benchmark::State& state)
+{
+  CREATE_FILE_TREE_WITH_DEPTH();
+
+  for (auto _ : state) {
+    auto copy = root->clone();
+    START();
+    copy->add(path + "/new", "/tmp" + path + "/new", file);
+    END();
+    benchmark::DoNotOptimize(copy);
+  }
+}
+
+// merge the trees of the given number of mods into the tree of the destination like
+// usvfsVirtualLinkDirectoryStatic does, each mod has 10 directories with 100 files. The
+// second argument enables the path index of the destination tree like usvfs_init does
+static void mergeModFiletrees(benchmark::State& state)
+{
+  static constexpr int directoriesPerMod = 10;
+  static constexpr int filesPerDirectory = 100;
+  const int64_t mods                     = state.range(0);
+  const bool pathIndex                   = state.range(1) != 0;
+
+  vector<shared_ptr<VirtualFileTreeItem>> modTrees;
+  for (int64_t i = 0; i < mods; ++i) {
+    auto modTree = VirtualFileTreeItem::create("/", "/mods/" + to_string(i), dir);
+    for (int j = 0; j < directoriesPerMod; ++j) {
+      const string dirPath = "/dir" + to_string(j);
+      modTree->add(dirPath, "/tmp" + dirPath, dir);
+      for (int k = 0; k < filesPerDirectory; ++k) {
+        const string filePath = dirPath + "/mod" + to_string(i) + "file" + to_string(k);
+        modTree->add(filePath, "/tmp" + filePath, file);
+      }
+    }
+    modTrees.emplace_back(std::move(modTree));
+  }
+
+  for (auto _ : state) {
+    auto root = VirtualFileTreeItem::create("/", "/tmp", dir);
+    root->setPathIndexEnabled(pathIndex);
+    START();
+    for (const auto& modTree : modTrees) {
+      *root += *modTree;
+    }
+    END();
+    benchmark::DoNotOptimize(root);
+  }
+
+  state.SetItemsProcessed(state.iterations() * mods);
+}
+
 static void mergeFiletrees(benchmark::State& state)
 {
   auto a = VirtualFileTreeItem::create("/", "/tmp", dir);
@@ -138,17 +351,60 @@ static void mergeFiletrees(benchmark::State& state)
 BENCHMARK(createFiletree)->Name("filetree/create");
 BENCHMARK(copyEmptyFiletree)->Name("filetree/copyEmpty");
 BENCHMARK(copyFiletree)->Name("filetree/copy")->DenseRange(1, 10);
+BENCHMARK(modifyCopiedFiletree)
+    ->Name("filetree/copy/modify")
+    ->UseManualTime()
+    ->DenseRange(1, 10);
 BENCHMARK(addItemToFiletree)->Name("filetree/add")->UseManualTime();
 BENCHMARK(addMultipleItemsToFiletree)
     ->Name("filetree/addMultiple")
     ->UseManualTime()
     ->ArgsProduct({benchmark::CreateDenseRange(1, 5, 1),
                    benchmark::CreateDenseRange(1, 5, 1)});
-BENCHMARK(findInFiletree)->Name("filetree/find")->DenseRange(1, 10);
+BENCHMARK(buildLargeFiletree)
+    ->Name("filetree/buildLarge")
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(100)
+    ->Arg(3000);
+BENCHMARK(findInFiletree)
+    ->Name("filetree/find")
+    ->DenseRange(1, 10)
+    ->DenseRange(15, 30, 5);
+BENCHMARK(findInIndexedFiletree)
+    ->Name("filetree/find/indexed")
+    ->DenseRange(1, 10)
+    ->DenseRange(15, 30, 5);
+BENCHMARK(findConcurrently)
+    ->Name("filetree/find/concurrent")
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 32)
+    ->UseRealTime();
+BENCHMARK(findWithoutAllocations)
+    ->Name("filetree/find/allocations")
+    ->DenseRange(1, 10)
+    ->Arg(20);
+BENCHMARK(findInWideFiletree)
+    ->Name("filetree/find/wide")
+    ->RangeMultiplier(10)
+    ->Range(10, 100000);
 BENCHMARK(eraseFromFiletree)
     ->Name("filetree/erase")
     ->UseManualTime()
     ->DenseRange(1, 10);
+BENCHMARK(eraseFromWideFiletree)
+    ->Name("filetree/erase/wide")
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->RangeMultiplier(10)
+    ->Range(10, 100000);
 BENCHMARK(mergeFiletrees)->Name("filetree/merge")->UseManualTime();
+BENCHMARK(mergeModFiletrees)
+    ->Name("filetree/merge/mods")
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond)
+    ->ArgNames({"mods", "index"})
+    ->ArgsProduct({{10, 200}, {0, 1}});
 
 }  // namespace benchmarks
@@ -2,6 +2,7 @@
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
+#include <sys/stat.h>
 #include <thread>
 
 #include "usvfs-fuse/usvfsmanager.h"
@@ -15,6 +16,7 @@ static const fs::path base = fs::temp_directory_path() / "usvfs";
 static const fs::path src  = base / "src";
 static const fs::path mnt  = base / "mnt";
 static const fs::path file = src / "0" / "0.txt";
+static const fs::path dir  = src / "0" / "dir";
 
 static void DoSetup_usvfs(const benchmark::State&)
 {
@@ -32,6 +34,40 @@ static void DoSetup_usvfs(const benchmark::State&)
   this_thread::sleep_for(10ms);
 }
 
+static void DoSetup_usvfs_lowlevel(const benchmark::State& state)
+{
+  UsvfsManager::instance()->setUseLowLevelApi(true);
+  DoSetup_usvfs(state);
+}
+
+// every getattr reaches usvfs instead of being answered by the kernel, which is
+// either served from the attribute cache of usvfs or from the real file
+static void setAttributeCache(bool enabled)
+{
+  FuseCacheOptions options;
+  options.attrTimeout           = 0.0;
+  options.attributeCacheTimeout = enabled ? 60.0 : 0.0;
+  UsvfsManager::instance()->setCacheOptions(options);
+}
+
+static void DoSetup_usvfs_uncached(const benchmark::State& state)
+{
+  setAttributeCache(false);
+  DoSetup_usvfs(state);
+}
+
+static void DoSetup_usvfs_cached(const benchmark::State& state)
+{
+  setAttributeCache(true);
+  DoSetup_usvfs(state);
+}
+
+static void DoSetup_usvfs_lowlevel_cached(const benchmark::State& state)
+{
+  setAttributeCache(true);
+  DoSetup_usvfs_lowlevel(state);
+}
+
 static void DoSetup(const benchmark::State&)
 {
   fs::create_directories(file.parent_path());
@@ -40,6 +76,32 @@ static void DoSetup(const benchmark::State&)
   ofs << "test";
 }
 
+static void createDirectoryEntries(const benchmark::State& state)
+{
+  fs::create_directories(dir);
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    ofstream ofs(dir / (to_string(i) + ".txt"));
+  }
+}
+
+static void DoSetup_usvfs_readdir(const benchmark::State& state)
+{
+  createDirectoryEntries(state);
+  DoSetup_usvfs(state);
+}
+
+static void DoSetup_usvfs_readdir_cached(const benchmark::State& state)
+{
+  createDirectoryEntries(state);
+  DoSetup_usvfs_cached(state);
+}
+
+static void DoSetup_readdir(const benchmark::State& state)
+{
+  DoSetup(state);
+  createDirectoryEntries(state);
+}
+
 static void DoTeardown_usvfs(const benchmark::State&)
 {
   auto usvfs = UsvfsManager::instance();
@@ -47,6 +109,24 @@ static void DoTeardown_usvfs(const benchmark::State&)
   fs::remove_all(base);
 }
 
+static void DoTeardown_usvfs_lowlevel(const benchmark::State& state)
+{
+  DoTeardown_usvfs(state);
+  UsvfsManager::instance()->setUseLowLevelApi(false);
+}
+
+static void DoTeardown_usvfs_cached(const benchmark::State& state)
+{
+  DoTeardown_usvfs(state);
+  UsvfsManager::instance()->setCacheOptions({});
+}
+
+static void DoTeardown_usvfs_lowlevel_cached(const benchmark::State& state)
+{
+  DoTeardown_usvfs_lowlevel(state);
+  UsvfsManager::instance()->setCacheOptions({});
+}
+
 static void DoTeardown(const benchmark::State&)
 {
   fs::remove_all(base);
@@ -60,10 +140,67 @@ static void open(benchmark::State& state)
   }
 }
 
+static void statFile(benchmark::State& state, const fs::path& path)
+{
+  struct stat st;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(::stat(path.c_str(), &st));
+  }
+}
+
+// list a directory and get the attributes of each entry, like ls -l
+static void listDirectory(benchmark::State& state, const fs::path& path)
+{
+  for (auto _ : state) {
+    for (const auto& entry : fs::directory_iterator(path)) {
+      benchmark::DoNotOptimize(entry.symlink_status());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
 BENCHMARK(open)->Name("usvfs/open")->Setup(DoSetup)->Teardown(DoTeardown);
 BENCHMARK(open)
     ->Name("usvfs/usvfs_open")
     ->Setup(DoSetup_usvfs)
     ->Teardown(DoTeardown_usvfs);
+BENCHMARK(open)
+    ->Name("usvfs/usvfs_open_lowlevel")
+    ->Setup(DoSetup_usvfs_lowlevel)
+    ->Teardown(DoTeardown_usvfs_lowlevel);
+BENCHMARK_CAPTURE(statFile, native, file)
+    ->Name("usvfs/stat")
+    ->Setup(DoSetup)
+    ->Teardown(DoTeardown);
+BENCHMARK_CAPTURE(statFile, usvfs, mnt / "0.txt")
+    ->Name("usvfs/usvfs_stat")
+    ->Setup(DoSetup_usvfs_uncached)
+    ->Teardown(DoTeardown_usvfs_cached);
+BENCHMARK_CAPTURE(statFile, usvfs_cached, mnt / "0.txt")
+    ->Name("usvfs/usvfs_stat_cached")
+    ->Setup(DoSetup_usvfs_cached)
+    ->Teardown(DoTeardown_usvfs_cached);
+BENCHMARK_CAPTURE(statFile, usvfs_lowlevel_cached, mnt / "0.txt")
+    ->Name("usvfs/usvfs_stat_lowlevel_cached")
+    ->Setup(DoSetup_usvfs_lowlevel_cached)
+    ->Teardown(DoTeardown_usvfs_lowlevel_cached);
+BENCHMARK_CAPTURE(listDirectory, native, dir)
+    ->Name("usvfs/readdir")
+    ->Arg(1000)
+    ->Arg(20000)
+    ->Setup(DoSetup_readdir)
+    ->Teardown(DoTeardown);
+BENCHMARK_CAPTURE(listDirectory, usvfs, mnt / "dir")
+    ->Name("usvfs/usvfs_readdir")
+    ->Arg(1000)
+    ->Arg(20000)
+    ->Setup(DoSetup_usvfs_readdir)
+    ->Teardown(DoTeardown_usvfs);
+BENCHMARK_CAPTURE(listDirectory, usvfs_cached, mnt / "dir")
+    ->Name("usvfs/usvfs_readdir_cached")
+    ->Arg(1000)
+    ->Arg(20000)
+    ->Setup(DoSetup_usvfs_readdir_cached)
+    ->Teardown(DoTeardown_usvfs_cached);
 
 }  // namespace benchmarks
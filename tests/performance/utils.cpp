@@ -6,14 +6,27 @@ using namespace std;
 
 namespace benchmarks
 {
+// paths of the length found in large mod setups, for measuring throughput
+static constexpr const char* longPath =
+    "/home/user/.local/share/ModOrganizer/Skyrim Special Edition/mods/Texture "
+    "Overhaul 4K/Textures/Architecture/Whiterun/WRWoodPlankDoor01_N.dds";
+static constexpr const char* longPathLower =
+    "/home/user/.local/share/modorganizer/skyrim special edition/mods/texture "
+    "overhaul 4k/textures/architecture/whiterun/wrwoodplankdoor01_n.dds";
+static constexpr const char* longPathUnicode =
+    "/home/user/.local/share/ModOrganizer/Skyrim Special Edition/mods/Texture "
+    "Overhaul 4K/Textures/Architecture/Weißlauf/WRWoodPlankDoor01_N.dds";
+
 template <class... Args>
 static void iequals(benchmark::State& state, Args&&... args)
 {
   auto args_tuple = std::make_tuple(std::move(args)...);
   for (auto _ : state) {
-    auto result = ::iequals(get<0>(args_tuple), get<0>(args_tuple));
+    auto result = ::iequals(get<0>(args_tuple), get<1>(args_tuple));
     benchmark::DoNotOptimize(result);
   }
+  state.SetBytesProcessed(state.iterations() *
+                          string_view(get<0>(args_tuple)).length());
 }
 
 template <class... Args>
@@ -21,9 +34,11 @@ static void iendsWith(benchmark::State& state, Args&&... args)
 {
   auto args_tuple = std::make_tuple(std::move(args)...);
   for (auto _ : state) {
-    auto result = ::iendsWith(get<0>(args_tuple), get<0>(args_tuple));
+    auto result = ::iendsWith(get<0>(args_tuple), get<1>(args_tuple));
     benchmark::DoNotOptimize(result);
   }
+  state.SetBytesProcessed(state.iterations() *
+                          string_view(get<1>(args_tuple)).length());
 }
 
 template <class... Args>
@@ -31,7 +46,7 @@ static void istartsWith(benchmark::State& state, Args&&... args)
 {
   auto args_tuple = std::make_tuple(std::move(args)...);
   for (auto _ : state) {
-    auto result = ::iendsWith(get<0>(args_tuple), get<0>(args_tuple));
+    auto result = ::istartsWith(get<0>(args_tuple), get<1>(args_tuple));
     benchmark::DoNotOptimize(result);
   }
 }
@@ -44,6 +59,8 @@ static void toLower(benchmark::State& state, Args&&... args)
     auto result = ::toLower(get<0>(args_tuple));
     benchmark::DoNotOptimize(result);
   }
+  state.SetBytesProcessed(state.iterations() *
+                          string_view(get<0>(args_tuple)).length());
 }
 
 template <class... Args>
@@ -57,6 +74,8 @@ static void toLowerInplace(benchmark::State& state, Args&&... args)
     benchmark::DoNotOptimize(str);
     END();
   }
+  state.SetBytesProcessed(state.iterations() *
+                          string_view(get<0>(args_tuple)).length());
 }
 
 template <class... Args>
@@ -109,21 +128,33 @@ static void createEnv(benchmark::State& state)
 BENCHMARK_CAPTURE(iequals, ascii, "abc", "aBC")->Name("utils/iequals/ascii");
 BENCHMARK_CAPTURE(iequals, unicode, "テストtest", "テストtESt")
     ->Name("utils/iequals/unicode");
+BENCHMARK_CAPTURE(iequals, asciiLong, longPath, longPathLower)
+    ->Name("utils/iequals/asciiLong");
+BENCHMARK_CAPTURE(iequals, unicodeLong, longPathUnicode, longPathUnicode)
+    ->Name("utils/iequals/unicodeLong");
 BENCHMARK_CAPTURE(iendsWith, ascii, "test", "ST")->Name("utils/iendsWith/ascii");
 BENCHMARK_CAPTURE(iendsWith, unicode, "テストtest", "ストtEST")
     ->Name("utils/iendsWith/unicode");
+BENCHMARK_CAPTURE(iendsWith, asciiLong, longPath, longPathLower + 20)
+    ->Name("utils/iendsWith/asciiLong");
 BENCHMARK_CAPTURE(istartsWith, ascii, "abc", "AB")->Name("utils/istartsWith/ascii");
 BENCHMARK_CAPTURE(istartsWith, unicode, "テストtest", "テストT")
     ->Name("utils/istartsWith/unicode");
 BENCHMARK_CAPTURE(toLower, ascii, "ABCDEFGHIJKLMNOPQRST")->Name("utils/toLower/ascii");
 BENCHMARK_CAPTURE(toLower, unicode, "ÄÜöabC/テスト/жзИЙ/ԱբգԴ")
     ->Name("utils/toLower/unicode");
+BENCHMARK_CAPTURE(toLower, asciiLong, longPath)->Name("utils/toLower/asciiLong");
+BENCHMARK_CAPTURE(toLower, unicodeLong, longPathUnicode)
+    ->Name("utils/toLower/unicodeLong");
 BENCHMARK_CAPTURE(toLowerInplace, ascii, "ABCDEFGHIJKLMNOPQRST")
     ->Name("utils/toLowerInplace/ascii")
     ->UseManualTime();
 BENCHMARK_CAPTURE(toLowerInplace, unicode, "ÄÜöabC/テスト/жзИЙ/ԱբգԴ")
     ->Name("utils/toLowerInplace/unicode")
     ->UseManualTime();
+BENCHMARK_CAPTURE(toLowerInplace, asciiLong, longPath)
+    ->Name("utils/toLowerInplace/asciiLong")
+    ->UseManualTime();
 BENCHMARK_CAPTURE(toUpper, ascii, "abcdefghijklmnopqrst")->Name("utils/toUpper/ascii");
 BENCHMARK_CAPTURE(toUpper, unicode, "ÄÜöabC/テスト/жзИЙ/ԱբգԴ")
     ->Name("utils/toUpper/unicode");
@@ -2,6 +2,8 @@
 #include <fstream>
 #include <gtest/gtest.h>
 #include <ostream>
+#include <ranges>
+#include <thread>
 
 #include "../../src/virtualfiletreeitem.h"
 #include "usvfs-fuse/logging.h"
@@ -342,6 +344,165 @@ TEST_F(FileTreeTest, CopyTree)
   EXPECT_EQ(ss.str(), expectedResult);
 }
 
+TEST_F(FileTreeTest, CopyIsIndependent)
+{
+  addItems();
+  auto copy = fileTree->clone();
+
+  // unchanged items are shared
+  EXPECT_EQ(fileTree->find("/2/2/1"), copy->find("/2/2/1"));
+
+  ASSERT_TRUE(copy->add("/2/2/2", "/tmp/b/b/b", dir));
+  ASSERT_TRUE(copy->add("/3/1", "/tmp/C/A", dir, true));
+  ASSERT_TRUE(copy->erase("/2/1", false));
+  ASSERT_TRUE(fileTree->erase("/2/3"));
+
+  EXPECT_EQ(find("/2/2/2"), "");
+  EXPECT_EQ(find(copy, "/2/2/2"), "/tmp/b/b/b");
+  EXPECT_EQ(find("/3/1"), "/tmp/c/a");
+  EXPECT_EQ(find(copy, "/3/1"), "/tmp/C/A");
+  EXPECT_EQ(find("/2/1"), "/tmp/b/a");
+  EXPECT_EQ(find(copy, "/2/1"), "");
+  EXPECT_EQ(find("/2/3"), "");
+  EXPECT_EQ(find(copy, "/2/3"), "/tmp/b/c");
+
+  // items that have not been modified are still shared
+  EXPECT_EQ(fileTree->find("/2/2/1"), copy->find("/2/2/1"));
+  EXPECT_NE(fileTree->find("/2/2"), copy->find("/2/2"));
+
+  // the parents of the shared items remain valid once the other tree is destroyed
+  fileTree.reset();
+  EXPECT_EQ(copy->find("/2/2/1")->filePath(), "/2/2/1");
+  EXPECT_EQ(copy->find("/1/1")->filePath(), "/1/1");
+}
+
+TEST_F(FileTreeTest, RemoveAndRestoreSharedDirectory)
+{
+  addItems();
+  fileTree->setPathIndexEnabled(true);
+  auto copy = fileTree->clone();
+
+  // removing a directory like rmdir only marks it as deleted in one tree
+  ASSERT_TRUE(fileTree->erase("/2/2/1", false));
+  EXPECT_EQ(find("/2/2/1"), "");
+  EXPECT_EQ(find(copy, "/2/2/1"), "/tmp/b/b/a");
+  EXPECT_FALSE(copy->find("/2/2/1")->isDeleted());
+
+  // restoring it like mkdir modifies the unshared copy
+  ASSERT_TRUE(copy->erase("/3/2/1", false));
+  const auto item = copy->unshare("/3/2/1");
+  ASSERT_NE(item, nullptr);
+  EXPECT_NE(item, fileTree->find("/3/2/1"));
+  item->setDeleted(false);
+  item->setName("A");
+  EXPECT_EQ(copy->find("/3/2/1"), item);
+  EXPECT_EQ(copy->find("/3/2/1")->fileName(), "A");
+  EXPECT_EQ(fileTree->find("/3/2/1")->fileName(), "1");
+
+  // looking up a path for modification copies the shared items on it
+  const auto shared = copy->find("/1/1");
+  ASSERT_EQ(shared, fileTree->find("/1/1"));
+  const auto unshared = copy->unshare("/1/1");
+  ASSERT_NE(unshared, nullptr);
+  EXPECT_NE(unshared, shared);
+  unshared->setRealPath("/tmp/x");
+  EXPECT_EQ(find(copy, "/1/1"), "/tmp/x");
+  EXPECT_EQ(find("/1/1"), "/tmp/a/a");
+  EXPECT_EQ(copy->unshare("/1/2"), nullptr);
+  EXPECT_EQ(errno, ENOENT);
+}
+
+TEST_F(FileTreeTest, MergeSharesItems)
+{
+  addItems();
+  auto newFileTree = VirtualFileTreeItem::create("/", "/tmp", dir);
+  ASSERT_TRUE(newFileTree->add("/3", "/tmp/3", dir));
+  ASSERT_TRUE(newFileTree->add("/3/3", "/tmp/3/3", dir));
+  ASSERT_TRUE(newFileTree->add("/3/3/3", "/tmp/3/3/3", dir));
+  ASSERT_TRUE(newFileTree->add("/4", "/tmp/4", dir));
+  *fileTree += *newFileTree;
+
+  EXPECT_EQ(fileTree->find("/3/3"), newFileTree->find("/3/3"));
+  EXPECT_EQ(fileTree->find("/4"), newFileTree->find("/4"));
+
+  // modifications of either tree are not visible in the other one
+  ASSERT_TRUE(newFileTree->add("/3/3/4", "/tmp/3/3/4", file));
+  ASSERT_TRUE(fileTree->erase("/4", false));
+  EXPECT_EQ(find("/3/3/4"), "");
+  EXPECT_EQ(find(newFileTree, "/3/3/4"), "/tmp/3/3/4");
+  EXPECT_EQ(find("/4"), "");
+  EXPECT_EQ(find(newFileTree, "/4"), "/tmp/4");
+
+  newFileTree.reset();
+  const auto item = fileTree->find("/3/3/3");
+  ASSERT_NE(item, nullptr);
+  EXPECT_EQ(item->filePath(), "/3/3/3");
+
+  // once the other tree is gone the items are modified in place
+  ASSERT_TRUE(fileTree->add("/3/3/3", "/tmp/x", dir, true));
+  EXPECT_EQ(fileTree->find("/3/3/3"), item);
+  EXPECT_EQ(item->realPath(), "/tmp/x");
+}
+
+TEST_F(FileTreeTest, RealDirs)
+{
+  addItems();
+  const auto item = fileTree->find("/2/2");
+  ASSERT_NE(item, nullptr);
+  EXPECT_EQ(item->realParentDir(), invalidDir);
+  EXPECT_EQ(item->realDir(), invalidDir);
+
+  item->setRealDirs(3u, 4u);
+  EXPECT_EQ(item->realParentDir(), 3u);
+  EXPECT_EQ(item->realDir(), 4u);
+
+  // copies of shared items keep the directories
+  auto copy = fileTree->clone();
+  ASSERT_TRUE(copy->add("/2/2/2", "/tmp/b/b/b", dir));
+  EXPECT_NE(copy->find("/2/2"), item);
+  EXPECT_EQ(copy->find("/2/2")->realDir(), 4u);
+
+  // the directories belong to the old real path
+  ASSERT_TRUE(fileTree->add("/2/2", "/tmp/x", dir, true));
+  EXPECT_EQ(fileTree->find("/2/2")->realParentDir(), invalidDir);
+  EXPECT_EQ(fileTree->find("/2/2")->realDir(), invalidDir);
+  EXPECT_EQ(copy->find("/2/2")->realDir(), 4u);
+}
+
+TEST_F(FileTreeTest, CachedAttributes)
+{
+  addItems();
+  const auto item = fileTree->find("/2/2");
+  ASSERT_NE(item, nullptr);
+
+  EpochGuard guard;
+  struct stat st = {};
+  EXPECT_FALSE(item->cachedAttributes(st));
+
+  struct stat real = {};
+  real.st_size     = 42;
+  item->cacheAttributes(real, item->attributesVersion(), 1h);
+  ASSERT_TRUE(item->cachedAttributes(st));
+  EXPECT_EQ(st.st_size, 42);
+
+  item->invalidateAttributes();
+  EXPECT_FALSE(item->cachedAttributes(st));
+
+  // attributes read before an invalidation are not cached
+  const uint64_t version = item->attributesVersion();
+  item->invalidateAttributes();
+  item->cacheAttributes(real, version, 1h);
+  EXPECT_FALSE(item->cachedAttributes(st));
+
+  item->cacheAttributes(real, item->attributesVersion(), 0s);
+  EXPECT_FALSE(item->cachedAttributes(st));
+
+  // the attributes belong to the old real path
+  item->cacheAttributes(real, item->attributesVersion(), 1h);
+  ASSERT_TRUE(fileTree->add("/2/2", "/tmp/x", dir, true));
+  EXPECT_FALSE(fileTree->find("/2/2")->cachedAttributes(st));
+}
+
 TEST_F(FileTreeTest, Erase)
 {
   addItems();
@@ -379,3 +540,276 @@ TEST_F(FileTreeTest, InsertAfterErase)
   ASSERT_NE(fileTree->add("/1/1", "/tmp/A/A"), nullptr);
   ASSERT_EQ(find("/1/1"), "/tmp/A/A");
 }
+
+TEST_F(FileTreeTest, Move)
+{
+  addItems();
+  fileTree->setPathIndexEnabled(true);
+  auto copy = fileTree->clone();
+
+  // the moved item and its children keep their identity, the other tree keeps its copy
+  const auto item  = fileTree->unshare("/2/2");
+  const auto child = fileTree->find("/2/2/1");
+  ASSERT_NE(item, nullptr);
+  ASSERT_EQ(fileTree->move("/2/2", "/3/4"), item);
+  EXPECT_EQ(fileTree->find("/2/2", true), nullptr);
+  EXPECT_EQ(fileTree->find("/2/2/1", true), nullptr);
+  EXPECT_EQ(fileTree->find("/3/4"), item);
+  EXPECT_EQ(fileTree->find("/3/4/1"), child);
+  EXPECT_EQ(item->filePath(), "/3/4");
+  EXPECT_EQ(find(copy, "/2/2/1"), "/tmp/b/b/a");
+  EXPECT_EQ(copy->find("/3/4"), nullptr);
+
+  // existing items are replaced
+  ASSERT_EQ(fileTree->move("/3/4", "/3/2"), item);
+  EXPECT_EQ(fileTree->find("/3/4"), nullptr);
+  EXPECT_EQ(fileTree->find("/3/2/1"), child);
+  EXPECT_EQ(find(copy, "/3/2/1"), "/tmp/c/b/a");
+
+  // exchanged items swap their names
+  const auto other = fileTree->unshare("/1");
+  ASSERT_EQ(fileTree->move("/3/2", "/1", true), item);
+  EXPECT_EQ(fileTree->find("/1/1"), child);
+  EXPECT_EQ(fileTree->find("/3/2"), other);
+  EXPECT_EQ(find("/3/2/1"), "/tmp/a/a");
+  EXPECT_EQ(other->fileName(), "2");
+  EXPECT_EQ(copy->find("/1")->fileName(), "1");
+
+  // changing the case only renames the item
+  ASSERT_EQ(fileTree->move("/1", "/A"), item);
+  ASSERT_EQ(fileTree->move("/A", "/a"), item);
+  EXPECT_EQ(item->fileName(), "a");
+  EXPECT_EQ(fileTree->find("/A/1"), child);
+
+  EXPECT_EQ(fileTree->move("/5", "/6"), nullptr);
+  EXPECT_EQ(errno, ENOENT);
+  EXPECT_EQ(fileTree->move("/a", "/a/1/2"), nullptr);
+  EXPECT_EQ(errno, EINVAL);
+  EXPECT_EQ(fileTree->move("/a", "/4", true), nullptr);
+  EXPECT_EQ(errno, ENOENT);
+}
+
+TEST_F(FileTreeTest, ConcurrentFindAndAdd)
+{
+  addItems();
+
+  atomic_bool failed = false;
+  vector<thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 1000; ++j) {
+        if (fileTree->find("/2/2/1") == nullptr || fileTree->find("/3/2") == nullptr) {
+          failed = true;
+        }
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    for (int j = 0; j < 1000; ++j) {
+      const string name = "new" + to_string(j);
+      if (fileTree->add("/3/2/" + name, "/tmp/c/b/" + name, file) == nullptr) {
+        failed = true;
+      }
+    }
+  });
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(fileTree->find("/3/2")->getChildren().size(), 1001);
+  EXPECT_EQ(find("/3/2/new999"), "/tmp/c/b/new999");
+}
+
+TEST_F(FileTreeTest, ConcurrentFindAndErase)
+{
+  addItems();
+  fileTree->setPathIndexEnabled(true);
+
+  atomic_bool failed = false;
+  atomic_bool done   = false;
+  vector<thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      while (!done) {
+        // the erased item is either found with its real path or not at all
+        if (const auto item = fileTree->find("/3/2/1");
+            item != nullptr && item->realPath() != "/tmp/c/b/a") {
+          failed = true;
+        }
+        if (fileTree->find("/2/2/1") == nullptr) {
+          failed = true;
+        }
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    for (int j = 0; j < 1000; ++j) {
+      if (!fileTree->erase("/3/2/1") ||
+          fileTree->add("/3/2/1", "/tmp/c/b/a", file) == nullptr) {
+        failed = true;
+      }
+      fileTree->find("/2/2")->setRealPath("/tmp/b/b" + to_string(j));
+    }
+    done = true;
+  });
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(find("/3/2/1"), "/tmp/c/b/a");
+  EXPECT_EQ(find("/2/2"), "/tmp/b/b999");
+}
+
+TEST_F(FileTreeTest, ConcurrentIterateAndErase)
+{
+  ASSERT_TRUE(fileTree->add("/dir", "/tmp/dir", dir));
+  for (int i = 0; i < 100; ++i) {
+    const string name = "keep" + to_string(i);
+    ASSERT_TRUE(fileTree->add("/dir/" + name, "/tmp/dir/" + name, file));
+  }
+
+  atomic_bool failed = false;
+  atomic_bool done   = false;
+  vector<thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      while (!done) {
+        // erased entries and compacted tables must not disturb the other entries
+        int kept = 0;
+        for (const auto& [name, child] : fileTree->find("/dir")->getChildren()) {
+          if (child == nullptr) {
+            failed = true;
+          } else if (name.starts_with("keep")) {
+            ++kept;
+          }
+        }
+        if (kept != 100 || fileTree->find("/dir/keep50") == nullptr) {
+          failed = true;
+        }
+      }
+    });
+  }
+  threads.emplace_back([&] {
+    for (int j = 0; j < 20; ++j) {
+      for (int k = 0; k < 500; ++k) {
+        const string name = "temp" + to_string(k);
+        if (fileTree->add("/dir/" + name, "/tmp/dir/" + name, file) == nullptr) {
+          failed = true;
+        }
+      }
+      for (int k = 0; k < 500; ++k) {
+        if (!fileTree->erase("/dir/temp" + to_string(k))) {
+          failed = true;
+        }
+      }
+    }
+    done = true;
+  });
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  EXPECT_FALSE(failed);
+  EXPECT_EQ(fileTree->find("/dir")->getChildren().size(), 100);
+}
+
+TEST_F(FileTreeTest, LargeDirectory)
+{
+  ASSERT_TRUE(fileTree->add("/dir", "/tmp/dir", dir));
+  for (int i = 0; i < 1000; ++i) {
+    const string name = "File" + to_string(i);
+    ASSERT_TRUE(fileTree->add("/dir/" + name, "/tmp/dir/" + name, file));
+  }
+
+  // erase entries from the middle of the directory
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 3 != 0 && i < 995) {
+      ASSERT_TRUE(fileTree->erase("/dir/file" + to_string(i)));
+    }
+  }
+  for (int i = 0; i < 1000; ++i) {
+    const string name = "file" + to_string(i);
+    if (i % 3 != 0 && i < 995) {
+      EXPECT_EQ(fileTree->find("/dir/" + name), nullptr);
+    } else {
+      EXPECT_EQ(find("/DIR/" + name), "/tmp/dir/File" + to_string(i));
+    }
+  }
+
+  // children are kept in insertion order
+  const auto children = fileTree->find("/dir")->getChildren();
+  ASSERT_EQ(children.size(), 337);
+  int previous = -1;
+  for (const auto& child : children | views::values) {
+    const int current = stoi(child->fileName().substr(4));
+    EXPECT_GT(current, previous);
+    previous = current;
+  }
+}
+
+TEST_F(FileTreeTest, PathIndex)
+{
+  addItems();
+  fileTree->setPathIndexEnabled(true);
+
+  EXPECT_EQ(find("/2/2/1"), "/tmp/b/b/a");
+  EXPECT_EQ(find("/3/2"), "/tmp/c/b");
+  ASSERT_TRUE(fileTree->add("/Ä", "/tmp/Ö", dir));
+  ASSERT_TRUE(fileTree->add("/Ä/Test", "/tmp/Ö/teST", dir));
+  EXPECT_EQ(find("/ä/TEST"), "/tmp/Ö/teST");
+  EXPECT_EQ(find("/Ä/test"), "/tmp/Ö/teST");
+  ASSERT_TRUE(fileTree->add("/Ä/Ωμέγα", "/tmp/Ö/ω", file));
+  EXPECT_EQ(find("/Ä/ΩΜΈΓΑ"), "/tmp/Ö/ω");
+  EXPECT_EQ(find("/ä/ωμέγα"), "/tmp/Ö/ω");
+
+  // deleted items are kept in the index
+  ASSERT_TRUE(fileTree->erase("/2", false));
+  EXPECT_EQ(fileTree->find("/2/2/1"), nullptr);
+  EXPECT_NE(fileTree->find("/2/2/1", true), nullptr);
+
+  // erased items are removed from the index together with their children
+  ASSERT_TRUE(fileTree->erase("/2", true));
+  EXPECT_EQ(fileTree->find("/2/2/1", true), nullptr);
+  EXPECT_EQ(fileTree->find("/2", true), nullptr);
+
+  // rename
+  ASSERT_TRUE(fileTree->add("/4", "/tmp/c/a", dir));
+  ASSERT_TRUE(fileTree->erase("/3/1"));
+  EXPECT_EQ(fileTree->find("/3/1", true), nullptr);
+  EXPECT_EQ(find("/4"), "/tmp/c/a");
+
+  // merge
+  auto newFileTree = VirtualFileTreeItem::create("/", "/tmp", dir);
+  ASSERT_TRUE(newFileTree->add("/3", "/tmp/3", dir));
+  ASSERT_TRUE(newFileTree->add("/3/3", "/tmp/3/3", dir));
+  ASSERT_TRUE(newFileTree->add("/3/3/3", "/tmp/3/3/3", dir));
+  *fileTree += *newFileTree;
+  EXPECT_EQ(find("/3"), "/tmp/3");
+  EXPECT_EQ(find("/3/3/3"), "/tmp/3/3/3");
+  EXPECT_EQ(find("/3/2/1"), "/tmp/c/b/a");
+
+  // the index is copied with the tree
+  auto copy = fileTree->clone();
+  ASSERT_TRUE(fileTree->erase("/3/3/3"));
+  EXPECT_EQ(find(copy, "/3/3/3"), "/tmp/3/3/3");
+  EXPECT_EQ(find("/3/3/3"), "");
+
+  // merging into shared items indexes the copies owned by the tree
+  auto other = VirtualFileTreeItem::create("/", "/tmp", dir);
+  ASSERT_TRUE(other->add("/1", "/tmp/m", dir));
+  ASSERT_TRUE(other->add("/1/1", "/tmp/m/m", dir));
+  ASSERT_TRUE(other->add("/1/1/5", "/tmp/m/m/m", file));
+  *copy += *other;
+  EXPECT_EQ(find(copy, "/1"), "/tmp/m");
+  EXPECT_EQ(find(copy, "/1/1/5"), "/tmp/m/m/m");
+  EXPECT_EQ(find(copy, "/1/1"), "/tmp/m/m");
+  EXPECT_NE(copy->find("/1/1"), fileTree->find("/1/1"));
+  EXPECT_EQ(find("/1"), "/tmp/a");
+  EXPECT_EQ(find("/1/1"), "/tmp/a/a");
+  EXPECT_EQ(find("/1/1/5"), "");
+}
@@ -1,9 +1,13 @@
+#include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <gtest/gtest.h>
 #include <ranges>
+#include <set>
 #include <sys/statvfs.h>
+#include <thread>
 
 #include "usvfs-fuse/usvfsmanager.h"
 
@@ -235,6 +239,15 @@ bool createFile(const string& path, const string& content)
   }
 }
 
+// wait until a change to a source directory shows up in the mount
+bool waitFor(const fs::path& path, bool exists)
+{
+  for (int i = 0; i < 50 && fs::exists(path) != exists; ++i) {
+    this_thread::sleep_for(20ms);
+  }
+  return fs::exists(path) == exists;
+}
+
 }  // namespace
 
 class UsvfsTest : public testing::Test
@@ -339,6 +352,31 @@ TEST_F(UsvfsTest, readdir)
   EXPECT_TRUE(runCmd("tree "s + mnt.c_str())) << "error: " << strerror(errno);
 }
 
+TEST_F(UsvfsTest, readdirLarge)
+{
+  // more entries than fit into a single readdir request
+  static constexpr int count = 2000;
+
+  createDir(mnt / "large_dir");
+  for (int i = 0; i < count; ++i) {
+    ASSERT_TRUE(createFile(mnt / "large_dir" / (to_string(i) + ".txt"), ""));
+  }
+
+  set<string> names;
+  for (const auto& entry : fs::directory_iterator(mnt / "large_dir")) {
+    EXPECT_TRUE(entry.is_regular_file());
+    names.insert(entry.path().filename());
+  }
+  EXPECT_EQ(names.size(), count);
+
+  // deleted entries must not be listed
+  unlinkFile(mnt / "large_dir/0.txt");
+  EXPECT_FALSE(ranges::any_of(fs::directory_iterator(mnt / "large_dir"),
+                              [](const auto& entry) {
+                                return entry.path().filename() == "0.txt";
+                              }));
+}
+
 TEST_F(UsvfsTest, mkdir)
 {
   createDir(mnt / "new_dir");
@@ -410,6 +448,32 @@ TEST_F(UsvfsTest, rename)
 
   // opening the original file should fail with ENOENT
   openFileWithFailure(mnt / "a.txt", ENOENT);
+
+  // items in subdirectories are renamed in the directory of their parent
+  EXPECT_EQ(rename((mnt / "a/a.txt").c_str(), (mnt / "a/asdf.txt").c_str()), 0)
+      << "error: " << strerror(errno);
+  readFile(mnt / "a/asdf.txt", "test a/a");
+  openFileWithFailure(mnt / "a/a.txt", ENOENT);
+
+  // directories are renamed along with their contents
+  createDir(mnt / "dir");
+  EXPECT_TRUE(createFile(mnt / "dir/file.txt", "dir"));
+  EXPECT_EQ(rename((mnt / "dir").c_str(), (mnt / "renamed_dir").c_str()), 0)
+      << "error: " << strerror(errno);
+  readFile(mnt / "renamed_dir/file.txt", "dir");
+  statPathWithFailure(mnt / "dir", ENOENT);
+  EXPECT_TRUE(createFile(mnt / "renamed_dir/new.txt", "new"));
+  readFile(mnt / "renamed_dir/new.txt", "new");
+
+  // exchanged items swap their contents
+  EXPECT_TRUE(createFile(mnt / "first.txt", "first"));
+  EXPECT_TRUE(createFile(mnt / "second.txt", "second"));
+  EXPECT_EQ(renameat2(AT_FDCWD, (mnt / "first.txt").c_str(), AT_FDCWD,
+                      (mnt / "second.txt").c_str(), RENAME_EXCHANGE),
+            0)
+      << "error: " << strerror(errno);
+  readFile(mnt / "first.txt", "second");
+  readFile(mnt / "second.txt", "first");
 }
 
 TEST_F(UsvfsTest, renameCaseInsensitive)
@@ -515,12 +579,468 @@ TEST_F(UsvfsTest, createCaseInsensitive)
   EXPECT_EQ(close(fd), 0);
 }
 
+TEST_F(UsvfsTest, readWriteLarge)
+{
+  // larger than a single FUSE request to exercise the read_buf and write_buf path
+  string content(4 * 1024 * 1024, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>('a' + i % 26);
+  }
+
+  const fs::path filePath = mnt / "large.bin";
+  ASSERT_TRUE(createFile(filePath, content));
+
+  ifstream ifs(filePath, ios::binary);
+  ASSERT_TRUE(ifs.is_open()) << "error opening file: " << strerror(errno);
+  const string readContent{istreambuf_iterator<char>(ifs), istreambuf_iterator<char>()};
+  EXPECT_EQ(readContent.size(), content.size());
+  EXPECT_TRUE(readContent == content);
+}
+
+TEST_F(UsvfsTest, negativeLookupCache)
+{
+  // missing paths are remembered until a path is created
+  statPathWithFailure(mnt / "probe.txt", ENOENT);
+  statPathWithFailure(mnt / "PROBE.TXT", ENOENT);
+  openFileWithFailure(mnt / "probe_dir", ENOENT);
+  openFileWithFailure(mnt / "renamed.txt", ENOENT);
+
+  EXPECT_TRUE(createFile(mnt / "probe.txt", "probe"));
+  readFile(mnt / "PROBE.TXT", "probe");
+
+  createDir(mnt / "probe_dir");
+  statPath(mnt / "PROBE_DIR");
+
+  ASSERT_EQ(rename((mnt / "probe.txt").c_str(), (mnt / "renamed.txt").c_str()), 0)
+      << strerror(errno);
+  readFile(mnt / "Renamed.txt", "probe");
+}
+
+TEST_F(UsvfsTest, copyFileRange)
+{
+  int in, out;
+  ASSERT_NE(in = open((mnt / "a.txt").c_str(), O_RDONLY), -1) << strerror(errno);
+  ASSERT_NE(out = open((mnt / "copy.txt").c_str(), O_WRONLY | O_CREAT | O_EXCL, mode),
+            -1)
+      << strerror(errno);
+
+  const string content = "test a";
+  EXPECT_EQ(copy_file_range(in, nullptr, out, nullptr, content.size(), 0),
+            static_cast<ssize_t>(content.size()))
+      << strerror(errno);
+  EXPECT_EQ(close(in), 0);
+  EXPECT_EQ(close(out), 0);
+
+  readFile(mnt / "copy.txt", content);
+}
+
+TEST_F(UsvfsTest, fallocateAndSeek)
+{
+  static constexpr off_t size = 1024 * 1024;
+
+  int fd;
+  ASSERT_NE(fd = open((mnt / "sparse.bin").c_str(), O_RDWR | O_CREAT | O_EXCL, mode),
+            -1)
+      << strerror(errno);
+
+  ASSERT_EQ(fallocate(fd, 0, 0, size), 0) << strerror(errno);
+  struct stat st{};
+  ASSERT_EQ(fstat(fd, &st), 0);
+  EXPECT_EQ(st.st_size, size);
+
+  // the file contains no holes, so the next hole is the end of the file
+  EXPECT_EQ(lseek(fd, 0, SEEK_DATA), 0) << strerror(errno);
+  EXPECT_EQ(lseek(fd, 0, SEEK_HOLE), size) << strerror(errno);
+  EXPECT_EQ(close(fd), 0);
+}
+
 TEST_F(UsvfsTest, statfs)
 {
   struct statvfs buf;
   EXPECT_GT(statvfs(mnt.c_str(), &buf), -1) << "error: " << strerror(errno);
 }
 
+// mounts created by the tests themselves with options that differ from the defaults.
+// The options of the manager are restored even if a test fails, so they do not leak
+// into the following tests
+class UsvfsOptionsTest : public testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    initLogging();
+    ASSERT_TRUE(createTmpDirs());
+  }
+  void TearDown() override
+  {
+    const auto usvfs = UsvfsManager::instance();
+    EXPECT_TRUE(usvfs->unmount());
+    usvfs->usvfsClearVirtualMappings();
+    usvfs->setFuseThreads(0, 0);
+    usvfs->setUseLowLevelApi(false);
+    usvfs->setCacheOptions({});
+    usvfs->setPassthrough(false);
+    usvfs->setTreeCacheDir({});
+    usvfs->setWatchSources(false);
+    usvfs->setDirectoryFdBudget(0);
+    EXPECT_TRUE(cleanup());
+  }
+
+  // link a source directory recursively
+  static bool link(const string& name, const fs::path& mountpoint = mnt)
+  {
+    return UsvfsManager::instance()->usvfsVirtualLinkDirectoryStatic(
+        (src / name).string(), mountpoint.string(), linkFlag::RECURSIVE);
+  }
+};
+
+TEST_F(UsvfsOptionsTest, MultithreadedMount)
+{
+  auto usvfs = UsvfsManager::instance();
+  usvfs->setFuseThreads(4, 2);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(link("b"));
+  ASSERT_TRUE(usvfs->mount());
+
+  vector<thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([] {
+      for (int j = 0; j < 100; ++j) {
+        readFile(mnt / "a.txt", "test a");
+        readFile(mnt / "A/A.txt", "test a/a");
+        statPath(mnt / "b.txt");
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+TEST_F(UsvfsOptionsTest, ConcurrentCreateAndLookup)
+{
+  // a lookup that missed before a path was created must not remember the path as
+  // missing once it exists
+  auto usvfs = UsvfsManager::instance();
+  usvfs->setFuseThreads(4, 2);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(usvfs->mount());
+
+  static constexpr int fileCount = 200;
+
+  const auto fileName = [](int i) {
+    return mnt / ("race_" + to_string(i) + ".txt");
+  };
+
+  atomic_bool done = false;
+  vector<thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&] {
+      struct stat st{};
+      while (!done) {
+        for (int j = 0; j < fileCount; ++j) {
+          stat(fileName(j).c_str(), &st);
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < fileCount; ++i) {
+    EXPECT_TRUE(createFile(fileName(i), "race"));
+  }
+  done = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (int i = 0; i < fileCount; ++i) {
+    statPath(fileName(i));
+  }
+}
+
+TEST_F(UsvfsOptionsTest, CacheOptions)
+{
+  auto usvfs = UsvfsManager::instance();
+
+  FuseCacheOptions options;
+  options.entryTimeout    = 60.0;
+  options.attrTimeout     = 60.0;
+  options.negativeTimeout = 60.0;
+  options.kernelCache     = true;
+  usvfs->setCacheOptions(options);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(usvfs->mount());
+
+  statPath(mnt / "a.txt");
+  readFile(mnt / "a.txt", "test a");
+  readFile(mnt / "a.txt", "test a");
+
+  // changes made through the mount must be visible despite the caches
+  statPathWithFailure(mnt / "new_file.txt", ENOENT);
+  EXPECT_TRUE(createFile(mnt / "new_file.txt", "new"));
+  readFile(mnt / "new_file.txt", "new");
+  unlinkFile(mnt / "a.txt");
+  statPathWithFailure(mnt / "a.txt", ENOENT);
+}
+
+TEST_F(UsvfsOptionsTest, AttributeCache)
+{
+  // every getattr reaches usvfs, which answers it from the cached attributes
+  auto usvfs = UsvfsManager::instance();
+  FuseCacheOptions options;
+  options.attrTimeout           = 0.0;
+  options.attributeCacheTimeout = 60.0;
+  usvfs->setCacheOptions(options);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(usvfs->mount());
+
+  const fs::path path = mnt / "a.txt";
+  EXPECT_EQ(fs::file_size(path), 6u);
+
+  // changes made through the mount drop the cached attributes
+  EXPECT_EQ(chmod(path.c_str(), 0600), 0) << strerror(errno);
+  EXPECT_EQ(fs::status(path).permissions() & fs::perms::all,
+            fs::perms::owner_read | fs::perms::owner_write);
+  EXPECT_TRUE(createFile(path, "changed content"));
+  EXPECT_EQ(fs::file_size(path), 15u);
+  EXPECT_EQ(truncate(path.c_str(), 2), 0) << strerror(errno);
+  EXPECT_EQ(fs::file_size(path), 2u);
+
+  // changes made outside of it are only seen once the attributes expire
+  EXPECT_TRUE(createFile(src / "a/a.txt", "test a"));
+  EXPECT_EQ(fs::file_size(path), 2u);
+}
+
+TEST_F(UsvfsOptionsTest, Passthrough)
+{
+  // falls back to serving files from the daemon if passthrough is not available
+  auto usvfs = UsvfsManager::instance();
+  usvfs->setPassthrough(true);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(usvfs->mount());
+
+  // open the same file multiple times so the backing file is shared
+  int fd;
+  ASSERT_NE(fd = open((mnt / "a.txt").c_str(), O_RDONLY), -1) << strerror(errno);
+  readFile(mnt / "a.txt", "test a");
+  readFile(mnt / "A.TXT", "test a");
+  EXPECT_EQ(close(fd), 0);
+
+  EXPECT_TRUE(createFile(mnt / "new_file.txt", "new"));
+  readFile(mnt / "new_file.txt", "new");
+}
+
+TEST_F(UsvfsOptionsTest, LowLevelMount)
+{
+  auto usvfs = UsvfsManager::instance();
+  usvfs->setUseLowLevelApi(true);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(link("b"));
+  ASSERT_TRUE(usvfs->mount());
+
+  for (const auto& [filePath, content] : filesToCheck) {
+    if (filePath.parent_path() == mnt2) {
+      continue;
+    }
+    readFile(filePath, content);
+  }
+  for (const auto& [filePath, content] : filesToCheckCaseInsensitive) {
+    if (filePath.parent_path() == mnt2) {
+      continue;
+    }
+    readFile(filePath, content);
+  }
+  statPath(mnt / "empty_dir");
+  statPathWithFailure(mnt / "DOES_NOT_EXIST", ENOENT);
+  EXPECT_TRUE(runCmd("tree "s + mnt.c_str()));
+}
+
+TEST_F(UsvfsOptionsTest, LowLevelWriteOperations)
+{
+  auto usvfs = UsvfsManager::instance();
+  usvfs->setUseLowLevelApi(true);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(link("b"));
+  ASSERT_TRUE(usvfs->mount());
+
+  EXPECT_TRUE(createFile(mnt / "new_file.txt", "new"));
+  readFile(mnt / "NEW_FILE.txt", "new");
+
+  createDir(mnt / "new_dir");
+  createDir(mnt / "NEW_DIR/b");
+  createDirWithFailure(mnt / "a", EEXIST);
+  createDirWithFailure(mnt / "b/c/d/e", ENOENT);
+
+  unlinkFile(mnt / "a.txt");
+  statPathWithFailure(mnt / "a.txt", ENOENT);
+  unlinkFileWithFailure(mnt / "a", EISDIR);
+  unlinkDirWithFailure(mnt / "a", ENOTEMPTY);
+  unlinkDir(mnt / "empty_dir");
+  statPathWithFailure(mnt / "empty_dir", ENOENT);
+
+  // a removed directory can be created again
+  createDir(mnt / "empty_dir");
+  statPath(mnt / "empty_dir");
+
+  EXPECT_EQ(rename((mnt / "b.txt").c_str(), (mnt / "renamed.txt").c_str()), 0)
+      << "error: " << strerror(errno);
+  readFile(mnt / "renamed.txt", "test b");
+  openFileWithFailure(mnt / "b.txt", ENOENT);
+
+  // directories are renamed along with their contents, the kernel keeps its entries
+  // below them
+  const int dirFd = open((mnt / "a").c_str(), O_RDONLY | O_DIRECTORY);
+  ASSERT_NE(dirFd, -1) << strerror(errno);
+  statPath(mnt / "a/a.txt");
+  EXPECT_EQ(rename((mnt / "a").c_str(), (mnt / "renamed_dir").c_str()), 0)
+      << "error: " << strerror(errno);
+  readFile(mnt / "renamed_dir/a.txt", "test a/a");
+  EXPECT_EQ(faccessat(dirFd, "a.txt", F_OK, 0), 0) << strerror(errno);
+  close(dirFd);
+  statPathWithFailure(mnt / "a", ENOENT);
+
+  EXPECT_EQ(symlink("renamed.txt", (mnt / "link.txt").c_str()), 0) << strerror(errno);
+  readFile(mnt / "link.txt", "test b");
+  EXPECT_EQ(::link((mnt / "renamed.txt").c_str(), (mnt / "hardlink.txt").c_str()), 0)
+      << strerror(errno);
+  readFile(mnt / "hardlink.txt", "test b");
+
+  EXPECT_EQ(renameat2(AT_FDCWD, (mnt / "renamed.txt").c_str(), AT_FDCWD,
+                      (mnt / "new_file.txt").c_str(), RENAME_EXCHANGE),
+            0)
+      << strerror(errno);
+  readFile(mnt / "renamed.txt", "new");
+  readFile(mnt / "new_file.txt", "test b");
+  EXPECT_TRUE(runCmd("tree "s + mnt.c_str()));
+}
+
+TEST_F(UsvfsOptionsTest, TreeCache)
+{
+  const fs::path cacheDir = base / "cache";
+  auto usvfs              = UsvfsManager::instance();
+  usvfs->setTreeCacheDir(cacheDir);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(usvfs->mount());
+  EXPECT_TRUE(usvfs->unmount());
+  EXPECT_FALSE(fs::is_empty(cacheDir));
+
+  // the changed directory is read again, the unchanged ones are taken from the cache
+  EXPECT_TRUE(createFile(src / "a/new_file.txt", "new"));
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(usvfs->mount());
+
+  readFile(mnt / "a.txt", "test a");
+  readFile(mnt / "a/a.txt", "test a/a");
+  readFile(mnt / "new_file.txt", "new");
+  readFile(mnt / "already_existed.txt", "test already_existed");
+  statPath(mnt / "empty_dir");
+}
+
+TEST_F(UsvfsOptionsTest, DirectoryFdBudget)
+{
+  // the source directories have to be opened again once another one was used
+  auto usvfs = UsvfsManager::instance();
+  usvfs->setDirectoryFdBudget(1);
+  const DirectoryFdStats before = usvfs->directoryFdStats();
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(link("b"));
+  ASSERT_TRUE(usvfs->mount());
+
+  for (const auto& [filePath, content] : filesToCheck) {
+    if (filePath.parent_path() == mnt2) {
+      continue;
+    }
+    readFile(filePath, content);
+  }
+  statPath(mnt / "empty_dir");
+
+  const DirectoryFdStats after = usvfs->directoryFdStats();
+  EXPECT_LE(after.open, 1u);
+  EXPECT_GT(after.misses, before.misses);
+  EXPECT_GT(after.evictions, before.evictions);
+}
+
+TEST_F(UsvfsOptionsTest, SharedDirectoryFds)
+{
+  // linking the same source into another mount does not open its directories again
+  auto usvfs = UsvfsManager::instance();
+  ASSERT_TRUE(link("a"));
+  const DirectoryFdStats first = usvfs->directoryFdStats();
+  ASSERT_TRUE(link("a", mnt2));
+  const DirectoryFdStats second = usvfs->directoryFdStats();
+  EXPECT_EQ(second.open, first.open);
+  ASSERT_TRUE(usvfs->mount());
+
+  readFile(mnt / "a/a.txt", "test a/a");
+  readFile(mnt2 / "a/a.txt", "test a/a");
+
+  EXPECT_TRUE(usvfs->unmount());
+  const DirectoryFdStats after = usvfs->directoryFdStats();
+  EXPECT_EQ(after.open, 0u);
+  EXPECT_EQ(after.pinned, 0u);
+}
+
+TEST_F(UsvfsOptionsTest, WatchSources)
+{
+  auto usvfs = UsvfsManager::instance();
+  usvfs->setWatchSources(true);
+
+  ASSERT_TRUE(link("a"));
+  ASSERT_TRUE(usvfs->mount());
+
+  EXPECT_TRUE(createFile(src / "a/watched.txt", "watched"));
+  EXPECT_TRUE(waitFor(mnt / "watched.txt", true));
+  readFile(mnt / "WATCHED.TXT", "watched");
+
+  fs::create_directories(src / "a/watched_dir");
+  EXPECT_TRUE(createFile(src / "a/watched_dir/watched.txt", "watched dir"));
+  EXPECT_TRUE(waitFor(mnt / "watched_dir/watched.txt", true));
+  readFile(mnt / "watched_dir/watched.txt", "watched dir");
+
+  EXPECT_TRUE(fs::remove(src / "a/a/a.txt"));
+  EXPECT_TRUE(waitFor(mnt / "a/a.txt", false));
+  statPathWithFailure(mnt / "a/a.txt", ENOENT);
+}
+
+TEST_F(UsvfsOptionsTest, WatchSourcesWithNegativeTimeout)
+{
+  // failed lookups cached by the kernel must not hide files added to the sources
+  for (const bool lowLevel : {false, true}) {
+    auto usvfs = UsvfsManager::instance();
+    FuseCacheOptions options;
+    options.negativeTimeout = 60.0;
+    usvfs->setCacheOptions(options);
+    usvfs->setUseLowLevelApi(lowLevel);
+    usvfs->setWatchSources(true);
+
+    ASSERT_TRUE(link("a"));
+    ASSERT_TRUE(usvfs->mount());
+
+    const string name = lowLevel ? "watched_ll.txt" : "watched.txt";
+    statPathWithFailure(mnt / name, ENOENT);
+    statPathWithFailure(mnt / "a" / name, ENOENT);
+
+    EXPECT_TRUE(createFile(src / "a" / name, "watched"));
+    EXPECT_TRUE(createFile(src / "a/a" / name, "watched"));
+    EXPECT_TRUE(waitFor(mnt / name, true));
+    EXPECT_TRUE(waitFor(mnt / "a" / name, true));
+    readFile(mnt / name, "watched");
+    readFile(mnt / "a" / name, "watched");
+
+    EXPECT_TRUE(usvfs->unmount());
+    usvfs->usvfsClearVirtualMappings();
+  }
+}
+
 TEST(usvfs, CreateProcessHooked)
 {
   initLogging();
@@ -1,4 +1,7 @@
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "../../src/utils.h"
 
@@ -43,6 +46,18 @@ TEST(utils, toLower)
   EXPECT_EQ(toLower("テスト"), "テスト");
 }
 
+TEST(utils, toLowerBuffer)
+{
+  string buffer;
+  EXPECT_EQ(toLower("aBc", buffer), "abc");
+  EXPECT_EQ(toLower("ÄÜöabC", buffer), "äüöabc");
+  EXPECT_EQ(toLower("TÊŚT", buffer), "têśt");
+  EXPECT_EQ(toLower("テスト", buffer), "テスト");
+  // the result is longer than the input
+  EXPECT_EQ(toLower("İ", buffer), "i̇");
+  EXPECT_EQ(toLower("", buffer), "");
+}
+
 TEST(utils, toLowerInplace)
 {
   auto test = [](const char* testString, const char* result) {
@@ -79,6 +94,46 @@ TEST(utils, toUpperInplace)
   test("テスト", "テスト");
 }
 
+TEST(utils, longStrings)
+{
+  // long enough to be processed in blocks of 32 and 16 bytes and a remainder, with the
+  // characters next to the letter ranges
+  const string upper = "/DATA/TEXTURES/ARMOR/@STEEL[PLATE]`/CUIRASS_01{Z}.DDS";
+  const string lower = "/data/textures/armor/@steel[plate]`/cuirass_01{z}.dds";
+
+  EXPECT_EQ(toLower(upper), lower);
+  EXPECT_EQ(toUpper(lower), upper);
+  EXPECT_TRUE(iequals(upper, lower));
+  EXPECT_TRUE(iendsWith("/mods" + upper, lower));
+  EXPECT_FALSE(iequals(upper, lower.substr(0, lower.length() - 1) + "t"));
+  EXPECT_FALSE(iequals("/data/textures/armor/@steel[plate]@",
+                       "/data/textures/armor/`steel[plate]`"));
+
+  // non ASCII characters after the first block
+  EXPECT_EQ(toLower(upper + "/ÄÖ"), lower + "/äö");
+  EXPECT_EQ(toUpper(lower + "/äö"), upper + "/ÄÖ");
+  EXPECT_TRUE(iequals(upper + "/ÄÖ", lower + "/äö"));
+  EXPECT_FALSE(iequals(upper + "/ÄÖ", lower + "/äü"));
+}
+
+TEST(utils, specialCaseMappings)
+{
+  // the encoded length changes, title case letters
+  EXPECT_EQ(toLower("ȺK"), "ⱥk");
+  EXPECT_TRUE(iequals("ǄǅK", "ǆǆK"));
+
+  // context dependent lower case mapping
+  EXPECT_EQ(toLower("ΣΑΣ"), "σας");
+  EXPECT_TRUE(iequals("ΣΑΣ", "σας"));
+
+  // full case folding
+  EXPECT_TRUE(iequals("straße", "STRASSE"));
+  EXPECT_EQ(toLower("STRAẞE"), "straße");
+
+  // invalid UTF-8 is left unchanged
+  EXPECT_EQ(toLower("A\xff"), "a\xff");
+}
+
 TEST(utils, getParentPath)
 {
   EXPECT_EQ(getParentPath("/a"), "");
@@ -92,3 +147,35 @@ TEST(utils, getFileNameFromPath)
   EXPECT_EQ(getFileNameFromPath("/a/b"), "b");
   EXPECT_EQ(getFileNameFromPath("/a/b/c"), "c");
 }
+
+TEST(utils, statAttributes)
+{
+  for (const char* path : {"/proc/self/exe", "/tmp", "/dev/null"}) {
+    struct stat expected{};
+    ASSERT_EQ(fstatat(AT_FDCWD, path, &expected, AT_SYMLINK_NOFOLLOW), 0);
+
+    for (const bool dontSync : {false, true}) {
+      struct stat st{};
+      ASSERT_EQ(statAttributes(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW, dontSync, &st), 0);
+      EXPECT_EQ(st.st_mode, expected.st_mode);
+      EXPECT_EQ(st.st_nlink, expected.st_nlink);
+      EXPECT_EQ(st.st_uid, expected.st_uid);
+      EXPECT_EQ(st.st_gid, expected.st_gid);
+      EXPECT_EQ(st.st_rdev, expected.st_rdev);
+      EXPECT_EQ(st.st_size, expected.st_size);
+      EXPECT_EQ(st.st_mtim.tv_sec, expected.st_mtim.tv_sec);
+      EXPECT_EQ(st.st_mtim.tv_nsec, expected.st_mtim.tv_nsec);
+    }
+  }
+
+  const int fd = open("/tmp", O_PATH | O_DIRECTORY);
+  ASSERT_NE(fd, -1);
+  struct stat st{};
+  EXPECT_EQ(statAttributes(fd, "", AT_SYMLINK_NOFOLLOW | AT_EMPTY_PATH, false, &st), 0);
+  EXPECT_TRUE(S_ISDIR(st.st_mode));
+  close(fd);
+
+  errno = 0;
+  EXPECT_EQ(statAttributes(AT_FDCWD, "/does/not/exist", 0, false, &st), -1);
+  EXPECT_EQ(errno, ENOENT);
+}